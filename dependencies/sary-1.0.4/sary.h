@@ -3,10 +3,12 @@
 
 #include <sary/array.h>
 #include <sary/bsearch.h>
+#include <sary/bucket.h>
 #include <sary/builder.h>
 #include <sary/cache.h>
 #include <sary/i.h>
 #include <sary/ipoint.h>
+#include <sary/lcp.h>
 #include <sary/merger.h>
 #include <sary/mkqsort.h>
 #include <sary/mmap.h>
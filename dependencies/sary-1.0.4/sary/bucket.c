@@ -0,0 +1,318 @@
+/*
+ * sary - a suffix array library
+ *
+ * $Id$
+ *
+ * Copyright (C) 2000  Satoru Takabayashi <satoru@namazu.org>
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Prefix bucket tables.
+ *
+ * A binary search over the whole array spends its first
+ * probes telling apart the first few bytes of the
+ * pattern, each on a different page of the array and the
+ * text.  The bucket table answers that part with a single
+ * lookup: for every string of `width' bytes it holds the
+ * rank of the first suffix not smaller than that string,
+ * so the suffixes starting with a prefix are the ranks
+ * between its entry and the next one.
+ *
+ * A suffix shorter than `width' is counted as if it were
+ * padded with \0, which keeps the keys in array order; it
+ * lands in a bucket it does not really match, but a
+ * search inside the bucket still sorts it correctly.
+ *
+ * File format (all integers big-endian):
+ *   "SARYBKT1"  magic
+ *   SaryInt     number of index points of the array
+ *   guint32     fingerprint of the array
+ *   guint32     width, 1 to 3
+ *   SaryInt[256^width + 1]  first rank of each bucket
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <sary.h>
+
+enum { BUCKET_HEADER_SIZE = 20 };
+enum { BUCKET_MAX_WIDTH = 3 };
+enum { NSAMPLES = 64 };
+
+static const gchar magic[] = "SARYBKT1";
+
+struct _SaryBucket {
+    SaryMmap	*mobj;
+    gint	width;
+    SaryInt	*start;  /* big-endian */
+};
+
+static guint32	fingerprint	(SaryInt *array, SaryInt len);
+static guint32	key_of		(const gchar *pos,
+				 const gchar *eof,
+				 gint width);
+
+/**
+ * sary_bucket_build:
+ * @file_name: file name of the text.
+ * @array_name: file name of the sorted suffix array.
+ * @bucket_name: file name of the bucket table to be written.
+ * @width: length of the prefixes, 1 to 3.
+ *
+ * Write the ranges of the suffixes of @array_name starting with each
+ * @width byte prefix to @bucket_name. The table takes 4 * 256^@width
+ * bytes: 256 KB for the default width of 2, 64 MB for 3.
+ *
+ * Returns: %FALSE if an error occurred, %TRUE on success.
+ *
+ **/
+gboolean
+sary_bucket_build (const gchar *file_name,
+		   const gchar *array_name,
+		   const gchar *bucket_name,
+		   gint width)
+{
+    SaryText *text;
+    SaryMmap *array;
+    SaryInt *ary, *start;
+    SaryInt len, i;
+    guint32 nkeys, next, key;
+    guchar header[BUCKET_HEADER_SIZE];
+    guint32 fp_be, width_be;
+    SaryInt len_be;
+    gchar *eof;
+    FILE *fp;
+    gboolean status = TRUE;
+
+    g_assert(file_name != NULL && array_name != NULL && 
+	     bucket_name != NULL);
+    g_assert(width >= 1 && width <= BUCKET_MAX_WIDTH);
+
+    text = sary_text_new(file_name);
+    if (text == NULL) {
+	return FALSE;
+    }
+    array = sary_mmap(array_name, "r");
+    if (array == NULL) {
+	sary_text_destroy(text);
+	return FALSE;
+    }
+
+    ary   = (SaryInt *)array->map;
+    len   = array->len / sizeof(SaryInt);
+    eof   = sary_text_get_eof(text);
+    nkeys = 1 << (8 * width);
+    start = g_new(SaryInt, nkeys + 1);
+
+    /*
+     * One pass in array order: every key up to that of a
+     * suffix starts at its rank at the latest.
+     */
+    next = 0;
+    for (i = 0; i < len; i++) {
+	key = key_of(sary_i_text(text, ary + i), eof, width);
+	while (next <= key) {
+	    start[next++] = GINT_TO_BE(i);
+	}
+    }
+    while (next <= nkeys) {
+	start[next++] = GINT_TO_BE(len);
+    }
+
+    memcpy(header, magic, 8);
+    len_be   = GINT_TO_BE(len);
+    fp_be    = GUINT32_TO_BE(fingerprint(ary, len));
+    width_be = GUINT32_TO_BE(width);
+    memcpy(header + 8,  &len_be, 4);
+    memcpy(header + 12, &fp_be, 4);
+    memcpy(header + 16, &width_be, 4);
+
+    fp = fopen(bucket_name, "w");
+    if (fp == NULL) {
+	status = FALSE;
+    } else {
+	fwrite(header, 1, BUCKET_HEADER_SIZE, fp);
+	fwrite(start, sizeof(SaryInt), nkeys + 1, fp);
+	if (ferror(fp)) {
+	    status = FALSE;
+	}
+	if (fclose(fp) != 0) {
+	    status = FALSE;
+	}
+    }
+
+    g_free(start);
+    sary_munmap(array);
+    sary_text_destroy(text);
+
+    return status;
+}
+
+/**
+ * sary_bucket_new:
+ * @bucket_name: file name of the bucket table.
+ * @array: the mapped suffix array which the table was built for.
+ *
+ * Load the bucket table written by sary_bucket_build. The table is
+ * rejected if it does not match @array.
+ *
+ * Returns: a new #SaryBucket; NULL if the file is missing or stale.
+ *
+ **/
+SaryBucket *
+sary_bucket_new (const gchar *bucket_name, SaryMmap *array)
+{
+    SaryBucket *bucket;
+    SaryMmap *mobj;
+    SaryInt len, len_be;
+    guint32 fp_be, width_be, width;
+
+    g_assert(bucket_name != NULL && array != NULL);
+
+    len = array->len / sizeof(SaryInt);
+    if (len == 0) {
+	return NULL;
+    }
+
+    mobj = sary_mmap(bucket_name, "r");
+    if (mobj == NULL) {
+	return NULL;
+    }
+    if (mobj->len < BUCKET_HEADER_SIZE ||
+	memcmp(mobj->map, magic, 8) != 0) {
+	sary_munmap(mobj);
+	return NULL;
+    }
+    memcpy(&len_be,   (gchar *)mobj->map + 8,  4);
+    memcpy(&fp_be,    (gchar *)mobj->map + 12, 4);
+    memcpy(&width_be, (gchar *)mobj->map + 16, 4);
+    width = GUINT32_FROM_BE(width_be);
+    if (width < 1 || width > BUCKET_MAX_WIDTH ||
+	mobj->len != BUCKET_HEADER_SIZE + 
+	((1 << (8 * width)) + 1) * sizeof(SaryInt) ||
+	GINT_FROM_BE(len_be) != len ||
+	GUINT32_FROM_BE(fp_be) != fingerprint(array->map, len)) {
+	sary_munmap(mobj);
+	return NULL;
+    }
+
+    bucket = g_new(SaryBucket, 1);
+    bucket->mobj  = mobj;
+    bucket->width = width;
+    bucket->start = (SaryInt *)((gchar *)mobj->map + BUCKET_HEADER_SIZE);
+
+    return bucket;
+}
+
+/**
+ * sary_bucket_destroy:
+ * @bucket: a #SaryBucket to be destructed.
+ *
+ * Destructs the @bucket.
+ *
+ **/
+void
+sary_bucket_destroy (SaryBucket *bucket)
+{
+    if (bucket != NULL) {
+	sary_munmap(bucket->mobj);
+	g_free(bucket);
+    }
+}
+
+/**
+ * sary_bucket_range:
+ * @bucket: a #SaryBucket.
+ * @pattern: pattern.
+ * @len: length of @pattern; must be positive.
+ * @first: the rank of the first suffix of the range is stored here.
+ *
+ * Find the range of the suffix array which holds every suffix starting
+ * with @pattern. The range is exact as far as the first bytes of
+ * @pattern, up to the width of the table, are concerned; a binary
+ * search inside it finds the occurrences.
+ *
+ * Returns: the number of suffixes in the range.
+ *
+ **/
+SaryInt
+sary_bucket_range (SaryBucket *bucket,
+		   const gchar *pattern,
+		   SaryInt len,
+		   SaryInt *first)
+{
+    guint32 low = 0, high = 0;
+    gint i;
+
+    g_assert(bucket != NULL && pattern != NULL && len > 0);
+
+    /*
+     * A pattern shorter than the width spans the buckets
+     * of all its paddings.
+     */
+    for (i = 0; i < bucket->width; i++) {
+	if (i < len) {
+	    low  = (low  << 8) | (guchar)pattern[i];
+	    high = (high << 8) | (guchar)pattern[i];
+	} else {
+	    low  = low  << 8;
+	    high = (high << 8) | 0xff;
+	}
+    }
+
+    *first = GINT_FROM_BE(bucket->start[low]);
+    return GINT_FROM_BE(bucket->start[high + 1]) - *first;
+}
+
+/*
+ * Sample the array evenly, as lcp.c does, so that a table
+ * left behind by an older array is detected.
+ */
+static guint32
+fingerprint (SaryInt *array, SaryInt len)
+{
+    guint32 h = len;
+    SaryInt i, step;
+
+    step = len / NSAMPLES + 1;
+    for (i = 0; i < len; i += step) {
+	h = (h << 5) - h + (guint32)array[i];
+    }
+    if (len > 0) {
+	h = (h << 5) - h + (guint32)array[len - 1];
+    }
+    return h;
+}
+
+static guint32
+key_of (const gchar *pos, const gchar *eof, gint width)
+{
+    guint32 key = 0;
+    gint i;
+
+    for (i = 0; i < width; i++) {
+	key <<= 8;
+	if (pos + i < eof) {
+	    key |= (guchar)pos[i];
+	}
+    }
+    return key;
+}
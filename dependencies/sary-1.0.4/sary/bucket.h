@@ -0,0 +1,32 @@
+#ifndef __SARY_BUCKET_H__
+#define __SARY_BUCKET_H__
+
+#include <glib.h>
+#include <sary/mmap.h>
+#include <sary/saryconfig.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct _SaryBucket	SaryBucket;
+
+#define SARY_BUCKET_DEFAULT_WIDTH	2
+
+gboolean	sary_bucket_build	(const gchar *file_name,
+					 const gchar *array_name,
+					 const gchar *bucket_name,
+					 gint width);
+SaryBucket*	sary_bucket_new		(const gchar *bucket_name,
+					 SaryMmap *array);
+void		sary_bucket_destroy	(SaryBucket *bucket);
+SaryInt		sary_bucket_range	(SaryBucket *bucket,
+					 const gchar *pattern,
+					 SaryInt len,
+					 SaryInt *first);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __SARY_BUCKET_H__ */
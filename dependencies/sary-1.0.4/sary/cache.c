@@ -23,60 +23,449 @@
  */
 
 #include "config.h"
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <glib.h>
 #include <sary.h>
 
+/*
+ * The cache maps patterns to their search results, stored
+ * as ranks in the suffix array so that they mean the same
+ * to every process mapping the array.  A result with
+ * first > last records a pattern that was not found.
+ *
+ * A private cache is a hash table of its own copies of the
+ * patterns, threaded on a list from the most to the least
+ * recently used; the least recently used entry is dropped
+ * when the cache is full.
+ *
+ * A shared cache lives in a file mapped by every process
+ * using it.  The file is a set-associative table of
+ * SHARED_WAYS slots per set.  Each slot has a sequence
+ * number that is odd while the slot is written; a reader
+ * that sees the number change takes the slot as a miss.  The slot least recently used in its set
+ * is replaced.  Patterns longer than SHARED_KEYMAX bytes
+ * are not shared.
+ */
+
+#define SHARED_MAGIC	"SARYSHC1"
+#define SHARED_WAYS	4
+#define SHARED_KEYMAX	112
+#define NSAMPLES	64
+
+typedef struct _Entry Entry;
+struct _Entry {
+    SaryPattern	pattern;  /* pattern.str is owned */
+    SaryInt	first;
+    SaryInt	last;
+    Entry	*prev;
+    Entry	*next;
+};
+
+typedef struct {
+    gchar		magic[8];
+    guint32		nsets;
+    guint32		array_len;
+    guint32		fingerprint;
+    volatile guint32	clock;
+} SharedHeader;
+
+typedef struct {
+    volatile guint32	seq;
+    volatile guint32	stamp;	/* 0 if empty */
+    guint32		hash;
+    SaryInt		len;
+    SaryInt		first;
+    SaryInt		last;
+    gchar		key[SHARED_KEYMAX];
+} SharedSlot;
+
+struct _SaryCache {
+    /* private */
+    GHashTable	*table;
+    Entry	*head;
+    Entry	*tail;
+    SaryInt	size;
+    SaryInt	max_entries;
+
+    /* shared */
+    SaryMmap	 *shared;
+    SharedHeader *header;
+    SharedSlot	 *slots;
+};
+
 static void	destroy_element	(gpointer key, 
 				 gpointer value, 
 				 gpointer use_data);
 static guint	pattern_hash	(gconstpointer key);
 static gint	pattern_equal	(gconstpointer v, gconstpointer v2);
+static void	unlink_entry	(SaryCache *cache, Entry *entry);
+static void	push_entry	(SaryCache *cache, Entry *entry);
+static gboolean	shared_get	(SaryCache *cache, 
+				 const gchar *pattern, 
+				 SaryInt len,
+				 SaryInt *first,
+				 SaryInt *last);
+static void	shared_add	(SaryCache *cache, 
+				 const gchar *pattern,
+				 SaryInt len,
+				 SaryInt first,
+				 SaryInt last);
+static guint32	fingerprint	(SaryMmap *array);
 
 
 SaryCache *
 sary_cache_new (void)
 {
-    return g_hash_table_new(pattern_hash, pattern_equal);
+    return sary_cache_new2(SARY_CACHE_DEFAULT_SIZE);
+}
+
+SaryCache *
+sary_cache_new2 (SaryInt max_entries)
+{
+    SaryCache *cache = g_new0(SaryCache, 1);
+
+    cache->table = g_hash_table_new(pattern_hash, pattern_equal);
+    cache->max_entries = MAX(max_entries, 1);
+    return cache;
+}
+
+/*
+ * Open or create the shared cache @cache_name for @array.
+ * A file made for another array is replaced by a new one,
+ * built under another name and renamed over it, so that
+ * processes still mapping the old file keep it whole.  The
+ * geometry of an existing file wins over @max_entries.
+ */
+SaryCache *
+sary_cache_new_shared (const gchar *cache_name, 
+		       SaryInt max_entries, 
+		       SaryMmap *array)
+{
+    SaryCache *cache;
+    SaryMmap *shared;
+    SharedHeader header;
+    struct stat st, named;
+    guint32 nsets, array_len, fp;
+    gint fd, tmp_fd;
+    gchar *tmp_name;
+    gboolean valid;
+
+    array_len = array->len / sizeof(SaryInt);
+    fp = fingerprint(array);
+
+    for (;;) {
+	fd = open(cache_name, O_RDWR | O_CREAT, 0666);
+	if (fd < 0) {
+	    return NULL;
+	}
+	if (lockf(fd, F_LOCK, 0) < 0 || fstat(fd, &st) < 0) {
+	    close(fd);
+	    return NULL;
+	}
+	/* the file may have been replaced while we waited */
+	if (stat(cache_name, &named) == 0 &&
+	    named.st_dev == st.st_dev && named.st_ino == st.st_ino) {
+	    break;
+	}
+	close(fd);
+    }
+
+    valid = (st.st_size >= sizeof(SharedHeader) &&
+	     pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+	     memcmp(header.magic, SHARED_MAGIC, 8) == 0 &&
+	     header.nsets > 0 &&
+	     st.st_size == sizeof(SharedHeader) + 
+	     (off_t)header.nsets * SHARED_WAYS * sizeof(SharedSlot) &&
+	     header.array_len == array_len && 
+	     header.fingerprint == fp);
+
+    if (valid) {
+	shared = sary_mmap(cache_name, "r+");
+    } else {
+	for (nsets = 1; nsets * SHARED_WAYS < max_entries; nsets *= 2)
+	    ;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SHARED_MAGIC, 8);
+	header.nsets = nsets;
+	header.array_len = array_len;
+	header.fingerprint = fp;
+	header.clock = 0;
+
+	/* a new file is all empty slots; the lock on the old one
+	 * is held until the new one has taken its name */
+	tmp_name = g_strdup_printf("%s.%d", cache_name, (int)getpid());
+	tmp_fd = open(tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (tmp_fd < 0) {
+	    g_free(tmp_name);
+	    close(fd);
+	    return NULL;
+	}
+	shared = NULL;
+	if (ftruncate(tmp_fd, sizeof(SharedHeader) + 
+		      (off_t)nsets * SHARED_WAYS * sizeof(SharedSlot)) == 0 &&
+	    pwrite(tmp_fd, &header, sizeof(header), 0) == sizeof(header)) {
+	    shared = sary_mmap(tmp_name, "r+");
+	}
+	close(tmp_fd);
+	if (shared != NULL && rename(tmp_name, cache_name) < 0) {
+	    sary_munmap(shared);
+	    shared = NULL;
+	}
+	if (shared == NULL) {
+	    unlink(tmp_name);
+	}
+	g_free(tmp_name);
+    }
+    close(fd);  /* releases the lock */
+    if (shared == NULL) {
+	return NULL;
+    }
+
+    cache = g_new0(SaryCache, 1);
+    cache->shared = shared;
+    cache->header = (SharedHeader *)cache->shared->map;
+    cache->slots  = (SharedSlot *)(cache->header + 1);
+    return cache;
 }
 
 void
 sary_cache_destroy (SaryCache *cache)
 {
-    if (cache != NULL) {
-	g_hash_table_foreach(cache, destroy_element, NULL);
-	g_hash_table_destroy(cache);
+    if (cache == NULL) {
+	return;
     }
+    if (cache->shared != NULL) {
+	sary_munmap(cache->shared);
+    } else {
+	g_hash_table_foreach(cache->table, destroy_element, NULL);
+	g_hash_table_destroy(cache->table);
+    }
+    g_free(cache);
 }
 
-SaryResult *
-sary_cache_get (SaryCache *cache, const gchar *pattern, SaryInt len)
+/*
+ * Look up @pattern. On a hit, set *@first and *@last to the
+ * ranks of its first and last occurrences (first > last if
+ * it does not occur) and return TRUE.
+ */
+gboolean
+sary_cache_get (SaryCache *cache, 
+		const gchar *pattern, 
+		SaryInt len,
+		SaryInt *first,
+		SaryInt *last)
 {
     SaryPattern key;
+    Entry *entry;
+
+    if (cache->shared != NULL) {
+	return shared_get(cache, pattern, len, first, last);
+    }
 
     key.str = (gchar *)pattern;
     key.len = len;
+    entry = (Entry *)g_hash_table_lookup(cache->table, &key);
+    if (entry == NULL) {
+	return FALSE;
+    }
 
-    return (SaryResult *)g_hash_table_lookup(cache, &key);
+    unlink_entry(cache, entry);
+    push_entry(cache, entry);
+    *first = entry->first;
+    *last  = entry->last;
+    return TRUE;
 }
 
 void
 sary_cache_add (SaryCache *cache, 
 		const gchar *pattern,
 		SaryInt len,
-		SaryInt *first,
-		SaryInt *last)
+		SaryInt first,
+		SaryInt last)
+{
+    SaryPattern key;
+    Entry *entry;
+
+    if (cache->shared != NULL) {
+	shared_add(cache, pattern, len, first, last);
+	return;
+    }
+
+    key.str = (gchar *)pattern;
+    key.len = len;
+    entry = (Entry *)g_hash_table_lookup(cache->table, &key);
+    if (entry != NULL) {
+	unlink_entry(cache, entry);
+    } else {
+	if (cache->size >= cache->max_entries) {
+	    /* reuse the least recently used entry */
+	    entry = cache->tail;
+	    unlink_entry(cache, entry);
+	    g_hash_table_remove(cache->table, &entry->pattern);
+	    g_free((gchar *)entry->pattern.str);
+	    cache->size--;
+	} else {
+	    entry = g_new(Entry, 1);
+	}
+	entry->pattern.str  = g_malloc(MAX(len, 1));
+	entry->pattern.len  = len;
+	entry->pattern.skip = 0;
+	g_memmove((gchar *)entry->pattern.str, pattern, len);
+	g_hash_table_insert(cache->table, &entry->pattern, entry);
+	cache->size++;
+    }
+    entry->first = first;
+    entry->last  = last;
+    push_entry(cache, entry);
+}
+
+/*
+ * Private functions.
+ */
+static void
+unlink_entry (SaryCache *cache, Entry *entry)
+{
+    if (entry->prev != NULL) {
+	entry->prev->next = entry->next;
+    } else {
+	cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+	entry->next->prev = entry->prev;
+    } else {
+	cache->tail = entry->prev;
+    }
+}
+
+static void
+push_entry (SaryCache *cache, Entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+	cache->head->prev = entry;
+    } else {
+	cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+static gboolean
+shared_get (SaryCache *cache, 
+	    const gchar *pattern, 
+	    SaryInt len,
+	    SaryInt *first,
+	    SaryInt *last)
 {
-    SaryResult *item  = g_new(SaryResult, 1);
-    SaryPattern *key = g_new(SaryPattern, 1);
+    SharedSlot *set, *slot;
+    SaryPattern key;
+    guint32 hash, seq;
+    gint i;
 
-    key->str = pattern;
-    key->len = len;
+    if (len > SHARED_KEYMAX) {
+	return FALSE;
+    }
+    key.str = (gchar *)pattern;
+    key.len = len;
+    hash = pattern_hash(&key);
+    set  = cache->slots + (hash & (cache->header->nsets - 1)) * SHARED_WAYS;
 
-    item->first    = first;
-    item->last     = last;
+    for (i = 0; i < SHARED_WAYS; i++) {
+	SaryInt slot_first, slot_last;
+	gboolean match;
 
-    g_hash_table_insert(cache, key, item);
+	slot = set + i;
+	seq  = slot->seq;
+	if (seq & 1) {
+	    continue;
+	}
+	__sync_synchronize();
+	match = (slot->stamp != 0 && slot->hash == hash && slot->len == len &&
+		 memcmp(slot->key, pattern, len) == 0);
+	slot_first = slot->first;
+	slot_last  = slot->last;
+	__sync_synchronize();
+	if (match && slot->seq == seq) {
+	    slot->stamp = __sync_add_and_fetch(&cache->header->clock, 1);
+	    *first = slot_first;
+	    *last  = slot_last;
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+static void
+shared_add (SaryCache *cache, 
+	    const gchar *pattern,
+	    SaryInt len,
+	    SaryInt first,
+	    SaryInt last)
+{
+    SharedSlot *set, *slot, *victim;
+    SaryPattern key;
+    guint32 hash, seq;
+    gint i;
+
+    if (len > SHARED_KEYMAX) {
+	return;
+    }
+    key.str = (gchar *)pattern;
+    key.len = len;
+    hash = pattern_hash(&key);
+    set  = cache->slots + (hash & (cache->header->nsets - 1)) * SHARED_WAYS;
+
+    victim = set;
+    for (i = 0; i < SHARED_WAYS; i++) {
+	slot = set + i;
+	if (slot->stamp == 0) {
+	    victim = slot;
+	    break;
+	}
+	if (slot->stamp < victim->stamp) {
+	    victim = slot;
+	}
+    }
+
+    /* give up if another process is writing the slot */
+    seq = victim->seq;
+    if ((seq & 1) || !__sync_bool_compare_and_swap(&victim->seq, seq, seq + 1)) {
+	return;
+    }
+    victim->hash  = hash;
+    victim->len   = len;
+    victim->first = first;
+    victim->last  = last;
+    memcpy(victim->key, pattern, len);
+    victim->stamp = __sync_add_and_fetch(&cache->header->clock, 1);
+    __sync_synchronize();
+    victim->seq = seq + 2;
+}
+
+/*
+ * Sample the array evenly, as lcp.c does, so that a cache
+ * left behind by an older array is detected.
+ */
+static guint32
+fingerprint (SaryMmap *array)
+{
+    SaryInt *ary = (SaryInt *)array->map;
+    SaryInt len  = array->len / sizeof(SaryInt);
+    guint32 h = len;
+    SaryInt i, step;
+
+    step = len / NSAMPLES + 1;
+    for (i = 0; i < len; i += step) {
+	h = (h << 5) - h + (guint32)ary[i];
+    }
+    if (len > 0) {
+	h = (h << 5) - h + (guint32)ary[len - 1];
+    }
+    return h;
 }
 
 /* 
@@ -114,6 +503,8 @@ destroy_element (gpointer element,
 		 gpointer value, 
 		 gpointer use_data)
 {
-    SaryPattern *elt = (SaryPattern *)element;
-    g_free(elt);
+    Entry *entry = (Entry *)value;
+
+    g_free((gchar *)entry->pattern.str);
+    g_free(entry);
 }
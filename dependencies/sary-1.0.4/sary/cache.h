@@ -9,18 +9,26 @@
 extern "C" {
 #endif /* __cplusplus */
 
-typedef GHashTable	SaryCache;
+typedef struct _SaryCache	SaryCache;
+
+#define SARY_CACHE_DEFAULT_SIZE	4096
 
 SaryCache*	sary_cache_new		(void);
+SaryCache*	sary_cache_new2		(SaryInt max_entries);
+SaryCache*	sary_cache_new_shared	(const gchar *cache_name,
+					 SaryInt max_entries,
+					 SaryMmap *array);
 void		sary_cache_destroy	(SaryCache *cache);
-SaryResult*	sary_cache_get		(SaryCache *cache, 
+gboolean	sary_cache_get		(SaryCache *cache, 
 					 const gchar *pattern, 
-					 SaryInt len);
-void		sary_cache_add		(SaryCache *cache, 
-					 const gchar *pattern,
 					 SaryInt len,
 					 SaryInt *first,
 					 SaryInt *last);
+void		sary_cache_add		(SaryCache *cache, 
+					 const gchar *pattern,
+					 SaryInt len,
+					 SaryInt first,
+					 SaryInt last);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,542 @@
+/*
+ * sary - a suffix array library
+ *
+ * $Id$
+ *
+ * Copyright (C) 2000  Satoru Takabayashi <satoru@namazu.org>
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * LCP-LR tables for Manber-Myers style searching.
+ *
+ * The binary search in bsearch.c always visits the same
+ * implicit tree: the root interval is (-1, len) and every
+ * interval (low, high) is split at mid = (low + high) / 2.
+ * Every index of the array is the mid of exactly one
+ * interval, so two bytes per index are enough to store
+ * Llcp = lcp(SA[low], SA[mid]) and Rlcp = lcp(SA[mid],
+ * SA[high]).  The virtual boundaries -1 and len have an lcp
+ * of 0 with everything.  Values are capped at LCP_MAX.
+ *
+ * Knowing the lcp of the pattern with both ends of the
+ * current interval, the search can decide most probes
+ * without touching the text, and never re-compares a
+ * byte of the pattern which is already known to match, so
+ * a search costs O(len + log n) instead of O(len * log n).
+ *
+ * File format (all integers big-endian):
+ *   "SARYLCP1"  magic
+ *   SaryInt     number of index points of the array
+ *   guint32     fingerprint of the array
+ *   guint8[2n]  Llcp and Rlcp interleaved for each index
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <sary.h>
+
+enum { LCP_MAX = 255 };
+enum { LCP_HEADER_SIZE = 16 };
+enum { NSAMPLES = 64 };
+
+static const gchar magic[] = "SARYLCP1";
+
+typedef struct {
+    SaryInt	low;
+    SaryInt	high;
+    SaryInt	l;
+    SaryInt	r;
+} Interval;
+
+struct _SaryLcp {
+    SaryMmap	*mobj;
+    SaryInt	*array;
+    SaryInt	len;
+    guint8	*lr;
+};
+
+static guint32	fingerprint	(SaryInt *array, SaryInt len);
+static guint8	lcp_of		(const gchar *pos1,
+				 const gchar *pos2,
+				 const gchar *eof);
+static guint8	fill_lr		(guint8 *lr,
+				 const guint8 *adjacent,
+				 SaryInt len,
+				 SaryInt low,
+				 SaryInt high);
+static SaryInt	pattern_lcp	(SaryLcp *lcp,
+				 SaryText *text,
+				 const gchar *pattern,
+				 SaryInt len,
+				 SaryInt i);
+static SaryInt	lcp_bsearch	(SaryLcp *lcp,
+				 SaryText *text,
+				 const gchar *pattern,
+				 SaryInt len,
+				 gboolean upper,
+				 Interval *iv,
+				 Interval *split);
+
+/**
+ * sary_lcp_build:
+ * @file_name: file name of the text.
+ * @array_name: file name of the sorted suffix array.
+ * @lcp_name: file name of the LCP table to be written.
+ *
+ * Compute the LCP-LR table of @array_name and write it to @lcp_name.
+ *
+ * Returns: %FALSE if an error occurred, %TRUE on success.
+ *
+ **/
+gboolean
+sary_lcp_build (const gchar *file_name,
+		const gchar *array_name,
+		const gchar *lcp_name)
+{
+    SaryText *text;
+    SaryMmap *array;
+    SaryInt *ary;
+    SaryInt len, i;
+    guint8 *adjacent, *lr;
+    guchar header[LCP_HEADER_SIZE];
+    guint32 fp_be;
+    SaryInt len_be;
+    FILE *fp;
+    gboolean status = TRUE;
+
+    g_assert(file_name != NULL && array_name != NULL && lcp_name != NULL);
+
+    text = sary_text_new(file_name);
+    if (text == NULL) {
+	return FALSE;
+    }
+    array = sary_mmap(array_name, "r");
+    if (array == NULL) {
+	sary_text_destroy(text);
+	return FALSE;
+    }
+
+    ary = (SaryInt *)array->map;
+    len = array->len / sizeof(SaryInt);
+
+    /*
+     * adjacent[i] = lcp(SA[i - 1], SA[i]).  Any lcp of a
+     * wider interval is the minimum of these, which
+     * fill_lr computes bottom-up.
+     */
+    adjacent = g_new(guint8, len + 1);
+    lr       = g_new0(guint8, 2 * len + 1);
+    if (len > 0) {
+	adjacent[0] = 0;
+    }
+    for (i = 1; i < len; i++) {
+	adjacent[i] = lcp_of(sary_i_text(text, ary + i - 1),
+			     sary_i_text(text, ary + i),
+			     sary_text_get_eof(text));
+    }
+    fill_lr(lr, adjacent, len, -1, len);
+
+    memcpy(header, magic, 8);
+    len_be = GINT_TO_BE(len);
+    fp_be  = GUINT32_TO_BE(fingerprint(ary, len));
+    memcpy(header + 8,  &len_be, 4);
+    memcpy(header + 12, &fp_be, 4);
+
+    fp = fopen(lcp_name, "w");
+    if (fp == NULL) {
+	status = FALSE;
+    } else {
+	fwrite(header, 1, LCP_HEADER_SIZE, fp);
+	fwrite(lr, 1, 2 * len, fp);
+	if (ferror(fp)) {
+	    status = FALSE;
+	}
+	if (fclose(fp) != 0) {
+	    status = FALSE;
+	}
+    }
+
+    g_free(adjacent);
+    g_free(lr);
+    sary_munmap(array);
+    sary_text_destroy(text);
+
+    return status;
+}
+
+/**
+ * sary_lcp_new:
+ * @lcp_name: file name of the LCP table.
+ * @array: the mapped suffix array which the table was built for.
+ *
+ * Load the LCP table written by sary_lcp_build. The table is rejected
+ * if it does not match @array (e.g. the array was rebuilt afterwards).
+ *
+ * Returns: a new #SaryLcp; NULL if the file is missing or stale.
+ *
+ **/
+SaryLcp *
+sary_lcp_new (const gchar *lcp_name, SaryMmap *array)
+{
+    SaryLcp *lcp;
+    SaryMmap *mobj;
+    SaryInt len, len_be;
+    guint32 fp_be;
+
+    g_assert(lcp_name != NULL && array != NULL);
+
+    len = array->len / sizeof(SaryInt);
+    if (len == 0) {
+	return NULL;
+    }
+
+    mobj = sary_mmap(lcp_name, "r");
+    if (mobj == NULL) {
+	return NULL;
+    }
+    if (mobj->len != LCP_HEADER_SIZE + 2 * (size_t)len ||
+	memcmp(mobj->map, magic, 8) != 0) {
+	sary_munmap(mobj);
+	return NULL;
+    }
+    memcpy(&len_be, (gchar *)mobj->map + 8,  4);
+    memcpy(&fp_be,  (gchar *)mobj->map + 12, 4);
+    if (GINT_FROM_BE(len_be) != len ||
+	GUINT32_FROM_BE(fp_be) != fingerprint(array->map, len)) {
+	sary_munmap(mobj);
+	return NULL;
+    }
+
+    lcp = g_new(SaryLcp, 1);
+    lcp->mobj  = mobj;
+    lcp->array = (SaryInt *)array->map;
+    lcp->len   = len;
+    lcp->lr    = (guint8 *)mobj->map + LCP_HEADER_SIZE;
+
+    return lcp;
+}
+
+/**
+ * sary_lcp_destroy:
+ * @lcp: a #SaryLcp to be destructed.
+ *
+ * Destructs the @lcp.
+ *
+ **/
+void
+sary_lcp_destroy (SaryLcp *lcp)
+{
+    if (lcp != NULL) {
+	sary_munmap(lcp->mobj);
+	g_free(lcp);
+    }
+}
+
+/**
+ * sary_lcp_search:
+ * @lcp: a #SaryLcp.
+ * @text: the text of the suffix array.
+ * @pattern: pattern.
+ * @len: length of @pattern; must be positive.
+ * @first: the first occurrence is stored here.
+ * @last: the last occurrence is stored here.
+ *
+ * Search the whole suffix array for @pattern. A suffix cut off by the
+ * end of the text compares smaller than the pattern it is a prefix of,
+ * so it is never reported as an occurrence.
+ *
+ * Returns: %TRUE if @pattern occurs, %FALSE otherwise.
+ *
+ **/
+gboolean
+sary_lcp_search (SaryLcp *lcp,
+		 SaryText *text,
+		 const gchar *pattern,
+		 SaryInt len,
+		 SaryInt **first,
+		 SaryInt **last)
+{
+    return sary_lcp_search_range(lcp, text, pattern, len, 
+				 0, lcp->len, first, last);
+}
+
+/**
+ * sary_lcp_search_range:
+ * @lcp: a #SaryLcp.
+ * @text: the text of the suffix array.
+ * @pattern: pattern.
+ * @len: length of @pattern; must be positive.
+ * @lo: rank of the first suffix which may start with @pattern.
+ * @hi: rank after the last suffix which may start with @pattern.
+ * @first: the first occurrence is stored here.
+ * @last: the last occurrence is stored here.
+ *
+ * Search the suffix array for @pattern, all of whose occurrences are
+ * known to lie in [@lo, @hi), e.g. from a #SaryBucket.
+ *
+ * Returns: %TRUE if @pattern occurs, %FALSE otherwise.
+ *
+ **/
+gboolean
+sary_lcp_search_range (SaryLcp *lcp,
+		       SaryText *text,
+		       const gchar *pattern,
+		       SaryInt len,
+		       SaryInt lo,
+		       SaryInt hi,
+		       SaryInt **first,
+		       SaryInt **last)
+{
+    SaryInt lower, upper, mid;
+    Interval root, split;
+
+    g_assert(lcp != NULL && pattern != NULL && len > 0);
+    g_assert(lo >= 0 && hi <= lcp->len);
+
+    if (lo >= hi) {
+	return FALSE;
+    }
+
+    /*
+     * The table only holds the intervals met by a search
+     * from the whole array, so walk down them, without
+     * looking at the text, to the smallest one holding
+     * [lo, hi).  Its ends lie outside the range, and their
+     * lcp with the pattern is found by comparing them.
+     */
+    root.low  = -1;
+    root.high = lcp->len;
+    while (1) {
+	mid = (root.low + root.high) / 2;
+	if (mid < lo) {
+	    root.low = mid;
+	} else if (mid >= hi) {
+	    root.high = mid;
+	} else {
+	    break;
+	}
+    }
+    root.l = pattern_lcp(lcp, text, pattern, len, root.low);
+    root.r = pattern_lcp(lcp, text, pattern, len, root.high);
+
+    lower = lcp_bsearch(lcp, text, pattern, len, FALSE, &root, &split);
+    if (lower == -1) {
+	return FALSE;
+    }
+    upper = lcp_bsearch(lcp, text, pattern, len, TRUE, &split, NULL);
+    g_assert(upper >= lower);
+
+    *first = lcp->array + lower;
+    *last  = lcp->array + upper;
+    return TRUE;
+}
+
+/*
+ * Sample the array evenly so that a table left behind by
+ * an older array is detected without reading the whole
+ * array.
+ */
+static guint32
+fingerprint (SaryInt *array, SaryInt len)
+{
+    guint32 h = len;
+    SaryInt i, step;
+
+    step = len / NSAMPLES + 1;
+    for (i = 0; i < len; i += step) {
+	h = (h << 5) - h + (guint32)array[i];
+    }
+    if (len > 0) {
+	h = (h << 5) - h + (guint32)array[len - 1];
+    }
+    return h;
+}
+
+static guint8
+lcp_of (const gchar *pos1, const gchar *pos2, const gchar *eof)
+{
+    SaryInt max, i;
+
+    max = MIN(eof - pos1, eof - pos2);
+    max = MIN(max, LCP_MAX);
+    for (i = 0; i < max && pos1[i] == pos2[i]; i++) {
+	;
+    }
+    return i;
+}
+
+/*
+ * The lcp of the pattern and SA[i]; 0 for the sentinels
+ * before and after the array.
+ */
+static SaryInt
+pattern_lcp (SaryLcp *lcp,
+	     SaryText *text,
+	     const gchar *pattern,
+	     SaryInt len,
+	     SaryInt i)
+{
+    gchar *eof = sary_text_get_eof(text);
+    gchar *pos;
+    SaryInt k;
+
+    if (i < 0 || i >= lcp->len) {
+	return 0;
+    }
+    pos = sary_text_get_bof(text) + GINT_FROM_BE(lcp->array[i]);
+    for (k = 0; k < len && pos + k < eof && pattern[k] == pos[k]; k++) {
+	;
+    }
+    return k;
+}
+
+/*
+ * Fill in the table for the interval (low, high) and
+ * return lcp(SA[low], SA[high]).
+ */
+static guint8
+fill_lr (guint8 *lr,
+	 const guint8 *adjacent,
+	 SaryInt len,
+	 SaryInt low,
+	 SaryInt high)
+{
+    SaryInt mid;
+    guint8 llcp, rlcp;
+
+    if (low + 1 == high) {
+	if (low < 0 || high >= len) {
+	    return 0;
+	}
+	return adjacent[high];
+    }
+
+    mid  = (low + high) / 2;
+    llcp = fill_lr(lr, adjacent, len, low, mid);
+    rlcp = fill_lr(lr, adjacent, len, mid, high);
+    lr[2 * mid]     = llcp;
+    lr[2 * mid + 1] = rlcp;
+
+    return MIN(llcp, rlcp);
+}
+
+/*
+ * Walk down the same tree as sary_bsearch_first (if
+ * `upper' is FALSE) or sary_bsearch_last, starting from
+ * the interval `iv'.  `l' and `r' are the lcp of the
+ * pattern with SA[low] and SA[high].  Without `upper',
+ * suffixes starting with the pattern go to the high side,
+ * and the first of them ends up at `high'; the interval
+ * in which such a suffix was met first is saved to
+ * `split' so that the search for the last one can start
+ * from there.  With `upper' they go to the low side, and
+ * the last of them ends up at `low'.
+ */
+static SaryInt
+lcp_bsearch (SaryLcp *lcp,
+	     SaryText *text,
+	     const gchar *pattern,
+	     SaryInt len,
+	     gboolean upper,
+	     Interval *iv,
+	     Interval *split)
+{
+    SaryInt low = iv->low, high = iv->high, mid;
+    SaryInt l = iv->l, r = iv->r, k, x;
+    gboolean from_low, is_first = TRUE;
+    gchar *bof = sary_text_get_bof(text);
+    gchar *eof = sary_text_get_eof(text);
+    gchar *pos;
+    gint cmp;
+
+    while (low + 1 != high) {
+	mid = (low + high) / 2;
+
+	from_low = (l >= r);
+	if (from_low) {
+	    k = l;
+	    x = lcp->lr[2 * mid];
+	} else {
+	    k = r;
+	    x = lcp->lr[2 * mid + 1];
+	}
+
+	if (x == LCP_MAX && k >= LCP_MAX) {
+	    /*
+	     * The stored lcp is only a lower bound.
+	     */
+	    k = LCP_MAX;
+	    x = k;
+	} else {
+	    x = MIN(x, len);
+	}
+
+	if (x > k) {
+	    /*
+	     * SA[mid] agrees with the nearer end beyond the
+	     * point where the pattern leaves it, so it lies on
+	     * the same side of the pattern.
+	     */
+	    cmp = from_low ? 1 : -1;
+	} else if (x < k) {
+	    cmp = from_low ? -1 : 1;
+	    k = x;
+	} else {
+	    pos = bof + GINT_FROM_BE(lcp->array[mid]);
+	    while (k < len && pos + k < eof && pattern[k] == pos[k]) {
+		k++;
+	    }
+	    if (k == len) {
+		cmp = 0;
+	    } else if (pos + k >= eof ||
+		       (guchar)pattern[k] > (guchar)pos[k]) {
+		cmp = 1;
+	    } else {
+		cmp = -1;
+	    }
+	}
+
+	if (cmp == 0 && is_first && split != NULL) {
+	    split->low  = low;
+	    split->high = high;
+	    split->l    = l;
+	    split->r    = r;
+	    is_first = FALSE;
+	}
+
+	/*
+	 * In every case k is now lcp(pattern, SA[mid]).
+	 */
+	if (cmp > 0 || (cmp == 0 && upper)) {
+	    low = mid;
+	    l = k;
+	} else {
+	    high = mid;
+	    r = k;
+	}
+    }
+
+    if (upper) {
+	return (low >= 0 && l == len) ? low : -1;
+    } else {
+	return (high < lcp->len && r == len) ? high : -1;
+    }
+}
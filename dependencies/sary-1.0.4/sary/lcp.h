@@ -0,0 +1,40 @@
+#ifndef __SARY_LCP_H__
+#define __SARY_LCP_H__
+
+#include <glib.h>
+#include <sary/mmap.h>
+#include <sary/text.h>
+#include <sary/saryconfig.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct _SaryLcp		SaryLcp;
+
+gboolean	sary_lcp_build		(const gchar *file_name,
+					 const gchar *array_name,
+					 const gchar *lcp_name);
+SaryLcp*	sary_lcp_new		(const gchar *lcp_name,
+					 SaryMmap *array);
+void		sary_lcp_destroy	(SaryLcp *lcp);
+gboolean	sary_lcp_search		(SaryLcp *lcp,
+					 SaryText *text,
+					 const gchar *pattern,
+					 SaryInt len,
+					 SaryInt **first,
+					 SaryInt **last);
+gboolean	sary_lcp_search_range	(SaryLcp *lcp,
+					 SaryText *text,
+					 const gchar *pattern,
+					 SaryInt len,
+					 SaryInt lo,
+					 SaryInt hi,
+					 SaryInt **first,
+					 SaryInt **last);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __SARY_LCP_H__ */
@@ -52,6 +52,8 @@ struct _Saryer {
     gboolean    is_allocated;
     SaryPattern	pattern;
     SaryCache	*cache;
+    SaryLcp	*lcp;
+    SaryBucket	*bucket;
     SearchFunc  search;
 };
 
@@ -168,6 +170,8 @@ saryer_new2 (const gchar *file_name, const gchar *array_name)
     saryer->len    = saryer->array->len / sizeof(SaryInt);
     saryer->search = search;
     saryer->cache  = NULL;
+    saryer->lcp    = NULL;
+    saryer->bucket = NULL;
 
     init_saryer_states(saryer, TRUE);
 
@@ -186,6 +190,8 @@ saryer_destroy (Saryer *saryer)
 {
     sary_text_destroy(saryer->text);
     sary_cache_destroy(saryer->cache);
+    sary_lcp_destroy(saryer->lcp);
+    sary_bucket_destroy(saryer->bucket);
     sary_munmap(saryer->array);
 
     g_free(saryer->allocated_data);
@@ -699,16 +705,112 @@ saryer_sort_occurrences (Saryer *saryer)
  * @saryer: a #Saryer.
  *
  * Enable the cache engine. Cache the search results and reuse them for
- * the same pattern later.
+ * the same pattern later. Identical to saryer_enable_cache2 with
+ * %SARY_CACHE_DEFAULT_SIZE entries.
  *
  **/
 void
 saryer_enable_cache (Saryer *saryer)
 {
-    saryer->cache  = sary_cache_new();
+    saryer_enable_cache2(saryer, SARY_CACHE_DEFAULT_SIZE);
+}
+
+/**
+ * saryer_enable_cache2:
+ * @saryer: a #Saryer.
+ * @max_entries: the number of search results to keep.
+ *
+ * Similar to saryer_enable_cache but the cache holds at most
+ * @max_entries results. The least recently used one is dropped to
+ * make room for a new one. Patterns not found are cached too.
+ *
+ **/
+void
+saryer_enable_cache2 (Saryer *saryer, SaryInt max_entries)
+{
+    sary_cache_destroy(saryer->cache);
+    saryer->cache  = sary_cache_new2(max_entries);
     saryer->search = cache_search;
 }
 
+/**
+ * saryer_enable_shared_cache:
+ * @saryer: a #Saryer.
+ * @cache_name: file name of the cache, created if it does not exist.
+ * @max_entries: the number of search results to keep.
+ *
+ * Similar to saryer_enable_cache2 but the cache is kept in the file
+ * @cache_name and shared by every process that opens it for the same
+ * suffix array, so that concurrent jobs over one index reuse each
+ * other's results. A file left by another array is cleared. Patterns
+ * longer than 112 bytes are not cached.
+ *
+ * Returns: %FALSE if the file could not be opened, %TRUE on success.
+ *
+ **/
+gboolean
+saryer_enable_shared_cache (Saryer *saryer, 
+			    const gchar *cache_name, 
+			    SaryInt max_entries)
+{
+    SaryCache *cache;
+
+    if (saryer->array->map == NULL) {  /* 0-length (empty) file */
+	return FALSE;
+    }
+    cache = sary_cache_new_shared(cache_name, max_entries, saryer->array);
+    if (cache == NULL) {
+	return FALSE;
+    }
+    sary_cache_destroy(saryer->cache);
+    saryer->cache  = cache;
+    saryer->search = cache_search;
+    return TRUE;
+}
+
+/**
+ * saryer_enable_lcp:
+ * @saryer: a #Saryer.
+ * @lcp_name: file name of the LCP table written by `mksary --lcp'.
+ *
+ * Use the LCP table for searches over the whole suffix array. Incremental
+ * searches and searches restricted to previous results are not affected.
+ *
+ * Returns: %FALSE if @lcp_name is missing or does not match the array,
+ * %TRUE on success.
+ *
+ **/
+gboolean
+saryer_enable_lcp (Saryer *saryer, const gchar *lcp_name)
+{
+    sary_lcp_destroy(saryer->lcp);
+    saryer->lcp = sary_lcp_new(lcp_name, saryer->array);
+    return saryer->lcp != NULL;
+}
+
+/**
+ * saryer_enable_bucket:
+ * @saryer: a #Saryer.
+ * @bucket_name: file name of the bucket table written by
+ * `mksary --bucket'.
+ *
+ * Start searches over the whole suffix array from the range of the
+ * pattern's first bytes, looked up in the bucket table, instead of
+ * from the whole array. If the LCP table is enabled too, it is
+ * searched within that range.
+ *
+ * Returns: %FALSE if @bucket_name is missing or does not match the
+ * array, %TRUE on success.
+ *
+ **/
+gboolean
+saryer_enable_bucket (Saryer *saryer, const gchar *bucket_name)
+{
+    sary_bucket_destroy(saryer->bucket);
+    saryer->bucket = sary_bucket_new(bucket_name, saryer->array);
+    return saryer->bucket != NULL;
+}
+
 static void
 init_saryer_states(Saryer *saryer, gboolean first_time)
 {
@@ -743,6 +845,38 @@ search (Saryer *saryer,
     saryer->pattern.str = (gchar *)pattern;
     saryer->pattern.len = len;
 
+    if (saryer->bucket != NULL && offset == 0 && range == saryer->len &&
+	saryer->pattern.skip == 0 && len > 0) {
+	SaryInt rank;
+
+	range = sary_bucket_range(saryer->bucket, pattern, len, &rank);
+	if (range == 0) {
+	    return FALSE;
+	}
+	if (saryer->lcp != NULL) {
+	    if (sary_lcp_search_range(saryer->lcp, saryer->text, 
+				      pattern, len, rank, rank + range,
+				      &first, &last) == FALSE) {
+		return FALSE;
+	    }
+	    saryer->first   = first;
+	    saryer->last    = last;
+	    saryer->cursor  = first;
+	    return TRUE;
+	}
+	offset = rank * sizeof(SaryInt);
+    } else if (saryer->lcp != NULL && offset == 0 && range == saryer->len &&
+	       saryer->pattern.skip == 0 && len > 0) {
+	if (sary_lcp_search(saryer->lcp, saryer->text, 
+			    pattern, len, &first, &last) == FALSE) {
+	    return FALSE;
+	}
+	saryer->first   = first;
+	saryer->last    = last;
+	saryer->cursor  = first;
+	return TRUE;
+    }
+
     first = (SaryInt *)sary_bsearch_first(saryer, 
 					  saryer->array->map + offset,
 					  range, sizeof(SaryInt), 
@@ -769,7 +903,7 @@ search (Saryer *saryer,
 static inline gint 
 bsearchcmp (gconstpointer saryer_ptr, gconstpointer obj_ptr)
 {
-    gint len1, len2, skip;
+    gint len1, len2, skip, cmp;
     Saryer *saryer  = (Saryer *)saryer_ptr;
     gchar *eof  = sary_text_get_eof(saryer->text);
     gchar *pos = sary_i_text(saryer->text, obj_ptr);
@@ -781,7 +915,16 @@ bsearchcmp (gconstpointer saryer_ptr, gconstpointer obj_ptr)
 	len2 = 0;
     }
 
-    return memcmp(saryer->pattern.str + skip, pos + skip, MIN(len1, len2));
+    cmp = memcmp(saryer->pattern.str + skip, pos + skip, MIN(len1, len2));
+    if (cmp == 0 && len2 < len1) {
+	/*
+	 * The suffix is cut off by the end of the text, so
+	 * it sorts before the pattern (as in mkqsort.c)
+	 * rather than matching it.
+	 */
+	return 1;
+    }
+    return cmp;
 }
 
 static inline gint 
@@ -806,23 +949,32 @@ cache_search (Saryer *saryer,
 	      SaryInt offset,
 	      SaryInt range)
 {
-    SaryResult *cache;
+    SaryInt *ary = (SaryInt *)saryer->array->map;
+    SaryInt first, last;
+    gboolean result;
 
-    if ((cache = sary_cache_get(saryer->cache, pattern, len)) != NULL) {
-	saryer->first   = cache->first;
-	saryer->last    = cache->last;
-	saryer->cursor  = cache->first;
-	return TRUE;
-    } else {
-	gboolean result = search(saryer, pattern, len, offset, range);
-	if (result == TRUE) {
-	    sary_cache_add(saryer->cache, 
-			   sary_i_text(saryer->text, saryer->first), len, 
-			   saryer->first, saryer->last);
+    /*
+     * The cache holds ranks rather than pointers so that
+     * they mean the same in every process.
+     */
+    if (sary_cache_get(saryer->cache, pattern, len, &first, &last)) {
+	if (first > last) {
+	    return FALSE;
 	}
-	return result;
+	saryer->first   = ary + first;
+	saryer->last    = ary + last;
+	saryer->cursor  = saryer->first;
+	return TRUE;
+    }
+
+    result = search(saryer, pattern, len, offset, range);
+    if (result == TRUE) {
+	sary_cache_add(saryer->cache, pattern, len, 
+		       saryer->first - ary, saryer->last - ary);
+    } else if (saryer->array->map != NULL) {
+	sary_cache_add(saryer->cache, pattern, len, 0, -1);
     }
-    g_assert_not_reached();
+    return result;
 }
 
 static GArray *
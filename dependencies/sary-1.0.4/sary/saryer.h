@@ -71,6 +71,15 @@ gchar*		saryer_peek_next_position	(Saryer *saryer);
 SaryInt		saryer_count_occurrences	(Saryer *saryer);
 void		saryer_sort_occurrences		(Saryer *saryer);
 void		saryer_enable_cache		(Saryer *saryer);
+void		saryer_enable_cache2		(Saryer *saryer,
+						 SaryInt max_entries);
+gboolean	saryer_enable_shared_cache	(Saryer *saryer,
+						 const gchar *cache_name,
+						 SaryInt max_entries);
+gboolean	saryer_enable_bucket		(Saryer *saryer,
+						 const gchar *bucket_name);
+gboolean	saryer_enable_lcp		(Saryer *saryer,
+						 const gchar *lcp_name);
 
 #ifdef __cplusplus
 }
@@ -37,8 +37,11 @@
 #include <string.h>
 #include <glib.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sary.h>
 
+#define NCACHED	4
+
 static void 	cache_test		(const gchar *file_name);
 static Saryer *	new			(const gchar *file_name);
 static void 	show_usage		(void);
@@ -63,36 +66,61 @@ static void
 cache_test (const gchar *file_name)
 {
     Saryer *saryer1;
-    Saryer *saryer2;
-    gint i;
+    Saryer *saryer2[NCACHED];
+    gchar *cache_name;
+    gint i, j;
     gchar  pattern[BUFSIZ];
     FILE *fp = fopen(file_name, "r");
     g_assert(fp != NULL);
 
     saryer1 = new(file_name);
-    saryer2 = new(file_name);
-    saryer_enable_cache(saryer2);
+    for (j = 0; j < NCACHED; j++) {
+	saryer2[j] = new(file_name);
+    }
+
+    /*
+     * The default cache, a tiny one which keeps evicting
+     * entries, and two saryers sharing a cache file.
+     */
+    cache_name = g_strconcat(file_name, ".cache", NULL);
+    saryer_enable_cache(saryer2[0]);
+    saryer_enable_cache2(saryer2[1], 16);
+    g_assert(saryer_enable_shared_cache(saryer2[2], cache_name, 64));
+    g_assert(saryer_enable_shared_cache(saryer2[3], cache_name, 64));
 
     for (i = 0; i < 10; i++) {
 	while (fgets(pattern, BUFSIZ, fp) != NULL) {
 	    gchar *line1, *line2;
 
 	    saryer_search(saryer1, pattern);
-	    saryer_search(saryer2, pattern);
-
 	    line1 = saryer_get_next_line(saryer1);
-	    line2 = saryer_get_next_line(saryer2);
-	    g_assert(line1 != NULL && line2 != NULL);
-	    g_assert(strcmp(line1, line2) == 0);
-
+	    g_assert(line1 != NULL);
+
+	    for (j = 0; j < NCACHED; j++) {
+		saryer_search(saryer2[j], pattern);
+		line2 = saryer_get_next_line(saryer2[j]);
+		g_assert(line2 != NULL);
+		g_assert(strcmp(line1, line2) == 0);
+		line2 = saryer_get_next_line(saryer2[j]);
+		g_assert(line2 == NULL);
+	    }
 	    line1 = saryer_get_next_line(saryer1);
-	    line2 = saryer_get_next_line(saryer2);
-	    g_assert(line1 == NULL && line2 == NULL);
+	    g_assert(line1 == NULL);
+
+	    /* a pattern not found, cached as such */
+	    strcpy(pattern, "\001\002");
+	    for (j = 0; j < NCACHED; j++) {
+		g_assert(saryer_search(saryer2[j], pattern) == FALSE);
+	    }
 	}
 	rewind(fp);
     }
     saryer_destroy(saryer1);
-    saryer_destroy(saryer2);
+    for (j = 0; j < NCACHED; j++) {
+	saryer_destroy(saryer2[j]);
+    }
+    unlink(cache_name);
+    g_free(cache_name);
 }
 
 static Saryer *
@@ -0,0 +1,262 @@
+/*
+ * sary - a suffix array library
+ *
+ * $Id$
+ *
+ * Copyright (C) 2000  Satoru Takabayashi <satoru@namazu.org>
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Search every token of a token list with and without the
+ * LCP table written by `mksary --lcp' (or with -b, the
+ * bucket table written by `mksary --bucket', with -B,
+ * both), report the time of both and check that they
+ * find the same occurrences.
+ *
+ * The token list has one token per line.  \n, \r, \t, \\
+ * and \xHH are unescaped so that binary tokens can be
+ * listed.
+ */
+
+#include "config.h"
+#include <glib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <sary.h>
+#include "../src/getopt.h"
+
+typedef struct {
+    gchar	*str;
+    SaryInt	len;
+} Token;
+
+static GArray*	read_tokens	(const gchar *token_file);
+static SaryInt	unescape	(gchar *str);
+static double	benchmark	(Saryer *saryer,
+				 GArray *tokens,
+				 SaryInt *counts,
+				 gint n);
+static Saryer*	new		(const gchar *file_name);
+static void 	parse_options 	(int argc, char **argv);
+static void 	show_usage	(void);
+
+gint iterations = 1;
+gboolean use_bucket = FALSE;
+gboolean use_both = FALSE;
+
+int
+main (int argc, char **argv)
+{
+    gchar *file_name, *token_file, *table_name, *lcp_name;
+    Saryer *saryer1, *saryer2;
+    GArray *tokens;
+    SaryInt *counts1, *counts2;
+    double elapsed1, elapsed2;
+    gint i, status = EXIT_SUCCESS;
+
+    parse_options(argc, argv);
+    if (optind + 2 != argc) {
+	show_usage();
+	exit(EXIT_FAILURE);
+    }
+
+    token_file = argv[optind];
+    file_name  = argv[optind + 1];
+    table_name = g_strconcat(file_name, use_bucket ? ".ary.bkt" : ".ary.lcp",
+			     NULL);
+
+    tokens  = read_tokens(token_file);
+    saryer1 = new(file_name);
+    saryer2 = new(file_name);
+    if ((use_bucket ? saryer_enable_bucket(saryer2, table_name) :
+	 saryer_enable_lcp(saryer2, table_name)) == FALSE) {
+	g_printerr("lcp-benchmark: %s: missing or stale\n", table_name);
+	exit(EXIT_FAILURE);
+    }
+    lcp_name = g_strconcat(file_name, ".ary.lcp", NULL);
+    if (use_both && saryer_enable_lcp(saryer2, lcp_name) == FALSE) {
+	g_printerr("lcp-benchmark: %s: missing or stale\n", lcp_name);
+	exit(EXIT_FAILURE);
+    }
+
+    counts1 = g_new(SaryInt, tokens->len);
+    counts2 = g_new(SaryInt, tokens->len);
+    elapsed1 = benchmark(saryer1, tokens, counts1, iterations);
+    elapsed2 = benchmark(saryer2, tokens, counts2, iterations);
+
+    g_print("= %d tokens x %d\n", tokens->len, iterations);
+    g_print("  search2:      %5.2f\n", elapsed1 / CLOCKS_PER_SEC);
+    g_print("  with %-9s%5.2f\n", 
+	    use_both ? "both:" : use_bucket ? "bucket:" : "lcp:",
+	    elapsed2 / CLOCKS_PER_SEC);
+
+    for (i = 0; i < tokens->len; i++) {
+	if (counts1[i] != counts2[i]) {
+	    Token *token = &g_array_index(tokens, Token, i);
+	    g_printerr("lcp-benchmark: %.*s: %d != %d\n", token->len,
+		       token->str, counts1[i], counts2[i]);
+	    status = EXIT_FAILURE;
+	}
+    }
+
+    saryer_destroy(saryer1);
+    saryer_destroy(saryer2);
+    g_free(counts1);
+    g_free(counts2);
+    g_free(table_name);
+    g_free(lcp_name);
+
+    return status;
+}
+
+static GArray *
+read_tokens (const gchar *token_file)
+{
+    FILE *fp;
+    gchar buf[BUFSIZ];
+    GArray *tokens = g_array_new(FALSE, FALSE, sizeof(Token));
+
+    fp = fopen(token_file, "r");
+    if (fp == NULL) {
+	g_printerr("lcp-benchmark: %s: %s\n", token_file, g_strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    while (fgets(buf, BUFSIZ, fp) != NULL) {
+	Token token;
+
+	g_strchomp(buf);
+	token.str = g_strdup(buf);
+	token.len = unescape(token.str);
+	if (token.len > 0) {
+	    g_array_append_val(tokens, token);
+	}
+    }
+    fclose(fp);
+
+    return tokens;
+}
+
+static SaryInt
+unescape (gchar *str)
+{
+    gchar *src, *dst;
+
+    for (src = dst = str; *src != '\0'; src++, dst++) {
+	if (*src != '\\' || src[1] == '\0') {
+	    *dst = *src;
+	    continue;
+	}
+	src++;
+	switch (*src) {
+	case 'n':
+	    *dst = '\n';
+	    break;
+	case 'r':
+	    *dst = '\r';
+	    break;
+	case 't':
+	    *dst = '\t';
+	    break;
+	case 'x':
+	    if (isxdigit((guchar)src[1]) && isxdigit((guchar)src[2])) {
+		gchar hex[3];
+
+		hex[0] = src[1];
+		hex[1] = src[2];
+		hex[2] = '\0';
+		*dst = strtol(hex, NULL, 16);
+		src += 2;
+		break;
+	    }
+	    /* fall through */
+	default:
+	    *dst = *src;
+	    break;
+	}
+    }
+    return dst - str;
+}
+
+static double
+benchmark (Saryer *saryer, GArray *tokens, SaryInt *counts, gint n)
+{
+    gint i, j;
+    clock_t start;
+
+    start = clock();
+    for (i = 0; i < n; i++) {
+	for (j = 0; j < tokens->len; j++) {
+	    Token *token = &g_array_index(tokens, Token, j);
+
+	    if (saryer_search2(saryer, token->str, token->len)) {
+		counts[j] = saryer_count_occurrences(saryer);
+	    } else {
+		counts[j] = 0;
+	    }
+	}
+    }
+    return clock() - start;
+}
+
+static Saryer *
+new (const gchar *file_name)
+{
+    Saryer *saryer = saryer_new(file_name);
+
+    if (saryer == NULL) {
+	g_printerr("lcp-benchmark: %s(.ary): %s\n",
+		   file_name, g_strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    return saryer;
+}
+
+static void
+parse_options (int argc, char **argv)
+{
+    while (1) {
+        int ch = getopt(argc, argv, "bBn:");
+        if (ch == EOF) {
+	    break;
+	}
+	switch (ch) {
+	case 'b':
+	    use_bucket = TRUE;
+	    break;
+	case 'B':
+	    use_bucket = TRUE;
+	    use_both = TRUE;
+	    break;
+	case 'n':
+	    iterations = atoi(optarg);
+            break;
+	}
+    }
+}
+
+static void
+show_usage (void)
+{
+    g_print("Usage: lcp-benchmark [-b | -B] [-n NUM] <token-file> <file>\n");
+}
@@ -68,6 +68,10 @@ static void		sort			(SaryBuilder *builder,
 static void		index_and_sort		(SaryBuilder *builder,
 						 const gchar *file_name,
 						 const gchar *array_name);
+static void		build_lcp		(const gchar *file_name,
+						 const gchar *array_name);
+static void		build_bucket		(const gchar *file_name,
+						 const gchar *array_name);
 static void		print_time		(SaryProgress *progress, 
 						 time_t t);
 static void		print_eta		(SaryProgress *progress);
@@ -88,6 +92,8 @@ static SortFunc		sort_func     = sary_builder_sort;
 static gchar*		array_name    = NULL;
 static SaryInt		block_size    = 4 * 1024 * 1024; /* 4 MB */
 static SaryInt		nthreads      = 1;
+static gboolean		lcp_enabled   = FALSE;
+static SaryInt		bucket_width  = 0;  /* no bucket table */
 
 int
 main (int argc, char **argv)
@@ -108,8 +114,15 @@ main (int argc, char **argv)
 
     builder = new_builder(file_name, array_name);
     process(builder, file_name, array_name);
-
     sary_builder_destroy(builder);
+
+    if (lcp_enabled && process != index) {
+	build_lcp(file_name, array_name);
+    }
+    if (bucket_width > 0 && process != index) {
+	build_bucket(file_name, array_name);
+    }
+
     g_free(array_name);
 
     return 0;
@@ -190,6 +203,33 @@ index_and_sort (SaryBuilder *builder,
     sort(builder, file_name, array_name);
 }
 
+static void
+build_lcp (const gchar *file_name, const gchar *array_name)
+{
+    gchar *lcp_name = g_strconcat(array_name, ".lcp", NULL);
+
+    if (sary_lcp_build(file_name, array_name, lcp_name) == FALSE) {
+	g_printerr("mksary: %s, %s: %s\n", array_name, lcp_name,
+		   g_strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    g_free(lcp_name);
+}
+
+static void
+build_bucket (const gchar *file_name, const gchar *array_name)
+{
+    gchar *bucket_name = g_strconcat(array_name, ".bkt", NULL);
+
+    if (sary_bucket_build(file_name, array_name, bucket_name, 
+			  bucket_width) == FALSE) {
+	g_printerr("mksary: %s, %s: %s\n", array_name, bucket_name,
+		   g_strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    g_free(bucket_name);
+}
+
 static void
 print_time (SaryProgress *progress, time_t t)
 {
@@ -284,15 +324,17 @@ progress_quiet (SaryProgress *progress)
     /* do nothing */
 }
 
-static const char *short_options = "a:b::c:hilLqst:w";
+static const char *short_options = "a:b::c:hik::lLpqst:w";
 static struct option long_options[] = {
     { "array",		required_argument,		NULL, 'a' },
     { "block",		optional_argument,		NULL, 'b' },
     { "encoding",	required_argument,		NULL, 'c' },
     { "help",		no_argument,			NULL, 'h' },
     { "index",		no_argument,			NULL, 'i' },
+    { "bucket",		optional_argument,		NULL, 'k' },
     { "line",		no_argument,			NULL, 'l' },
     { "locale",		no_argument,			NULL, 'L' },
+    { "lcp",		no_argument,			NULL, 'p' },
     { "quiet",		no_argument,			NULL, 'q' },
     { "sort",		no_argument,			NULL, 's' },
     { "threads",	no_argument,			NULL, 't' },
@@ -316,11 +358,14 @@ Usage: mksary [OPTION]... FILE\n\
                          [bytestream], ASCII, ISO-8859,\n\
                          EUC-JP, Shift_JIS, UTF-8\n\
   -L, --locale           enable locale support (employ mblen for indexing)\n\
+  -p, --lcp              also write an LCP table (ARRAY.lcp) for faster search\n\
+  -k, --bucket=[WIDTH]   also write a table of the ranges of [%d] byte\n\
+                         prefixes (ARRAY.bkt) for faster search\n\
   -t, --threads=NUM      set number of threads for block sorting to NUM\n\
   -q, --quiet            suppress all normal output\n\
   -v, --version          print version information and exit\n\
   -h, --help             display this help and exit\n\
-", block_size / 1024);
+", block_size / 1024, SARY_BUCKET_DEFAULT_WIDTH);
     exit(EXIT_SUCCESS);
 
 }
@@ -369,6 +414,19 @@ parse_options (int argc, char **argv)
 	    }
 	    ipoint_func = sary_ipoint_locale;
 	    break;
+	case 'k':
+	    bucket_width = SARY_BUCKET_DEFAULT_WIDTH;
+	    if (optarg) {
+		if (ck_atoi(optarg, &bucket_width) || 
+		    bucket_width < 1 || bucket_width > 3) {
+		    g_printerr("mksary: invalid bucket width argument\n");
+		    exit(EXIT_FAILURE);
+		}
+	    }
+	    break;
+	case 'p':
+	    lcp_enabled = TRUE;
+	    break;
 	case 'q':
 	    progress_func = progress_quiet;
 	    break;
@@ -17,36 +17,63 @@ import time
 import os
 import random
 
-def fpos_eval_trace(sig, maxnum, streamfile):
-    """Evaluate false positives in a trace of innocuous flows."""
+class SignatureList(object):
+    """
+    The signatures of a polygraph.util.tokmatch.SignatureSet, matched
+    one at a time, for when tokmatch is not built.
+    """
+    def __init__(self, sigs):
+        self.sigs = list(sigs)
+
+    def matches(self, sample):
+        "indexes of the signatures matching sample, in increasing order"
+        return [i for i in xrange(len(self.sigs))
+                if self.sigs[i].match(sample)]
+
+def count_fnegs(sigset, samples):
+    """For each signature of sigset, the number of samples it misses."""
+    fnegs = [len(samples)] * len(sigset.sigs)
+    for sample in samples:
+        for i in sigset.matches(sample):
+            fnegs[i] -= 1
+    return fnegs
+
+def fpos_eval_trace(sigset, maxnum, streamfile):
+    """
+    Evaluate false positives in a trace of innocuous flows.
+
+    Returns (fpos, count) for each signature of sigset, a
+    polygraph.util.tokmatch.SignatureSet or SignatureList.
+    """
 
     import polygraph.trace_crunching.stream_trace
 
-    fpos = 0
+    fpos = [0] * len(sigset.sigs)
     count = 0
     s = polygraph.trace_crunching.stream_trace.StreamTrace(streamfile)
 
     stream = s.next()
     while (stream):
         count += 1
-        if sig.match(stream):
-            fpos += 1
+        for i in sigset.matches(stream):
+            fpos[i] += 1
         stream = s.next()
         if count == maxnum:
             break
 
-    return (fpos, count)
+    return [(f, count) for f in fpos]
 
-def fpos_eval_usrbin(sig, maxsize=100000000):
+def fpos_eval_usrbin(sigset, maxsize=100000000):
     """
     Evaluate false positives in program binaries.
 
     Used to see if signatures for obfuscated shellcode can distinguish between
-    obfuscated shellcode and other executable strings.
+    obfuscated shellcode and other executable strings. Returns
+    (fpos_count, trial_count) for each signature of sigset.
     """
 
     trial_count = 0
-    fpos_count = 0
+    fpos_count = [0] * len(sigset.sigs)
 
     # iterate through file list
     for f in os.listdir("/usr/bin/"):
@@ -60,12 +87,12 @@ def fpos_eval_usrbin(sig, maxsize=100000000):
         if sample.find('ELF') < 0:
             continue
 
-        # see if the signature matches
+        # see which signatures match
         trial_count += 1
-        if sig.match(sample):
-            fpos_count += 1
+        for i in sigset.matches(sample):
+            fpos_count[i] += 1
 
-    return (fpos_count, trial_count)
+    return [(f, trial_count) for f in fpos_count]
 
 def evaluate(sigs, variable_workload, fixed_workloads, var_range, fpos_eval_cb, trials=1, starttrial=0):
     """
@@ -81,7 +108,10 @@ def evaluate(sigs, variable_workload, fixed_workloads, var_range, fpos_eval_cb,
     variable_workload -- a dictionary describing the variable size workload
     fixed_workloads -- a sequence of workload dictionaries
     var_range -- a sequence of how many samples to use from variable_workload
-    fpos_eval_cb -- function to evaluate false positives
+    fpos_eval_cb -- function to evaluate false positives: given a
+                    polygraph.util.tokmatch.SignatureSet (or a
+                    SignatureList, without tokmatch) of the signatures
+                    generated from a pool, returns (fpos, count) for each
     trials -- number of trials to run
     starttrial -- which trial # to start on. Useful for distributing execution
                   of each trial.
@@ -90,6 +120,10 @@ def evaluate(sigs, variable_workload, fixed_workloads, var_range, fpos_eval_cb,
 
     import time
     import sys
+    try:
+        import polygraph.util.tokmatch as tokmatch
+    except ImportError:
+        tokmatch = None
     timestamp = int(time.time())
     os.mkdir(str(timestamp))
 
@@ -126,6 +160,7 @@ def evaluate(sigs, variable_workload, fixed_workloads, var_range, fpos_eval_cb,
                 if len(training_set[s]) > 10000:
                     training_set[s] = training_set[s][:10000]
 
+            generated = [] # (sig, cluster_sigs, deltat, prefix)
             for sig in sigs:
                 # make sure key exists in fpos cache
                 if not fpos_cache.has_key(sig.fname):
@@ -175,38 +210,53 @@ def evaluate(sigs, variable_workload, fixed_workloads, var_range, fpos_eval_cb,
                 f.write('%d\t%f\n' % (pool_size, deltat))
                 f.close()
 
-                # test and report each generated signature
+                # Uncomment to graph the hierarchical clustering
+#                try:
+#                    import polygraph.sig_gen.cluster
+#                    clusters = sig.clusters
+#                    graph = polygraph.sig_gen.cluster.graph_clusters(clusters)
+#                    graph.write_fig('%s.%d.%d.fig' % (prefix, pool_size, trial), prog='dot')
+#                except AttributeError, ImportError:
+#                    pass
+
+                generated.append((sig, cluster_sigs, deltat, prefix))
+
+            # test all the signatures generated from the pool together:
+            # each sample is scanned once for the tokens of all of them
+            csigs = []
+            for (sig, cluster_sigs, deltat, prefix) in generated:
+                csigs.extend(cluster_sigs)
+            if tokmatch:
+                sigset = tokmatch.SignatureSet(csigs)
+            else:
+                sigset = SignatureList(csigs)
+
+            # test for false negatives in training set
+            fnegs_train = count_fnegs(sigset, training_set)
+
+            # test for false negatives in eval sets
+            fnegs = {}
+            for workload in [variable_workload] + fixed_workloads:
+                fnegs[workload['fname']] = count_fnegs(sigset,
+                                                       workload['eval'])
+
+            # test for false positives
+            fpos_results = fpos_eval_cb(sigset)
+
+            # report each generated signature
+            i = 0
+            for (sig, cluster_sigs, deltat, prefix) in generated:
                 for csig in cluster_sigs:
-                    # test for false negatives in training set
-                    fnegs_train = 0
-                    for sample in training_set:
-                        if not csig.match(sample):
-                            fnegs_train += 1
-
-                    # test for false negatives in eval sets
-                    fnegs = {}
-                    for workload in [variable_workload] + fixed_workloads:
-                        fnegs[workload['fname']] = 0
-                        for sample in workload['eval']:
-                            if not csig.match(sample):
-                                fnegs[workload['fname']] += 1
-
-                    # test for false positives
-                    # (first check if we've already generated this sig)
-#                    if fpos_cache[sig.fname].has_key(str(csig)):
-#                        (fpos, num_fpos_eval) = fpos_cache[sig.fname][str(csig)]
-#                    else:
-                    (fpos, num_fpos_eval) = fpos_eval_cb(csig)
-#                        fpos_cache[sig.fname][str(csig)] = (fpos, num_fpos_eval)
+                    (fpos, num_fpos_eval) = fpos_results[i]
 
                     # print results for this trial
                     logwrite("%s; %d; %f; %d/%d; [%s]/[%s]; %d/%d; %s\n" % \
                         (sig.pname, pool_size, 
                         deltat,
                         fpos, num_fpos_eval, 
-                        ''.join(['%d,' % fnegs[w['fname']] for w in [variable_workload] + fixed_workloads]),
+                        ''.join(['%d,' % fnegs[w['fname']][i] for w in [variable_workload] + fixed_workloads]),
                         ''.join(['%d,' % len(w['eval']) for w in [variable_workload] + fixed_workloads]),
-                        fnegs_train, len(training_set), 
+                        fnegs_train[i], len(training_set), 
                         str(csig)))
                     sys.stdout.flush()
 
@@ -218,17 +268,9 @@ def evaluate(sigs, variable_workload, fixed_workloads, var_range, fpos_eval_cb,
                     for w in [variable_workload] + fixed_workloads:
                         if len(w['eval']) > 0:
                             f = open('%s.fneg.%s.%d' % (prefix, w['fname'], trial), 'a')
-                            f.write('%d\t%f\n' % (pool_size, fnegs[w['fname']] / len(w['eval'])))
+                            f.write('%d\t%f\n' % (pool_size, fnegs[w['fname']][i] / len(w['eval'])))
                             f.close()
-
-                # Uncomment to graph the hierarchical clustering
-#                try:
-#                    import polygraph.sig_gen.cluster
-#                    clusters = sig.clusters
-#                    graph = polygraph.sig_gen.cluster.graph_clusters(clusters)
-#                    graph.write_fig('%s.%d.%d.fig' % (prefix, pool_size, trial), prog='dot')
-#                except AttributeError, ImportError:
-#                    pass
+                    i += 1
 
 
 def bigeval(
@@ -244,7 +286,9 @@ def bigeval(
     starttrial=0,
     do_table=False,             # this is a horrible hack.
     ts=None,
-    caption="No caption"
+    caption="No caption",
+    fpos_store=None,        #filename
+    jobs=1                  #int
     ):
     """
     A wrapper to 'evaluate' that creates the signature objects.
@@ -253,7 +297,9 @@ def bigeval(
     sig_names         -- sequence of strings indicating what 
                          signature types to use
     training_streams  -- filename of streamfile of innocuous pool
-    training_stats    -- filename of statistics of innocuous pool
+    training_stats    -- filename of statistics of innocuous pool, a context
+                         model (see trace_crunching/context_model.py) or
+                         an older pickle
     fpos_eval_streams -- filename of streamfile to evaluate false positives
     fpos_eval_count   -- how many streams to evaluate each signature on
     dynamic_workload  -- a dictionary describing the variable size workload
@@ -267,17 +313,26 @@ def bigeval(
     ts                -- If generating a table, this is the 
                          ts for which results to use
     caption           -- If generating a table, this will be the table caption
+    fpos_store        -- file keeping the false positive rate estimates of
+                         tokens, shared by every trial using it
+    jobs              -- threads scoring the training streams when setting
+                         the threshold of a Bayes signature, and processes
+                         comparing sample pairs when clustering
     """
 
     import pickle
 
     stats=None
     if not do_table:
+        if fpos_store:
+            import polygraph.sig_gen.sig_gen
+            polygraph.sig_gen.sig_gen.set_fpos_store(fpos_store)
+
         # load the training stats
         if training_stats:
             print "Loading training stats"
-            f = open(training_stats)
-            stats = pickle.load(f)
+            import polygraph.trace_crunching.context_model as context_model
+            stats = context_model.load(training_stats)
         else:
 #            print "No training stats"
             stats=None
@@ -315,31 +370,31 @@ def bigeval(
             sigs.append(polygraph.sig_gen.bayes.Bayes(pname="Conjunction", fname="BayesAnd", kfrac=1,minlen=2,statsfile=stats, training_trace=training_streams, threshold_style='min'))
         elif n == 'BayesFuzzyAnd':
             import polygraph.sig_gen.bayes
-            sigs.append(polygraph.sig_gen.bayes.Bayes(pname="BayesFuzzyAnd", fname="BayesFuzzyAnd", kfrac=1,minlen=2,statsfile=stats, threshold_style='bound', max_fpos=5,training_trace=training_streams))
+            sigs.append(polygraph.sig_gen.bayes.Bayes(pname="BayesFuzzyAnd", fname="BayesFuzzyAnd", kfrac=1,minlen=2,statsfile=stats, threshold_style='bound', max_fpos=5,training_trace=training_streams, jobs=jobs))
         elif n == 'LCSeq':
             import polygraph.sig_gen.lcseq_tree
-            sigs.append(polygraph.sig_gen.lcseq_tree.LCSeqTree(pname="Token Subsequence", fname="lcseq", kfrac=1, tokenize_all=True, tokenize_pairs=False, minlen=2,statsfile=stats, do_cluster=False))
+            sigs.append(polygraph.sig_gen.lcseq_tree.LCSeqTree(pname="Token Subsequence", fname="lcseq", kfrac=1, tokenize_all=True, tokenize_pairs=False, minlen=2,statsfile=stats, do_cluster=False, jobs=jobs))
         elif n == 'Bayes2':
             import polygraph.sig_gen.bayes
-            sigs.append(polygraph.sig_gen.bayes.Bayes(pname="Bayes2", fname="bayes2", kmin=4, kfrac=.2,minlen=2,statsfile=stats, threshold_style='bound', max_fpos=5, training_trace=training_streams))
+            sigs.append(polygraph.sig_gen.bayes.Bayes(pname="Bayes2", fname="bayes2", kmin=4, kfrac=.2,minlen=2,statsfile=stats, threshold_style='bound', max_fpos=5, training_trace=training_streams, jobs=jobs))
         elif n == 'Bayes':
             import polygraph.sig_gen.bayes
-            sigs.append(polygraph.sig_gen.bayes.Bayes(pname="Bayes", fname="bayes", kmin=3, kfrac=.2,minlen=2,statsfile=stats, threshold_style='bound', max_fpos=5, training_trace=training_streams))
+            sigs.append(polygraph.sig_gen.bayes.Bayes(pname="Bayes", fname="bayes", kmin=3, kfrac=.2,minlen=2,statsfile=stats, threshold_style='bound', max_fpos=5, training_trace=training_streams, jobs=jobs))
         elif n == 'LCSeqTree':
             import polygraph.sig_gen.lcseq_tree
-            sigs.append(polygraph.sig_gen.lcseq_tree.LCSeqTree(pname="Token Subsequence", fname="lcseq_tree", k=3, tokenize_all=True, tokenize_pairs=False, minlen=2,statsfile=stats, spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=3))
+            sigs.append(polygraph.sig_gen.lcseq_tree.LCSeqTree(pname="Token Subsequence", fname="lcseq_tree", k=3, tokenize_all=True, tokenize_pairs=False, minlen=2,statsfile=stats, spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=3, jobs=jobs))
         elif n == 'BayesAndTree':
             import polygraph.sig_gen.bayes_tree
-            sigs.append(polygraph.sig_gen.bayes_tree.BayesTree(pname="Conjunction", fname="BayesAndTree", kfrac=1,minlen=2,statsfile=stats, threshold_style='min', spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=3))
+            sigs.append(polygraph.sig_gen.bayes_tree.BayesTree(pname="Conjunction", fname="BayesAndTree", kfrac=1,minlen=2,statsfile=stats, threshold_style='min', spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=3, jobs=jobs))
         elif n == 'BayesAndTree2':
             import polygraph.sig_gen.bayes_tree
-            sigs.append(polygraph.sig_gen.bayes_tree.BayesTree(pname="Conjunction2", fname="BayesAndTree2", kfrac=1,minlen=2,statsfile=stats, threshold_style='min', spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=10))
+            sigs.append(polygraph.sig_gen.bayes_tree.BayesTree(pname="Conjunction2", fname="BayesAndTree2", kfrac=1,minlen=2,statsfile=stats, threshold_style='min', spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=10, jobs=jobs))
         elif n == 'BayesFuzzyAndTree':
             import polygraph.sig_gen.bayes_tree
-            sigs.append(polygraph.sig_gen.bayes_tree.BayesTree(pname="BayesFuzzyAndTree", fname="BayesFuzzyAndTree", kfrac=1,minlen=2,statsfile=stats, threshold_style='bound', spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=3))
+            sigs.append(polygraph.sig_gen.bayes_tree.BayesTree(pname="BayesFuzzyAndTree", fname="BayesFuzzyAndTree", kfrac=1,minlen=2,statsfile=stats, threshold_style='bound', spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=3, jobs=jobs))
         elif n == 'BayesTree':
             import polygraph.sig_gen.bayes_tree
-            sigs.append(polygraph.sig_gen.bayes_tree.BayesTree(pname="Bayes", fname="bayes_tree", kmin=3, kfrac=.2,minlen=2,statsfile=stats, threshold_style='bound', spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=3))
+            sigs.append(polygraph.sig_gen.bayes_tree.BayesTree(pname="Bayes", fname="bayes_tree", kmin=3, kfrac=.2,minlen=2,statsfile=stats, threshold_style='bound', spec_threshold=3, max_fp_count=5, fpos_training_streams=training_streams, min_cluster_size=3, jobs=jobs))
         else:
             print "Bad signature name"
             sys.exit(1)
@@ -347,9 +402,9 @@ def bigeval(
     # run the evaluation
     if not do_table:
         if fpos_eval_streams:
-            evaluate(sigs, dynamic_workload, static_workloads, dynamic_range, lambda s: fpos_eval_trace(s, fpos_eval_count, fpos_eval_streams), trials, starttrial)
+            evaluate(sigs, dynamic_workload, static_workloads, dynamic_range, lambda ss: fpos_eval_trace(ss, fpos_eval_count, fpos_eval_streams), trials, starttrial)
         else:
-            evaluate(sigs, dynamic_workload, static_workloads, dynamic_range, lambda s: fpos_eval_usrbin(s), trials, starttrial)
+            evaluate(sigs, dynamic_workload, static_workloads, dynamic_range, lambda ss: fpos_eval_usrbin(ss), trials, starttrial)
     else:
         import make_graph as make_table
 #        import make_table_multiple2 as make_table
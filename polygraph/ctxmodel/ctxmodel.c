@@ -0,0 +1,912 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ctxmodel.h"
+
+#define MAGIC       "PGCTXMD1"
+#define VERSION     1
+#define BYTE_ORDER_MARK 0x01020304
+#define HEADER_LEN  64
+#define SKETCH_HEADER_LEN 64
+
+/* flags */
+#define SKETCHED    1
+
+/* sketch keys of f counts; the top bit of a string key is never set */
+#define FOLLOWED    (1ULL << 63)
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t window;
+	uint32_t byte_order;
+	uint32_t flags;
+	uint64_t nslots;
+	uint64_t count;
+	uint64_t streams;
+	uint64_t bytes;
+	uint64_t reserved;
+} header_t;
+
+typedef struct {
+	uint32_t depth;
+	uint32_t pad;
+	uint64_t width;
+	uint64_t threshold;
+	uint64_t total;
+	uint64_t reserved[4];
+} sketch_header_t;
+
+typedef struct {
+	ctxmodel_slot_t *slots;
+	uint64_t nslots;
+	uint64_t count;
+} table_t;
+
+/* The builder counts n in the slots and, in f, the number of streams
+ * ending with the string; f = n - that once the counting is done.
+ */
+typedef struct {
+	const unsigned char *data;
+	const uint64_t *offsets;
+	uint32_t first, last;   /* streams [first, last) */
+	int window;
+	table_t table;
+	int rv;
+
+	/* approximate models */
+	uint32_t *counters;     /* first pass, depth * width */
+	ctxmodel_sketch_t sketch;  /* estimates for the second pass */
+	uint64_t capacity;      /* strings the table may hold */
+	uint64_t threshold;
+	table_t *heavy;         /* strings left out of the last sketch */
+} shard_t;
+
+static uint64_t
+mix(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static uint64_t
+pack(const unsigned char *s, int len)
+{
+	uint64_t key = 0;
+	int i;
+
+	for (i = 0; i < len; i++)
+		key = (key << 8) | s[i];
+	return ((uint64_t)(len + 1) << 56) | key;
+}
+
+static int
+table_init(table_t *t, uint64_t nslots)
+{
+	t->slots = calloc(nslots, sizeof(ctxmodel_slot_t));
+	if (t->slots == NULL)
+		return -1;
+	t->nslots = nslots;
+	t->count = 0;
+	return 0;
+}
+
+static ctxmodel_slot_t *
+table_slot(table_t *t, uint64_t key)
+{
+	uint64_t mask = t->nslots - 1, i = mix(key) & mask;
+
+	while (t->slots[i].key != 0 && t->slots[i].key != key)
+		i = (i + 1) & mask;
+	return &t->slots[i];
+}
+
+static int
+table_grow(table_t *t)
+{
+	table_t bigger;
+	uint64_t i;
+
+	if (table_init(&bigger, t->nslots * 2) < 0)
+		return -1;
+	for (i = 0; i < t->nslots; i++) {
+		if (t->slots[i].key != 0)
+			*table_slot(&bigger, t->slots[i].key) = t->slots[i];
+	}
+	bigger.count = t->count;
+	free(t->slots);
+	*t = bigger;
+	return 0;
+}
+
+static int
+table_add(table_t *t, uint64_t key, uint64_t n, uint64_t f)
+{
+	ctxmodel_slot_t *slot = table_slot(t, key);
+
+	if (slot->key == 0) {
+		if (2 * (t->count + 1) > t->nslots) {
+			if (table_grow(t) < 0)
+				return -1;
+			slot = table_slot(t, key);
+		}
+		slot->key = key;
+		t->count++;
+	}
+	slot->n += n;
+	slot->f += f;
+	return 0;
+}
+
+/* The depth counters of key, by double hashing. */
+static void
+sketch_index(const ctxmodel_sketch_t *sk, uint64_t key, uint64_t *idx)
+{
+	uint64_t h1 = mix(key), h2 = mix(key ^ 0x9e3779b97f4a7c15ULL) | 1;
+	int r;
+
+	for (r = 0; r < sk->depth; r++)
+		idx[r] = r * sk->width + ((h1 + r * h2) & (sk->width - 1));
+}
+
+static uint64_t
+sketch_estimate(const ctxmodel_sketch_t *sk, uint64_t key)
+{
+	uint64_t idx[CTXMODEL_SKETCH_DEPTH], est = UINT32_MAX;
+	int r;
+
+	sketch_index(sk, key, idx);
+	for (r = 0; r < sk->depth; r++) {
+		if (sk->counters[idx[r]] < est)
+			est = sk->counters[idx[r]];
+	}
+	return est;
+}
+
+/* Conservative update: only the smallest counters of key grow, which
+ * keeps the estimate an upper bound and spares the others.
+ */
+static void
+sketch_add(uint32_t *counters, const ctxmodel_sketch_t *sk, uint64_t key)
+{
+	uint64_t idx[CTXMODEL_SKETCH_DEPTH];
+	uint32_t min = UINT32_MAX;
+	int r;
+
+	sketch_index(sk, key, idx);
+	for (r = 0; r < sk->depth; r++) {
+		if (counters[idx[r]] < min)
+			min = counters[idx[r]];
+	}
+	if (min == UINT32_MAX)
+		return;
+	for (r = 0; r < sk->depth; r++) {
+		if (counters[idx[r]] == min)
+			counters[idx[r]]++;
+	}
+}
+
+/* Keeps the strings estimated at least threshold times. They were
+ * counted from their first occurrence, since the threshold only grows.
+ */
+static int
+heavy_evict(table_t *t, const ctxmodel_sketch_t *sk, uint64_t threshold)
+{
+	table_t kept;
+	uint64_t i;
+
+	if (table_init(&kept, t->nslots) < 0)
+		return -1;
+	for (i = 0; i < t->nslots; i++) {
+		if (t->slots[i].key != 0 &&
+		    sketch_estimate(sk, t->slots[i].key) >= threshold) {
+			*table_slot(&kept, t->slots[i].key) = t->slots[i];
+			kept.count++;
+		}
+	}
+	free(t->slots);
+	*t = kept;
+	return 0;
+}
+
+/* table_add for the strings estimated at least *threshold times, which
+ * doubles while the table is full.
+ */
+static int
+heavy_add(table_t *t, const ctxmodel_sketch_t *sk, uint64_t capacity,
+          uint64_t *threshold, uint64_t key, uint64_t n, uint64_t f)
+{
+	ctxmodel_slot_t *slot = table_slot(t, key);
+
+	if (slot->key == 0) {
+		uint64_t est = sketch_estimate(sk, key);
+
+		if (est < *threshold)
+			return 0;
+		while (t->count + 1 > capacity) {
+			*threshold += (*threshold + 3) / 4;
+			if (heavy_evict(t, sk, *threshold) < 0)
+				return -1;
+		}
+		if (est < *threshold)
+			return 0;
+		slot = table_slot(t, key);
+		slot->key = key;
+		t->count++;
+	}
+	slot->n += n;
+	slot->f += f;
+	return 0;
+}
+
+static void *
+count_shard(void *arg)
+{
+	shard_t *sh = (shard_t *)arg;
+	uint64_t masks[CTXMODEL_MAX_WINDOW + 1];
+	uint32_t i;
+	int m;
+
+	for (m = 0; m <= CTXMODEL_MAX_WINDOW; m++)
+		masks[m] = (1ULL << (8 * m)) - 1;
+
+	sh->rv = table_init(&sh->table, 1 << 16);
+	for (i = sh->first; sh->rv == 0 && i < sh->last; i++) {
+		const unsigned char *p = sh->data + sh->offsets[i];
+		uint64_t len = sh->offsets[i + 1] - sh->offsets[i], j, w = 0;
+
+		for (j = 0; j < len; j++) {
+			int longest = (j + 1 < (uint64_t)sh->window) ?
+			              (int)j + 1 : sh->window;
+
+			w = (w << 8) | p[j];
+			for (m = 1; m <= longest; m++) {
+				uint64_t key = ((uint64_t)(m + 1) << 56) |
+				               (w & masks[m]);
+
+				if (table_add(&sh->table, key, 1, 0) < 0) {
+					sh->rv = -1;
+					break;
+				}
+			}
+		}
+
+		/* the strings at the end of the stream are not followed */
+		for (m = 1; sh->rv == 0 && m < sh->window && (uint64_t)m <= len;
+		     m++) {
+			if (table_add(&sh->table, ((uint64_t)(m + 1) << 56) |
+			              (w & masks[m]), 0, 1) < 0)
+				sh->rv = -1;
+		}
+	}
+	return NULL;
+}
+
+static void
+sketch_light(shard_t *sh, uint64_t key)
+{
+	if (sh->heavy != NULL && table_slot(sh->heavy, key & ~FOLLOWED)->key != 0)
+		return;
+	sketch_add(sh->counters, &sh->sketch, key);
+	sh->sketch.total++;
+}
+
+/* Sketches every string, and every context followed by a byte under
+ * its FOLLOWED key, but those in sh->heavy if it is set.
+ */
+static void *
+sketch_shard(void *arg)
+{
+	shard_t *sh = (shard_t *)arg;
+	uint64_t masks[CTXMODEL_MAX_WINDOW + 1];
+	uint64_t ncounters = sh->sketch.depth * sh->sketch.width;
+	uint32_t i;
+	int m;
+
+	for (m = 0; m <= CTXMODEL_MAX_WINDOW; m++)
+		masks[m] = (1ULL << (8 * m)) - 1;
+
+	if (sh->counters == NULL &&
+	    (sh->counters = malloc(ncounters * sizeof(uint32_t))) == NULL) {
+		sh->rv = -1;
+		return NULL;
+	}
+	memset(sh->counters, 0, ncounters * sizeof(uint32_t));
+	sh->sketch.total = 0;
+	for (i = sh->first; i < sh->last; i++) {
+		const unsigned char *p = sh->data + sh->offsets[i];
+		uint64_t len = sh->offsets[i + 1] - sh->offsets[i], j, w = 0;
+
+		for (j = 0; j < len; j++) {
+			int longest = (j + 1 < (uint64_t)sh->window) ?
+			              (int)j + 1 : sh->window;
+
+			/* the contexts before this byte */
+			for (m = 1; m < longest; m++) {
+				sketch_light(sh, FOLLOWED | ((uint64_t)(m + 1) << 56) |
+				             (w & masks[m]));
+			}
+			w = (w << 8) | p[j];
+			for (m = 1; m <= longest; m++)
+				sketch_light(sh, ((uint64_t)(m + 1) << 56) |
+				             (w & masks[m]));
+		}
+	}
+	return NULL;
+}
+
+/* Adds the counters of the other shards to the first one's. */
+static void
+merge_sketches(shard_t *shards, int nthreads)
+{
+	uint64_t ncounters = shards[0].sketch.depth * shards[0].sketch.width, j;
+	int i;
+
+	for (i = 1; i < nthreads; i++) {
+		for (j = 0; j < ncounters; j++) {
+			uint64_t sum = (uint64_t)shards[0].counters[j] +
+			               shards[i].counters[j];
+
+			shards[0].counters[j] = (sum > UINT32_MAX) ? UINT32_MAX : sum;
+		}
+		shards[0].sketch.total += shards[i].sketch.total;
+	}
+}
+
+/* Second pass: exact counts of the strings the merged sketch estimates
+ * at least sh->threshold times.
+ */
+static void *
+heavy_shard(void *arg)
+{
+	shard_t *sh = (shard_t *)arg;
+	uint64_t masks[CTXMODEL_MAX_WINDOW + 1];
+	uint32_t i;
+	int m;
+
+	for (m = 0; m <= CTXMODEL_MAX_WINDOW; m++)
+		masks[m] = (1ULL << (8 * m)) - 1;
+
+	sh->rv = table_init(&sh->table, sh->table.nslots);
+	for (i = sh->first; sh->rv == 0 && i < sh->last; i++) {
+		const unsigned char *p = sh->data + sh->offsets[i];
+		uint64_t len = sh->offsets[i + 1] - sh->offsets[i], j, w = 0;
+
+		for (j = 0; j < len; j++) {
+			int longest = (j + 1 < (uint64_t)sh->window) ?
+			              (int)j + 1 : sh->window;
+
+			w = (w << 8) | p[j];
+			for (m = 1; m <= longest; m++) {
+				if (heavy_add(&sh->table, &sh->sketch, sh->capacity,
+				              &sh->threshold, ((uint64_t)(m + 1) << 56) |
+				              (w & masks[m]), 1, 0) < 0) {
+					sh->rv = -1;
+					break;
+				}
+			}
+		}
+
+		/* a string at the end is in the table if it is heavy */
+		for (m = 1; sh->rv == 0 && m < sh->window && (uint64_t)m <= len;
+		     m++) {
+			ctxmodel_slot_t *slot = table_slot(&sh->table,
+			                          ((uint64_t)(m + 1) << 56) |
+			                          (w & masks[m]));
+
+			if (slot->key != 0)
+				slot->f++;
+		}
+	}
+	return NULL;
+}
+
+/* Runs fn on every shard, in threads if there are several. */
+static int
+run_shards(shard_t *shards, int nthreads, void *(*fn)(void *))
+{
+	pthread_t *threads;
+	int i, rv = 0, nstarted = 0;
+
+	if (nthreads == 1) {
+		fn(&shards[0]);
+		return shards[0].rv;
+	}
+	if ((threads = calloc(nthreads, sizeof(pthread_t))) == NULL)
+		return -1;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, fn, &shards[i]) != 0) {
+			rv = -1;
+			break;
+		}
+		nstarted++;
+	}
+	for (i = 0; i < nstarted; i++) {
+		pthread_join(threads[i], NULL);
+		if (shards[i].rv < 0)
+			rv = -1;
+	}
+	free(threads);
+	return rv;
+}
+
+/* n and f of the strings in the table, from the counts of the shards. */
+static int
+finish_table(table_t *t, int window, uint64_t bytes)
+{
+	ctxmodel_slot_t *empty;
+	uint64_t j;
+
+	/* every byte follows the empty context */
+	if (table_add(t, pack(NULL, 0), 0, 0) < 0)
+		return -1;
+	empty = table_slot(t, pack(NULL, 0));
+	empty->n = bytes;
+	empty->f = bytes;
+	for (j = 0; j < t->nslots; j++) {
+		ctxmodel_slot_t *slot = &t->slots[j];
+		int len = (int)(slot->key >> 56) - 1;
+
+		if (slot->key == 0 || slot == empty)
+			continue;
+		slot->f = (len < window) ? slot->n - slot->f : 0;
+	}
+	return 0;
+}
+
+static int
+write_model(const char *model_name, const table_t *t, int window,
+            uint32_t nstreams, uint64_t bytes, const ctxmodel_sketch_t *sk)
+{
+	table_t out;
+	header_t h;
+	FILE *fp;
+	uint64_t i, nslots = 16;
+	int rv = 0;
+
+	/* at most half full, as for building */
+	while (nslots < 2 * t->count)
+		nslots *= 2;
+	if (table_init(&out, nslots) < 0)
+		return -1;
+	for (i = 0; i < t->nslots; i++) {
+		if (t->slots[i].key != 0)
+			*table_slot(&out, t->slots[i].key) = t->slots[i];
+	}
+	out.count = t->count;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MAGIC, 8);
+	h.version = VERSION;
+	h.window = window;
+	h.byte_order = BYTE_ORDER_MARK;
+	h.nslots = out.nslots;
+	h.count = out.count;
+	h.streams = nstreams;
+	h.bytes = bytes;
+	if (sk != NULL)
+		h.flags = SKETCHED;
+
+	if ((fp = fopen(model_name, "wb")) == NULL) {
+		free(out.slots);
+		return -1;
+	}
+	if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	    fwrite(out.slots, sizeof(ctxmodel_slot_t), out.nslots, fp) !=
+	    out.nslots)
+		rv = -1;
+	if (rv == 0 && sk != NULL) {
+		sketch_header_t sh;
+
+		memset(&sh, 0, sizeof(sh));
+		sh.depth = sk->depth;
+		sh.width = sk->width;
+		sh.threshold = sk->threshold;
+		sh.total = sk->total;
+		if (fwrite(&sh, sizeof(sh), 1, fp) != 1 ||
+		    fwrite(sk->counters, sizeof(uint32_t), sk->depth * sk->width,
+		           fp) != sk->depth * sk->width)
+			rv = -1;
+	}
+	if (fclose(fp) != 0)
+		rv = -1;
+	free(out.slots);
+	if (rv < 0)
+		unlink(model_name);
+	return rv;
+}
+
+static int
+build_exact(shard_t *shards, int nthreads, int window, uint32_t nstreams,
+            uint64_t bytes, const char *model_name)
+{
+	table_t *t;
+	uint64_t j;
+	int i, rv;
+
+	rv = run_shards(shards, nthreads, count_shard);
+
+	/* merge the shards into the first one */
+	t = &shards[0].table;
+	for (i = 1; rv == 0 && i < nthreads; i++) {
+		const table_t *o = &shards[i].table;
+
+		for (j = 0; rv == 0 && j < o->nslots; j++) {
+			if (o->slots[j].key != 0)
+				rv = table_add(t, o->slots[j].key, o->slots[j].n,
+				               o->slots[j].f);
+		}
+	}
+
+	if (rv == 0)
+		rv = finish_table(t, window, bytes);
+	if (rv == 0)
+		rv = write_model(model_name, t, window, nstreams, bytes, NULL);
+	return rv;
+}
+
+static int
+build_sketch(shard_t *shards, int nthreads, int window, uint32_t nstreams,
+             uint64_t bytes, size_t budget, const char *model_name)
+{
+	ctxmodel_sketch_t sk;
+	uint64_t width = 1, nslots = 16, threshold, j;
+	table_t merged;
+	int i, rv;
+
+	/* half of the budget for each, in powers of 2 */
+	while (2 * width * CTXMODEL_SKETCH_DEPTH * sizeof(uint32_t) <= budget / 2)
+		width *= 2;
+	while (2 * nslots * sizeof(ctxmodel_slot_t) <= budget / 2)
+		nslots *= 2;
+	if (width < CTXMODEL_MIN_WIDTH) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < nthreads; i++) {
+		shards[i].sketch.depth = CTXMODEL_SKETCH_DEPTH;
+		shards[i].sketch.width = width;
+	}
+
+	/* the first shard's sketch gathers the others */
+	if ((rv = run_shards(shards, nthreads, sketch_shard)) < 0)
+		return rv;
+	merge_sketches(shards, nthreads);
+	sk = shards[0].sketch;
+	sk.counters = shards[0].counters;
+
+	/* leave a slot for the empty context */
+	for (i = 0; i < nthreads; i++) {
+		shards[i].sketch = sk;
+		shards[i].table.nslots = nslots;
+		shards[i].capacity = nslots / 2 - 1;
+		shards[i].threshold = 1;
+	}
+	if ((rv = run_shards(shards, nthreads, heavy_shard)) < 0)
+		return rv;
+
+	/* a string in every table had counted since its first occurrence
+	 * once the threshold is the highest of them
+	 */
+	threshold = 1;
+	for (i = 0; i < nthreads; i++) {
+		if (shards[i].threshold > threshold)
+			threshold = shards[i].threshold;
+	}
+	if (table_init(&merged, nslots) < 0)
+		return -1;
+	for (i = 0; rv == 0 && i < nthreads; i++) {
+		const table_t *o = &shards[i].table;
+
+		for (j = 0; rv == 0 && j < o->nslots; j++) {
+			if (o->slots[j].key != 0)
+				rv = heavy_add(&merged, &sk, nslots / 2 - 1,
+				               &threshold, o->slots[j].key,
+				               o->slots[j].n, o->slots[j].f);
+		}
+	}
+
+	/* Sketch the other strings again, without the counts of the
+	 * table's, whose collisions made most estimates reach the
+	 * threshold.
+	 */
+	for (i = 0; rv == 0 && i < nthreads; i++)
+		shards[i].heavy = &merged;
+	if (rv == 0)
+		rv = run_shards(shards, nthreads, sketch_shard);
+	if (rv == 0) {
+		merge_sketches(shards, nthreads);
+		sk.total = shards[0].sketch.total;
+		rv = finish_table(&merged, window, bytes);
+	}
+	if (rv == 0) {
+		sk.threshold = threshold;
+		rv = write_model(model_name, &merged, window, nstreams, bytes, &sk);
+	}
+	free(merged.slots);
+	return rv;
+}
+
+int
+ctxmodel_build(const char *data_name, const uint64_t *offsets,
+               uint32_t nstreams, int window, int nthreads,
+               size_t budget, const char *model_name)
+{
+	int fd, i, rv;
+	struct stat st;
+	const unsigned char *data = NULL;
+	uint64_t bytes = offsets[nstreams];
+	shard_t *shards;
+	uint32_t s;
+
+	if (window < 1 || window > CTXMODEL_MAX_WINDOW || nthreads < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((fd = open(data_name, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if ((uint64_t)st.st_size < bytes) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	if (bytes > 0) {
+		data = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise((void *)data, bytes, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	if ((shards = calloc(nthreads, sizeof(shard_t))) == NULL) {
+		if (data)
+			munmap((void *)data, bytes);
+		return -1;
+	}
+
+	/* about the same number of bytes in each shard */
+	s = 0;
+	for (i = 0; i < nthreads; i++) {
+		shards[i].data = data;
+		shards[i].offsets = offsets;
+		shards[i].window = window;
+		shards[i].first = s;
+		while (s < nstreams &&
+		       offsets[s] < bytes / nthreads * (i + 1))
+			s++;
+		if (i == nthreads - 1)
+			s = nstreams;
+		shards[i].last = s;
+	}
+
+	if (budget == 0)
+		rv = build_exact(shards, nthreads, window, nstreams, bytes,
+		                 model_name);
+	else
+		rv = build_sketch(shards, nthreads, window, nstreams, bytes,
+		                  budget, model_name);
+
+	for (i = 0; i < nthreads; i++) {
+		free(shards[i].table.slots);
+		free(shards[i].counters);
+	}
+	free(shards);
+	if (data)
+		munmap((void *)data, bytes);
+	if (rv < 0 && errno == 0)
+		errno = ENOMEM;
+	return rv;
+}
+
+ctxmodel_t *
+ctxmodel_open(const char *model_name)
+{
+	ctxmodel_t *model;
+	const header_t *h;
+	const sketch_header_t *sh = NULL;
+	struct stat st;
+	size_t size;
+	int fd;
+
+	if ((fd = open(model_name, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < HEADER_LEN) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((model = calloc(1, sizeof(ctxmodel_t))) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	model->size = st.st_size;
+	model->map = mmap(NULL, model->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (model->map == MAP_FAILED) {
+		free(model);
+		return NULL;
+	}
+
+	h = (const header_t *)model->map;
+	size = HEADER_LEN + h->nslots * sizeof(ctxmodel_slot_t);
+	if ((h->flags & SKETCHED) && model->size >= size + SKETCH_HEADER_LEN) {
+		sh = (const sketch_header_t *)((const char *)model->map + size);
+		size += SKETCH_HEADER_LEN +
+		        sh->depth * sh->width * sizeof(uint32_t);
+	}
+	if (memcmp(h->magic, MAGIC, 8) != 0 || h->version != VERSION ||
+	    h->byte_order != BYTE_ORDER_MARK ||
+	    h->window < 1 || h->window > CTXMODEL_MAX_WINDOW ||
+	    h->nslots == 0 || (h->nslots & (h->nslots - 1)) != 0 ||
+	    ((h->flags & SKETCHED) && (sh == NULL ||
+	     sh->depth < 1 || sh->depth > CTXMODEL_SKETCH_DEPTH ||
+	     sh->width == 0 || (sh->width & (sh->width - 1)) != 0 ||
+	     sh->threshold == 0)) ||
+	    model->size != size) {
+		munmap(model->map, model->size);
+		free(model);
+		errno = EINVAL;
+		return NULL;
+	}
+	model->window = h->window;
+	model->nslots = h->nslots;
+	model->count = h->count;
+	model->streams = h->streams;
+	model->bytes = h->bytes;
+	model->slots = (const ctxmodel_slot_t *)
+	               ((const char *)model->map + HEADER_LEN);
+	if (sh != NULL) {
+		model->sketch.depth = sh->depth;
+		model->sketch.width = sh->width;
+		model->sketch.threshold = sh->threshold;
+		model->sketch.total = sh->total;
+		model->sketch.counters = (const uint32_t *)
+		                         ((const char *)sh + SKETCH_HEADER_LEN);
+	}
+	return model;
+}
+
+void
+ctxmodel_close(ctxmodel_t *model)
+{
+	munmap(model->map, model->size);
+	free(model);
+}
+
+const ctxmodel_slot_t *
+ctxmodel_lookup(const ctxmodel_t *model, const unsigned char *s, int len)
+{
+	uint64_t key, mask = model->nslots - 1, i;
+
+	if (len < 0 || len > model->window)
+		return NULL;
+	key = pack(s, len);
+	for (i = mix(key) & mask; model->slots[i].key != 0;
+	     i = (i + 1) & mask) {
+		if (model->slots[i].key == key)
+			return &model->slots[i];
+	}
+	return NULL;
+}
+
+int
+ctxmodel_counts(const ctxmodel_t *model, const unsigned char *s, int len,
+                uint64_t *n, uint64_t *f)
+{
+	const ctxmodel_slot_t *slot;
+	uint64_t key, cap;
+
+	if ((slot = ctxmodel_lookup(model, s, len)) != NULL) {
+		*n = slot->n;
+		*f = slot->f;
+		return 1;
+	}
+	*n = *f = 0;
+	if (model->sketch.counters == NULL || len < 1 || len > model->window)
+		return 1;
+
+	/* not in the table, so seen fewer than threshold times */
+	key = pack(s, len);
+	cap = model->sketch.threshold - 1;
+	*n = sketch_estimate(&model->sketch, key);
+	if (*n > cap)
+		*n = cap;
+	if (len < model->window) {
+		*f = sketch_estimate(&model->sketch, FOLLOWED | key);
+		if (*f > cap)
+			*f = cap;
+	}
+	return 0;
+}
+
+double
+ctxmodel_error(const ctxmodel_t *model, double *confidence)
+{
+	const ctxmodel_sketch_t *sk = &model->sketch;
+	double error;
+
+	*confidence = 1;
+	if (sk->counters == NULL)
+		return 0;
+	*confidence = 1 - exp(-sk->depth);
+	error = ceil(exp(1) * sk->total / sk->width);
+	if (error > sk->threshold - 1)
+		error = sk->threshold - 1;
+	return error;
+}
+
+double
+ctxmodel_prob(const ctxmodel_t *model, const unsigned char *context,
+              int len, unsigned char byte, int max_context)
+{
+	unsigned char s[CTXMODEL_MAX_WINDOW + 1];
+	uint64_t cn, cf, bn, bf;
+	double prob = 0, thisprob;
+	int start;
+
+	if (len > max_context) {
+		context += len - max_context;
+		len = max_context;
+	}
+	ctxmodel_counts(model, NULL, 0, &cn, &cf);
+	if (cf > 0)
+		prob = 1.0 / cf;
+
+	/* longer contexts than the model has are never found */
+	for (start = 0; start <= len; start++) {
+		int clen = len - start;
+
+		if (clen + 1 > model->window)
+			continue;
+		ctxmodel_counts(model, context + start, clen, &cn, &cf);
+		if (cf == 0)
+			continue;
+		memcpy(s, context + start, clen);
+		s[clen] = byte;
+		ctxmodel_counts(model, s, clen + 1, &bn, &bf);
+		if (bn == 0)
+			continue;
+
+		/* estimates may overshoot; n(context + byte) <= f(context) */
+		if (bn > cf)
+			bn = cf;
+		thisprob = (double)bn / cf;
+		if (thisprob > prob)
+			prob = thisprob;
+	}
+	return prob;
+}
@@ -0,0 +1,128 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+/* Byte context statistics of a streamfile, as gathered by
+ * priorprob.PortInfo: for every context of fewer than window bytes,
+ * how often it is followed by a byte, and how often by each byte.
+ *
+ * Strings of up to CTXMODEL_MAX_WINDOW bytes are packed in a 64 bit
+ * key, their length plus one in the top byte and the bytes below it,
+ * so that the empty context is not the empty slot. A string s of the
+ * model has n(s), its number of occurrences, and f(s), the number of
+ * them followed by another byte of the same stream. The statistics of
+ * priorprob are then count = f(context) and bytes[b] = n(context + b).
+ *
+ * The model file is the open addressing table itself, so opening it
+ * is a mmap and a lookup touches a slot or two:
+ *   header: "PGCTXMD1", version, window, byte order mark, slots,
+ *           strings, streams, bytes
+ *   slots:  key, n, f, as native 64 bit integers, key 0 if empty
+ *
+ * A model built with a memory budget is approximate. Its table only
+ * holds the strings seen at least threshold times, with exact counts;
+ * the others are counted in a count-min sketch of depth rows of width
+ * 32 bit counters, which follows the table in the file:
+ *   sketch: depth, width, threshold, total
+ *   counters: depth * width native 32 bit integers
+ * A sketch estimate is never below the true count, and exceeds it by
+ * more than e * total / width with probability at most exp(-depth).
+ * Strings missing from the table occur fewer than threshold times, so
+ * their estimates are capped at threshold - 1 as well.
+ */
+#ifndef CTXMODEL_H
+#define CTXMODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CTXMODEL_MAX_WINDOW 7
+#define CTXMODEL_SKETCH_DEPTH 4
+#define CTXMODEL_MIN_WIDTH 1024
+/* the smallest budget, with a sketch of CTXMODEL_MIN_WIDTH in half of it */
+#define CTXMODEL_MIN_BUDGET \
+	(2 * CTXMODEL_MIN_WIDTH * CTXMODEL_SKETCH_DEPTH * sizeof(uint32_t))
+
+typedef struct {
+	uint64_t key;
+	uint64_t n;             /* occurrences */
+	uint64_t f;             /* occurrences followed by a byte */
+} ctxmodel_slot_t;
+
+typedef struct {
+	int depth;
+	uint64_t width;         /* a power of 2 */
+	uint64_t threshold;     /* of the strings in the table */
+	uint64_t total;         /* counted occurrences */
+	const uint32_t *counters;  /* depth * width, NULL if exact */
+} ctxmodel_sketch_t;
+
+typedef struct {
+	void *map;
+	size_t size;
+	int window;
+	uint64_t nslots;        /* a power of 2 */
+	uint64_t count;         /* strings */
+	uint64_t streams;
+	uint64_t bytes;
+	const ctxmodel_slot_t *slots;
+	ctxmodel_sketch_t sketch;
+} ctxmodel_t;
+
+/* Counts the strings of up to window bytes of the streams of data_name,
+ * and writes the model to model_name. offsets holds the start of each
+ * of the nstreams streams, and the data size after them. The streams
+ * are split in nthreads ranges of about the same size, counted in
+ * tables of their own that are then merged. Returns 0, or -1 with
+ * errno set.
+ *
+ * If budget is not 0 the model is approximate and its file takes about
+ * budget bytes, half of them for the table and half for the sketch;
+ * below CTXMODEL_MIN_BUDGET, it fails with EINVAL. The streams are read
+ * three times: to fill the sketch, to count exactly the strings it
+ * estimates at or above a threshold, raised by about a quarter whenever
+ * they outgrow the table, and to sketch the other strings again without
+ * them. Each thread needs the budget.
+ */
+int ctxmodel_build(const char *data_name, const uint64_t *offsets,
+                   uint32_t nstreams, int window, int nthreads,
+                   size_t budget, const char *model_name);
+
+/* Returns NULL, with errno set, if the model is missing or unreadable. */
+ctxmodel_t *ctxmodel_open(const char *model_name);
+void ctxmodel_close(ctxmodel_t *model);
+
+/* The slot of string s, or NULL if it is not in the table: it never
+ * occurs or, if the model is approximate, occurs too rarely.
+ */
+const ctxmodel_slot_t *ctxmodel_lookup(const ctxmodel_t *model,
+                                       const unsigned char *s, int len);
+
+/* Sets *n and *f for string s. Returns 1 if they are exact, 0 if they
+ * are sketch estimates.
+ */
+int ctxmodel_counts(const ctxmodel_t *model, const unsigned char *s, int len,
+                    uint64_t *n, uint64_t *f);
+
+/* The most an estimate exceeds the true count by, with probability at
+ * least *confidence; 0 for an exact model.
+ */
+double ctxmodel_error(const ctxmodel_t *model, double *confidence);
+
+/* sigprob.contextprob: the highest frequency of byte after a suffix of
+ * the last max_context bytes of context, at least one over the number
+ * of bytes.
+ */
+double ctxmodel_prob(const ctxmodel_t *model, const unsigned char *context,
+                     int len, unsigned char byte, int max_context);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <Python.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "ctxmodel.h"
+
+static PyObject*
+py_build(PyObject* self, PyObject* args)
+{
+	char *data_name, *model_name;
+	const void *buf;
+	int buflen;
+	int itemsize, window, nthreads = 1, rv;
+	long budget = 0;
+	uint64_t *offsets;
+	uint32_t nstreams, i;
+
+	if (!PyArg_ParseTuple(args, "ss#iis|il:build", &data_name, &buf, &buflen,
+	                      &itemsize, &window, &model_name, &nthreads,
+	                      &budget))
+		return NULL;
+	if (budget < 0) {
+		PyErr_SetString(PyExc_ValueError, "bad memory budget");
+		return NULL;
+	}
+	if (budget > 0 && (size_t)budget < CTXMODEL_MIN_BUDGET) {
+		PyErr_Format(PyExc_ValueError,
+		             "memory budget of %ld bytes is below the minimum of %ld",
+		             budget, (long)CTXMODEL_MIN_BUDGET);
+		return NULL;
+	}
+	if ((itemsize != 4 && itemsize != 8) || buflen % itemsize != 0 ||
+	    buflen == 0) {
+		PyErr_SetString(PyExc_ValueError, "bad offsets array");
+		return NULL;
+	}
+
+	/* the array ends with the data size */
+	nstreams = buflen / itemsize - 1;
+	if ((offsets = malloc(((size_t)nstreams + 1) * sizeof(uint64_t))) == NULL)
+		return PyErr_NoMemory();
+	for (i = 0; i <= nstreams; i++) {
+		if (itemsize == 4)
+			offsets[i] = ((const uint32_t *)buf)[i];
+		else
+			offsets[i] = ((const uint64_t *)buf)[i];
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	errno = 0;
+	rv = ctxmodel_build(data_name, offsets, nstreams, window, nthreads,
+	                    (size_t)budget, model_name);
+	Py_END_ALLOW_THREADS
+	free(offsets);
+
+	if (rv < 0)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, data_name);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_open(PyObject* self, PyObject* args)
+{
+	char *model_name;
+	ctxmodel_t *model;
+
+	if (!PyArg_ParseTuple(args, "s:open", &model_name))
+		return NULL;
+
+	errno = 0;
+	if ((model = ctxmodel_open(model_name)) == NULL)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, model_name);
+
+	/* return pointer to the handle */
+	return Py_BuildValue("l", (long)model);
+}
+
+static PyObject*
+py_close(PyObject* self, PyObject* args)
+{
+	ctxmodel_t *model;
+
+	if (!PyArg_ParseTuple(args, "l:close", (long*)&model)) return NULL;
+
+	ctxmodel_close(model);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_info(PyObject* self, PyObject* args)
+{
+	ctxmodel_t *model;
+
+	if (!PyArg_ParseTuple(args, "l:info", (long*)&model)) return NULL;
+
+	return Py_BuildValue("(iKKK)", model->window,
+	                     (unsigned PY_LONG_LONG)model->count,
+	                     (unsigned PY_LONG_LONG)model->streams,
+	                     (unsigned PY_LONG_LONG)model->bytes);
+}
+
+static PyObject*
+py_lookup(PyObject* self, PyObject* args)
+{
+	ctxmodel_t *model;
+	const char *s;
+	int len;
+	uint64_t n, f;
+
+	if (!PyArg_ParseTuple(args, "ls#:lookup", (long*)&model, &s, &len))
+		return NULL;
+
+	ctxmodel_counts(model, (const unsigned char *)s, len, &n, &f);
+	return Py_BuildValue("(KK)", (unsigned PY_LONG_LONG)n,
+	                     (unsigned PY_LONG_LONG)f);
+}
+
+static PyObject*
+py_error(PyObject* self, PyObject* args)
+{
+	ctxmodel_t *model;
+	double error, confidence;
+
+	if (!PyArg_ParseTuple(args, "l:error", (long*)&model)) return NULL;
+
+	error = ctxmodel_error(model, &confidence);
+	return Py_BuildValue("(dd)", error, confidence);
+}
+
+static PyObject*
+py_prob(PyObject* self, PyObject* args)
+{
+	ctxmodel_t *model;
+	const char *context, *byte;
+	int len, bytelen, max_context = 2;
+
+	if (!PyArg_ParseTuple(args, "ls#s#|i:prob", (long*)&model, &context,
+	                      &len, &byte, &bytelen, &max_context))
+		return NULL;
+	if (bytelen != 1) {
+		PyErr_SetString(PyExc_ValueError, "byte must be one character");
+		return NULL;
+	}
+
+	return PyFloat_FromDouble(ctxmodel_prob(model,
+	                                        (const unsigned char *)context,
+	                                        len, (unsigned char)byte[0],
+	                                        max_context));
+}
+
+static PyMethodDef ctxmodelc_funcs[] = {
+	{"build", (PyCFunction)py_build, METH_VARARGS,
+	 "build(data, offsets, itemsize, window, model, threads=1, budget=0): "
+	 "write the context model of a streamfile, approximate in about "
+	 "budget bytes if budget is set"},
+	{"open", (PyCFunction)py_open, METH_VARARGS,
+	 "open(model): map a context model"},
+	{"close", (PyCFunction)py_close, METH_VARARGS, "fillmein"},
+	{"info", (PyCFunction)py_info, METH_VARARGS,
+	 "(window, strings, streams, bytes) of a model"},
+	{"lookup", (PyCFunction)py_lookup, METH_VARARGS,
+	 "lookup(model, s): (occurrences, occurrences followed by a byte)"},
+	{"error", (PyCFunction)py_error, METH_VARARGS,
+	 "error(model): (most a count is over by, with what probability)"},
+	{"prob", (PyCFunction)py_prob, METH_VARARGS,
+	 "prob(model, context, byte, max_context=2): see sigprob.contextprob"},
+	{NULL}
+};
+
+void initctxmodelc(void)
+{
+	Py_InitModule3(
+		"ctxmodelc",
+		ctxmodelc_funcs,
+		"byte context statistics of streamfiles"
+	);
+}
@@ -0,0 +1,268 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fpstore.h"
+
+#define MAGIC       "PGFPSTR1"
+#define VERSION     1
+#define BYTE_ORDER_MARK 0x01020304
+#define HEADER_LEN  64
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t nsets;
+	volatile uint32_t clock;
+} header_t;
+
+static size_t
+store_size(uint32_t nsets)
+{
+	return HEADER_LEN + (size_t)nsets * FPSTORE_WAYS * sizeof(fpstore_slot_t);
+}
+
+fpstore_t *
+fpstore_open(const char *store_name, uint32_t entries)
+{
+	fpstore_t *store;
+	header_t h;
+	struct stat st, named;
+	uint32_t nsets;
+	char *tmp_name;
+	int fd, tmp_fd, valid;
+
+	for (;;) {
+		if ((fd = open(store_name, O_RDWR | O_CREAT, 0666)) < 0)
+			return NULL;
+		/* held until close, while the store is checked or made */
+		if (lockf(fd, F_LOCK, 0) < 0 || fstat(fd, &st) < 0) {
+			close(fd);
+			return NULL;
+		}
+		/* the store may have been replaced while we waited */
+		if (stat(store_name, &named) == 0 &&
+		    named.st_dev == st.st_dev && named.st_ino == st.st_ino)
+			break;
+		close(fd);
+	}
+
+	valid = ((size_t)st.st_size >= HEADER_LEN &&
+	         pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+	         memcmp(h.magic, MAGIC, 8) == 0 && h.version == VERSION &&
+	         h.byte_order == BYTE_ORDER_MARK &&
+	         h.nsets > 0 && (h.nsets & (h.nsets - 1)) == 0 &&
+	         (size_t)st.st_size == store_size(h.nsets));
+	if (!valid) {
+		for (nsets = 1; nsets < (1U << 31) &&
+		     (uint64_t)nsets * FPSTORE_WAYS < entries; nsets *= 2)
+			;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, MAGIC, 8);
+		h.version = VERSION;
+		h.byte_order = BYTE_ORDER_MARK;
+		h.nsets = nsets;
+
+		/* the new store is made under another name, all slots
+		 * zero, and renamed over the old one, so that processes
+		 * still mapping the old one keep it whole */
+		if ((tmp_name = malloc(strlen(store_name) + 16)) == NULL) {
+			close(fd);
+			return NULL;
+		}
+		sprintf(tmp_name, "%s.%ld", store_name, (long)getpid());
+		tmp_fd = open(tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (tmp_fd < 0 ||
+		    ftruncate(tmp_fd, store_size(nsets)) < 0 ||
+		    pwrite(tmp_fd, &h, sizeof(h), 0) != sizeof(h) ||
+		    rename(tmp_name, store_name) < 0) {
+			if (tmp_fd >= 0) {
+				close(tmp_fd);
+				unlink(tmp_name);
+			}
+			free(tmp_name);
+			close(fd);
+			return NULL;
+		}
+		free(tmp_name);
+		close(fd);  /* releases the lock on the old store */
+		fd = tmp_fd;
+	}
+
+	if ((store = calloc(1, sizeof(fpstore_t))) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	store->size = store_size(h.nsets);
+	store->map = mmap(NULL, store->size, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED, fd, 0);
+	close(fd);  /* releases the lock */
+	if (store->map == MAP_FAILED) {
+		free(store);
+		return NULL;
+	}
+	store->nsets = h.nsets;
+	store->clock = &((header_t *)store->map)->clock;
+	store->slots = (fpstore_slot_t *)((char *)store->map + HEADER_LEN);
+	return store;
+}
+
+void
+fpstore_close(fpstore_t *store)
+{
+	munmap(store->map, store->size);
+	free(store);
+}
+
+static uint64_t
+mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void
+hash_bytes(fpstore_key_t *key, const char *s, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		key->h1 = (key->h1 ^ p[i]) * 0x100000001b3ULL;
+		key->h2 = ((key->h2 << 5 | key->h2 >> 59) ^ p[i]) *
+		          0x9e3779b97f4a7c15ULL;
+	}
+}
+
+void
+fpstore_key(fpstore_key_t *key, const char *prefix, size_t plen,
+            const char *s, size_t len)
+{
+	key->h1 = 0xcbf29ce484222325ULL;
+	key->h2 = 0x84222325cbf29ce4ULL;
+	hash_bytes(key, prefix, plen);
+	key->h1 ^= plen;
+	key->h2 += plen;
+	hash_bytes(key, s, len);
+	key->h1 = mix(key->h1 ^ len);
+	key->h2 = mix(key->h2 + len + key->h1);
+}
+
+/* a new stamp, never 0 */
+static uint32_t
+tick(fpstore_t *store)
+{
+	uint32_t stamp;
+
+	while ((stamp = __sync_add_and_fetch(store->clock, 1)) == 0)
+		;
+	return stamp;
+}
+
+static fpstore_slot_t *
+find_set(fpstore_t *store, const fpstore_key_t *key)
+{
+	return store->slots + (key->h1 & (store->nsets - 1)) * FPSTORE_WAYS;
+}
+
+int
+fpstore_get(fpstore_t *store, const fpstore_key_t *key, double *value)
+{
+	fpstore_slot_t *set, *slot;
+	uint32_t seq;
+	double v;
+	int i, match;
+
+	set = find_set(store, key);
+	for (i = 0; i < FPSTORE_WAYS; i++) {
+		slot = set + i;
+		seq = slot->seq;
+		if (seq & 1)
+			continue;
+		__sync_synchronize();
+		match = (slot->stamp != 0 && slot->key.h1 == key->h1 &&
+		         slot->key.h2 == key->h2);
+		v = slot->value;
+		__sync_synchronize();
+		if (match && slot->seq == seq) {
+			slot->stamp = tick(store);
+			*value = v;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void
+fpstore_put(fpstore_t *store, const fpstore_key_t *key, double value)
+{
+	fpstore_slot_t *set, *slot, *victim;
+	uint32_t seq, now, age, oldest = 0;
+	int i;
+
+	/* the slot already holding key, else an empty one, else the
+	 * least recently used; ages are taken from the clock so that
+	 * they survive its wrapping around
+	 */
+	set = find_set(store, key);
+	now = *store->clock;
+	victim = set;
+	for (i = 0; i < FPSTORE_WAYS; i++) {
+		slot = set + i;
+		if (slot->stamp != 0 && slot->key.h1 == key->h1 &&
+		    slot->key.h2 == key->h2) {
+			victim = slot;
+			break;
+		}
+		age = slot->stamp == 0 ? UINT32_MAX : now - slot->stamp;
+		if (age > oldest || i == 0) {
+			victim = slot;
+			oldest = age;
+		}
+	}
+
+	/* give up if another process is writing the slot */
+	seq = victim->seq;
+	if ((seq & 1) || !__sync_bool_compare_and_swap(&victim->seq, seq,
+	                                               seq + 1))
+		return;
+	victim->key = *key;
+	victim->value = value;
+	victim->stamp = tick(store);
+	__sync_synchronize();
+	victim->seq = seq + 2;
+}
+
+uint32_t
+fpstore_used(const fpstore_t *store)
+{
+	uint64_t i, n = (uint64_t)store->nsets * FPSTORE_WAYS;
+	uint32_t used = 0;
+
+	for (i = 0; i < n; i++)
+		if (store->slots[i].stamp != 0)
+			used++;
+	return used;
+}
@@ -0,0 +1,80 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+/* A file of estimates shared by every process mapping it, such as the
+ * false positive rates sig_gen.est_fpos_rates works out for tokens.
+ *
+ * An estimate is found by a 128 bit hash of its key, so that keys of
+ * any length take a slot of the same size and distinct keys collide
+ * with negligible probability. As in sary's shared search cache, the
+ * file is a set-associative table of FPSTORE_WAYS slots per set:
+ *   header: "PGFPSTR1", version, byte order mark, sets, clock
+ *   slots:  sequence number, stamp, hash, estimate
+ * A slot's sequence number is odd while it is written, and a reader
+ * that sees it change takes the slot as a miss. The clock stamps every
+ * slot read or written, and a new estimate replaces the least recently
+ * used slot of its set.
+ */
+#ifndef FPSTORE_H
+#define FPSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FPSTORE_WAYS 8
+
+typedef struct {
+	uint64_t h1;
+	uint64_t h2;
+} fpstore_key_t;
+
+typedef struct {
+	volatile uint32_t seq;
+	volatile uint32_t stamp;        /* 0 if empty */
+	fpstore_key_t key;
+	double value;
+} fpstore_slot_t;
+
+typedef struct {
+	void *map;
+	size_t size;
+	uint32_t nsets;                 /* a power of 2 */
+	volatile uint32_t *clock;
+	fpstore_slot_t *slots;
+} fpstore_t;
+
+/* Opens the store store_name, creating it with room for about entries
+ * estimates if it is missing or is not a store. A file that is not a
+ * store is replaced by renaming a new one over it, so that processes
+ * still mapping it are not cut short. The size of an existing store
+ * wins over entries. Returns NULL with errno set.
+ */
+fpstore_t *fpstore_open(const char *store_name, uint32_t entries);
+void fpstore_close(fpstore_t *store);
+
+/* The key of prefix followed by s. */
+void fpstore_key(fpstore_key_t *key, const char *prefix, size_t plen,
+                 const char *s, size_t len);
+
+/* Sets *value and returns 1 if the store has key, returns 0 if not. */
+int fpstore_get(fpstore_t *store, const fpstore_key_t *key, double *value);
+
+/* Stores value under key, unless another process is writing the slot
+ * it would take.
+ */
+void fpstore_put(fpstore_t *store, const fpstore_key_t *key, double value);
+
+/* Number of slots in use. */
+uint32_t fpstore_used(const fpstore_t *store);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <Python.h>
+#include "fpstore.h"
+
+static PyObject*
+py_open(PyObject* self, PyObject* args)
+{
+	fpstore_t *store;
+	const char *store_name;
+	long entries;
+
+	if (!PyArg_ParseTuple(args, "sl:open", &store_name, &entries))
+		return NULL;
+	if (entries < 1 || entries > 0xffffffffL) {
+		PyErr_SetString(PyExc_ValueError, "bad number of entries");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	store = fpstore_open(store_name, (uint32_t)entries);
+	Py_END_ALLOW_THREADS
+	if (store == NULL)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+		                                      (char *)store_name);
+
+	/* return pointer to the handle */
+	return Py_BuildValue("l", (long)store);
+}
+
+static PyObject*
+py_close(PyObject* self, PyObject* args)
+{
+	fpstore_t *store;
+
+	if (!PyArg_ParseTuple(args, "l:close", (long*)&store)) return NULL;
+	fpstore_close(store);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_info(PyObject* self, PyObject* args)
+{
+	fpstore_t *store;
+
+	if (!PyArg_ParseTuple(args, "l:info", (long*)&store)) return NULL;
+	return Py_BuildValue("(kk)",
+	                     (unsigned long)store->nsets * FPSTORE_WAYS,
+	                     (unsigned long)fpstore_used(store));
+}
+
+static PyObject*
+py_get(PyObject* self, PyObject* args)
+{
+	fpstore_t *store;
+	PyObject *keys, *seq, *list, *item;
+	const char *prefix;
+	int plen, i, n;
+	fpstore_key_t key;
+	double value;
+
+	if (!PyArg_ParseTuple(args, "ls#O:get", (long*)&store, &prefix, &plen,
+	                      &keys))
+		return NULL;
+	if ((seq = PySequence_Fast(keys, "keys must be a list")) == NULL)
+		return NULL;
+	n = PySequence_Fast_GET_SIZE(seq);
+	if ((list = PyList_New(n)) == NULL) {
+		Py_DECREF(seq);
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		item = PySequence_Fast_GET_ITEM(seq, i);
+		if (!PyString_Check(item)) {
+			PyErr_SetString(PyExc_TypeError, "keys must be strings");
+			Py_DECREF(list);
+			Py_DECREF(seq);
+			return NULL;
+		}
+		fpstore_key(&key, prefix, plen, PyString_AS_STRING(item),
+		            PyString_GET_SIZE(item));
+		if (fpstore_get(store, &key, &value)) {
+			PyList_SET_ITEM(list, i, PyFloat_FromDouble(value));
+		} else {
+			Py_INCREF(Py_None);
+			PyList_SET_ITEM(list, i, Py_None);
+		}
+	}
+	Py_DECREF(seq);
+	return list;
+}
+
+static PyObject*
+py_put(PyObject* self, PyObject* args)
+{
+	fpstore_t *store;
+	PyObject *keys, *values, *kseq, *vseq = NULL, *item;
+	const char *prefix;
+	int plen, i, n;
+	fpstore_key_t key;
+	double value;
+
+	if (!PyArg_ParseTuple(args, "ls#OO:put", (long*)&store, &prefix, &plen,
+	                      &keys, &values))
+		return NULL;
+	if ((kseq = PySequence_Fast(keys, "keys must be a list")) == NULL ||
+	    (vseq = PySequence_Fast(values, "values must be a list")) == NULL) {
+		Py_XDECREF(kseq);
+		return NULL;
+	}
+	n = PySequence_Fast_GET_SIZE(kseq);
+	if (PySequence_Fast_GET_SIZE(vseq) != n) {
+		PyErr_SetString(PyExc_ValueError, "one value per key");
+		goto fail;
+	}
+	for (i = 0; i < n; i++) {
+		item = PySequence_Fast_GET_ITEM(kseq, i);
+		if (!PyString_Check(item)) {
+			PyErr_SetString(PyExc_TypeError, "keys must be strings");
+			goto fail;
+		}
+		value = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(vseq, i));
+		if (value == -1 && PyErr_Occurred())
+			goto fail;
+		fpstore_key(&key, prefix, plen, PyString_AS_STRING(item),
+		            PyString_GET_SIZE(item));
+		fpstore_put(store, &key, value);
+	}
+	Py_DECREF(kseq);
+	Py_DECREF(vseq);
+	Py_INCREF(Py_None);
+	return Py_None;
+
+fail:
+	Py_DECREF(kseq);
+	Py_DECREF(vseq);
+	return NULL;
+}
+
+static PyMethodDef fpstorec_funcs[] = {
+	{"open", (PyCFunction)py_open, METH_VARARGS,
+	 "open(store_name, entries): handle"},
+	{"close", (PyCFunction)py_close, METH_VARARGS,
+	 "close(store)"},
+	{"info", (PyCFunction)py_info, METH_VARARGS,
+	 "info(store): (slots, slots in use)"},
+	{"get", (PyCFunction)py_get, METH_VARARGS,
+	 "get(store, prefix, keys): the value of prefix + key, or None, "
+	 "for every key"},
+	{"put", (PyCFunction)py_put, METH_VARARGS,
+	 "put(store, prefix, keys, values)"},
+	{NULL}
+};
+
+void initfpstorec(void)
+{
+	Py_InitModule3(
+		"fpstorec",
+		fpstorec_funcs,
+		"estimates shared by processes in a mapped file"
+	);
+}
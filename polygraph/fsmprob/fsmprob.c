@@ -0,0 +1,165 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "fsmprob.h"
+
+fsm_t *
+fsm_new(int nstates, int nedges)
+{
+	fsm_t *fsm;
+
+	if ((fsm = calloc(1, sizeof(fsm_t))) == NULL)
+		return NULL;
+	fsm->nstates = nstates;
+	fsm->nedges = nedges;
+	fsm->start = calloc(nstates + 1, sizeof(int));
+	fsm->from = malloc((nedges + 1) * sizeof(int));
+	fsm->prob = malloc((nedges + 1) * sizeof(double));
+	if (fsm->start == NULL || fsm->from == NULL || fsm->prob == NULL) {
+		fsm_free(fsm);
+		return NULL;
+	}
+	return fsm;
+}
+
+void
+fsm_free(fsm_t *fsm)
+{
+	free(fsm->start);
+	free(fsm->from);
+	free(fsm->prob);
+	free(fsm);
+}
+
+/* new = M old */
+static void
+step(const fsm_t *fsm, const double *old, double *new)
+{
+	int s, e;
+
+	for (s = 0; s < fsm->nstates; s++) {
+		double p = 0;
+
+		for (e = fsm->start[s]; e < fsm->start[s + 1]; e++)
+			p += old[fsm->from[e]] * fsm->prob[e];
+		new[s] = p;
+	}
+}
+
+int
+fsm_dist(const fsm_t *fsm, int n, double *final)
+{
+	double *buf, *old, *new, *tmp;
+	int i, k = fsm->nstates;
+
+	if ((buf = calloc(2 * k, sizeof(double))) == NULL)
+		return -1;
+	old = buf;
+	new = buf + k;
+	old[0] = 1;
+	final[0] = 0;
+	for (i = 1; i <= n; i++) {
+		step(fsm, old, new);
+		final[i] = new[k - 1];
+		tmp = old;
+		old = new;
+		new = tmp;
+	}
+	free(buf);
+	return 0;
+}
+
+/* c = a b, all k x k */
+static void
+matmul(const double *a, const double *b, double *c, int k)
+{
+	int i, j, l;
+
+	memset(c, 0, (size_t)k * k * sizeof(double));
+	for (i = 0; i < k; i++) {
+		for (l = 0; l < k; l++) {
+			double x = a[i * k + l];
+			const double *bl = b + l * k;
+			double *ci = c + i * k;
+
+			if (x == 0)
+				continue;
+			for (j = 0; j < k; j++)
+				ci[j] += x * bl[j];
+		}
+	}
+}
+
+double
+fsm_final(const fsm_t *fsm, int n)
+{
+	int k = fsm->nstates, i, s, e, squarings = 0;
+	double *p, *sq, *v, *w, sparse, dense, rv;
+
+	if (n <= 0)
+		return 0;
+
+	/* n sparse steps, or a squaring per bit of n plus the products
+	 * of the vector with the powers of M
+	 */
+	for (i = n; i > 0; i >>= 1)
+		squarings++;
+	sparse = (double)n * (fsm->nedges + k);
+	dense = (double)squarings * ((double)k * k * k + (double)k * k);
+	if (sparse <= dense) {
+		double *final = malloc((n + 1) * sizeof(double));
+
+		if (final == NULL || fsm_dist(fsm, n, final) < 0) {
+			free(final);
+			return -1;
+		}
+		rv = final[n];
+		free(final);
+		return rv;
+	}
+
+	p = calloc(2 * (size_t)k * k + 2 * k, sizeof(double));
+	if (p == NULL)
+		return -1;
+	sq = p + (size_t)k * k;
+	v = sq + (size_t)k * k;
+	w = v + k;
+	for (s = 0; s < k; s++) {
+		for (e = fsm->start[s]; e < fsm->start[s + 1]; e++)
+			p[s * k + fsm->from[e]] += fsm->prob[e];
+	}
+
+	/* v = M^n e0, with p the powers M^(2^i) */
+	v[0] = 1;
+	for (;;) {
+		if (n & 1) {
+			for (s = 0; s < k; s++) {
+				double x = 0;
+
+				for (i = 0; i < k; i++)
+					x += p[s * k + i] * v[i];
+				w[s] = x;
+			}
+			memcpy(v, w, k * sizeof(double));
+		}
+		if ((n >>= 1) == 0)
+			break;
+		matmul(p, p, sq, k);
+		memcpy(p, sq, (size_t)k * k * sizeof(double));
+	}
+	rv = v[k - 1];
+	free(p);
+	return rv;
+}
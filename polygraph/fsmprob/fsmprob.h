@@ -0,0 +1,49 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+/* Probability of reaching each state of the match automata of sigprob
+ * after every number of steps.
+ *
+ * sigprob gives an automaton as, for every state, the transitions into
+ * it with their probabilities. Compiled, they are the sparse rows of
+ * the matrix M with M[to][from] = p, and the state distribution after
+ * n steps from state 0 is M^n e0: n sparse products, or about log n
+ * dense squarings of M when only the last step is wanted and that is
+ * cheaper.
+ */
+#ifndef FSMPROB_H
+#define FSMPROB_H
+
+typedef struct {
+	int nstates;
+	int nedges;
+	int *start;             /* [nstates + 1], edges into each state */
+	int *from;              /* [nedges] */
+	double *prob;           /* [nedges] */
+} fsm_t;
+
+/* Returns an automaton with room for nedges transitions, or NULL. The
+ * caller fills start, from and prob.
+ */
+fsm_t *fsm_new(int nstates, int nedges);
+void fsm_free(fsm_t *fsm);
+
+/* Sets final[i], for i from 0 to n, to the probability of being in
+ * the last state after i steps. Returns 0, or -1 if out of memory.
+ */
+int fsm_dist(const fsm_t *fsm, int n, double *final);
+
+/* final[n] of fsm_dist. Returns -1 if out of memory. */
+double fsm_final(const fsm_t *fsm, int n);
+
+#endif
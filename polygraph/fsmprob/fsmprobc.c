@@ -0,0 +1,158 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <Python.h>
+#include <stdlib.h>
+#include "fsmprob.h"
+
+/* Compiles sigprob's transitions, a list holding for every state a list
+ * of (from state, probability) pairs into it.
+ */
+static fsm_t *
+compile(PyObject *transitions)
+{
+	PyObject *seq, *in;
+	fsm_t *fsm;
+	int nstates, nedges = 0, s, e;
+
+	if ((seq = PySequence_Fast(transitions, "transitions must be a list"))
+	    == NULL)
+		return NULL;
+	nstates = PySequence_Fast_GET_SIZE(seq);
+	if (nstates == 0) {
+		PyErr_SetString(PyExc_ValueError, "no states");
+		Py_DECREF(seq);
+		return NULL;
+	}
+	for (s = 0; s < nstates; s++) {
+		in = PySequence_Fast_GET_ITEM(seq, s);
+		if (!PyList_Check(in) && !PyTuple_Check(in)) {
+			PyErr_SetString(PyExc_TypeError,
+			                "transitions must be lists of pairs");
+			Py_DECREF(seq);
+			return NULL;
+		}
+		nedges += PySequence_Size(in);
+	}
+	if ((fsm = fsm_new(nstates, nedges)) == NULL) {
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	e = 0;
+	for (s = 0; s < nstates; s++) {
+		PyObject *inseq;
+		int i, n;
+
+		in = PySequence_Fast_GET_ITEM(seq, s);
+		inseq = PySequence_Fast(in, "transitions must be lists of pairs");
+		n = PySequence_Fast_GET_SIZE(inseq);
+		fsm->start[s] = e;
+		for (i = 0; i < n; i++, e++) {
+			PyObject *pair = PySequence_Fast_GET_ITEM(inseq, i);
+
+			if (!PyTuple_Check(pair) ||
+			    !PyArg_ParseTuple(pair, "id", &fsm->from[e],
+			                      &fsm->prob[e]) ||
+			    fsm->from[e] < 0 || fsm->from[e] >= nstates) {
+				if (!PyErr_Occurred())
+					PyErr_SetString(PyExc_ValueError,
+					                "bad transition");
+				Py_DECREF(inseq);
+				Py_DECREF(seq);
+				fsm_free(fsm);
+				return NULL;
+			}
+		}
+		Py_DECREF(inseq);
+	}
+	fsm->start[nstates] = e;
+	Py_DECREF(seq);
+	return fsm;
+}
+
+static PyObject*
+py_dist(PyObject* self, PyObject* args)
+{
+	PyObject *transitions, *list;
+	fsm_t *fsm;
+	double *final;
+	int n, i, rv;
+
+	if (!PyArg_ParseTuple(args, "Oi:dist", &transitions, &n))
+		return NULL;
+	if (n < 0)
+		n = 0;
+	if ((fsm = compile(transitions)) == NULL)
+		return NULL;
+	if ((final = malloc((n + 1) * sizeof(double))) == NULL) {
+		fsm_free(fsm);
+		return PyErr_NoMemory();
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	rv = fsm_dist(fsm, n, final);
+	Py_END_ALLOW_THREADS
+	fsm_free(fsm);
+	if (rv < 0) {
+		free(final);
+		return PyErr_NoMemory();
+	}
+
+	if ((list = PyList_New(n + 1)) != NULL) {
+		for (i = 0; i <= n; i++)
+			PyList_SET_ITEM(list, i, PyFloat_FromDouble(final[i]));
+	}
+	free(final);
+	return list;
+}
+
+static PyObject*
+py_final(PyObject* self, PyObject* args)
+{
+	PyObject *transitions;
+	fsm_t *fsm;
+	double rv;
+	int n;
+
+	if (!PyArg_ParseTuple(args, "Oi:final", &transitions, &n))
+		return NULL;
+	if ((fsm = compile(transitions)) == NULL)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	rv = fsm_final(fsm, n);
+	Py_END_ALLOW_THREADS
+	fsm_free(fsm);
+	if (rv < 0)
+		return PyErr_NoMemory();
+	return PyFloat_FromDouble(rv);
+}
+
+static PyMethodDef fsmprobc_funcs[] = {
+	{"dist", (PyCFunction)py_dist, METH_VARARGS,
+	 "dist(transitions, n): sigprob.fsm_prob"},
+	{"final", (PyCFunction)py_final, METH_VARARGS,
+	 "final(transitions, n): sigprob.fsm_prob(transitions, n)[-1]"},
+	{NULL}
+};
+
+void initfsmprobc(void)
+{
+	Py_InitModule3(
+		"fsmprobc",
+		fsmprobc_funcs,
+		"state probabilities of sigprob automata"
+	);
+}
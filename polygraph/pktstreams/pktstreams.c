@@ -0,0 +1,887 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pktstreams.h"
+
+#define PCAP_MAGIC      0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_HDR_LEN    24
+#define PCAP_REC_LEN    16
+#define DLT_EN10MB      1
+
+#define ETH_HDR_LEN     14
+#define ETHERTYPE_IP    0x0800
+#define PROTO_TCP       6
+#define PROTO_UDP       17
+#define TH_FIN          0x01
+#define TH_RST          0x04
+
+typedef struct {
+	uint32_t src, dst;
+	uint16_t sport, dport;
+	int type;
+	int status;
+	double ts;
+	double now;             /* for a worker, see deal() */
+	const uint8_t *data;
+	size_t len;
+} packet_t;
+
+/* open TCP connections */
+typedef struct {
+	stream_t **buckets;
+	uint32_t nbuckets;      /* a power of 2 */
+	uint32_t count;
+	stream_t *head;         /* most recently active */
+	stream_t *tail;         /* least recently active */
+} table_t;
+
+struct pktstreams {
+	table_t table;
+	double timeout;
+	int save_data;
+	stream_fn fn;
+	void *arg;
+};
+
+/* a mapped trace */
+typedef struct {
+	const uint8_t *map;
+	size_t size;
+	int swap;
+	int nsec;
+} trace_t;
+
+static const char *status_names[] = {
+	"open", "fin", "rst", "udp", "timeout"
+};
+
+const char *
+pktstreams_status_name(int status)
+{
+	return status_names[status];
+}
+
+static uint32_t
+get32(const uint8_t *p, int swap)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	if (swap)
+		v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) |
+		    (v << 24);
+	return v;
+}
+
+static uint16_t
+get16be(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/* Fills in pkt and returns 1 if an Ethernet frame holds a TCP or UDP
+ * packet, or the first fragment of one.
+ */
+static int
+decode(const uint8_t *frame, uint32_t caplen, packet_t *pkt)
+{
+	const uint8_t *ip, *tp;
+	uint32_t iplen, ihl, total, doff;
+
+	if (caplen < ETH_HDR_LEN ||
+	    get16be(frame + 12) != ETHERTYPE_IP)
+		return 0;
+
+	ip = frame + ETH_HDR_LEN;
+	iplen = caplen - ETH_HDR_LEN;
+	if (iplen < 20 || (ip[0] >> 4) != 4)
+		return 0;
+	ihl = (ip[0] & 0x0f) * 4;
+	total = get16be(ip + 2);
+	if (ihl < 20 || total < ihl || iplen < ihl)
+		return 0;
+	if (get16be(ip + 6) & 0x1fff)
+		return 0;	/* no transport header in later fragments */
+	/* drop Ethernet padding, and anything not captured */
+	if (total < iplen)
+		iplen = total;
+
+	memcpy(&pkt->src, ip + 12, 4);
+	memcpy(&pkt->dst, ip + 16, 4);
+	tp = ip + ihl;
+	iplen -= ihl;
+
+	switch (ip[9]) {
+	case PROTO_TCP:
+		if (iplen < 20)
+			return 0;
+		doff = (tp[12] >> 4) * 4;
+		if (doff < 20 || doff > iplen)
+			return 0;
+		pkt->type = STREAM_TCP;
+		if (tp[13] & TH_RST)
+			pkt->status = STREAM_RST;
+		else if (tp[13] & TH_FIN)
+			pkt->status = STREAM_FIN;
+		else
+			pkt->status = STREAM_OPEN;
+		break;
+	case PROTO_UDP:
+		if (iplen < 8)
+			return 0;
+		doff = 8;
+		pkt->type = STREAM_UDP;
+		pkt->status = STREAM_UDP_DONE;
+		break;
+	default:
+		return 0;
+	}
+
+	pkt->sport = get16be(tp);
+	pkt->dport = get16be(tp + 2);
+	pkt->data = tp + doff;
+	pkt->len = iplen - doff;
+	return 1;
+}
+
+static uint32_t
+hash_of(uint32_t src, uint32_t dst, uint16_t sport, uint16_t dport)
+{
+	uint32_t h = src * 0x9e3779b1u;
+
+	h = (h ^ dst) * 0x85ebca6bu;
+	h = (h ^ (((uint32_t)sport << 16) | dport)) * 0xc2b2ae35u;
+	return h ^ (h >> 16);
+}
+
+static int
+add_packet(stream_t *s, const packet_t *pkt, int save_data)
+{
+	if (s->nts == s->ts_alloc) {
+		uint32_t n = s->ts_alloc ? 2 * s->ts_alloc : 4;
+		double *ts = realloc(s->ts, n * sizeof(double));
+		if (ts == NULL)
+			return -1;
+		s->ts = ts;
+		s->ts_alloc = n;
+	}
+	s->ts[s->nts++] = pkt->ts;
+
+	if (save_data && pkt->len > 0) {
+		if (s->len + pkt->len > s->alloc) {
+			size_t n = s->alloc ? 2 * s->alloc : 1024;
+			char *data;
+
+			while (n < s->len + pkt->len)
+				n *= 2;
+			data = realloc(s->data, n);
+			if (data == NULL)
+				return -1;
+			s->data = data;
+			s->alloc = n;
+		}
+		memcpy(s->data + s->len, pkt->data, pkt->len);
+		s->len += pkt->len;
+	}
+	s->status = pkt->status;
+	s->pkts++;
+	return 0;
+}
+
+static stream_t *
+stream_new(const packet_t *pkt, int save_data)
+{
+	stream_t *s = calloc(1, sizeof(stream_t));
+
+	if (s == NULL)
+		return NULL;
+	s->src = pkt->src;
+	s->dst = pkt->dst;
+	s->sport = pkt->sport;
+	s->dport = pkt->dport;
+	s->type = pkt->type;
+	s->hash = hash_of(s->src, s->dst, s->sport, s->dport);
+	if (add_packet(s, pkt, save_data) < 0) {
+		free(s->ts);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+static void
+stream_free(stream_t *s)
+{
+	free(s->ts);
+	free(s->data);
+	free(s);
+}
+
+static int
+table_init(table_t *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->nbuckets = 1024;
+	t->buckets = calloc(t->nbuckets, sizeof(stream_t *));
+	return t->buckets ? 0 : -1;
+}
+
+static stream_t *
+table_find(table_t *t, const packet_t *pkt)
+{
+	uint32_t h = hash_of(pkt->src, pkt->dst, pkt->sport, pkt->dport);
+	stream_t *s;
+
+	for (s = t->buckets[h & (t->nbuckets - 1)]; s; s = s->chain)
+		if (s->hash == h && s->src == pkt->src && s->dst == pkt->dst &&
+		    s->sport == pkt->sport && s->dport == pkt->dport)
+			return s;
+	return NULL;
+}
+
+static void
+push_front(table_t *t, stream_t *s)
+{
+	s->prev = NULL;
+	s->next = t->head;
+	if (t->head)
+		t->head->prev = s;
+	else
+		t->tail = s;
+	t->head = s;
+}
+
+static void
+unlink_list(table_t *t, stream_t *s)
+{
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		t->head = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+	else
+		t->tail = s->prev;
+}
+
+static int
+table_insert(table_t *t, stream_t *s)
+{
+	uint32_t i;
+
+	if (t->count >= t->nbuckets) {
+		uint32_t n = 2 * t->nbuckets;
+		stream_t **buckets = calloc(n, sizeof(stream_t *));
+
+		if (buckets == NULL)
+			return -1;
+		for (i = 0; i < t->nbuckets; i++) {
+			stream_t *c = t->buckets[i], *next;
+			for (; c; c = next) {
+				next = c->chain;
+				c->chain = buckets[c->hash & (n - 1)];
+				buckets[c->hash & (n - 1)] = c;
+			}
+		}
+		free(t->buckets);
+		t->buckets = buckets;
+		t->nbuckets = n;
+	}
+
+	i = s->hash & (t->nbuckets - 1);
+	s->chain = t->buckets[i];
+	t->buckets[i] = s;
+	t->count++;
+	push_front(t, s);
+	return 0;
+}
+
+static void
+table_remove(table_t *t, stream_t *s)
+{
+	stream_t **p = &t->buckets[s->hash & (t->nbuckets - 1)];
+
+	while (*p != s)
+		p = &(*p)->chain;
+	*p = s->chain;
+	t->count--;
+	unlink_list(t, s);
+}
+
+static void
+table_free(table_t *t)
+{
+	stream_t *s, *next;
+
+	for (s = t->head; s; s = next) {
+		next = s->next;
+		stream_free(s);
+	}
+	free(t->buckets);
+}
+
+static int
+finish(pktstreams_t *ps, stream_t *s)
+{
+	int rv = ps->fn(s, ps->arg);
+
+	stream_free(s);
+	return rv;
+}
+
+/* Closes the connections idle for more than the timeout at time now,
+ * from the least recently active one on.
+ */
+static int
+expire(pktstreams_t *ps, double now)
+{
+	table_t *t = &ps->table;
+	stream_t *s;
+	int rv;
+
+	while (t->tail && now - t->tail->ts[t->tail->nts - 1] > ps->timeout) {
+		s = t->tail;
+		table_remove(t, s);
+		s->status = STREAM_TIMEOUT;
+		if ((rv = finish(ps, s)) != 0)
+			return rv;
+	}
+	return 0;
+}
+
+static int
+handle(pktstreams_t *ps, const packet_t *pkt)
+{
+	table_t *t = &ps->table;
+	stream_t *s;
+	int rv;
+
+	/* udp packets are streams of their own */
+	if (pkt->type == STREAM_UDP) {
+		if ((s = stream_new(pkt, ps->save_data)) == NULL)
+			return -1;
+		return finish(ps, s);
+	}
+
+	s = table_find(t, pkt);
+	if (s) {
+		if (add_packet(s, pkt, ps->save_data) < 0)
+			return -1;
+		if (s->status == STREAM_FIN || s->status == STREAM_RST) {
+			table_remove(t, s);
+			if ((rv = finish(ps, s)) != 0)
+				return rv;
+		} else {
+			unlink_list(t, s);
+			push_front(t, s);
+		}
+	} else if (ps->save_data && pkt->len > 0) {
+		if ((s = stream_new(pkt, ps->save_data)) == NULL)
+			return -1;
+		if (table_insert(t, s) < 0) {
+			stream_free(s);
+			return -1;
+		}
+	}
+
+	/* connections idle for too long are done */
+	return expire(ps, pkt->ts);
+}
+
+static int
+trace_open(trace_t *tr, const char *trace_name)
+{
+	int fd;
+	struct stat st;
+	uint32_t magic;
+
+	fd = open(trace_name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < PCAP_HDR_LEN) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	tr->size = st.st_size;
+	tr->map = mmap(NULL, tr->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (tr->map == MAP_FAILED)
+		return -1;
+	madvise((void *)tr->map, tr->size, MADV_SEQUENTIAL);
+
+	memcpy(&magic, tr->map, 4);
+	tr->swap = (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC);
+	magic = get32(tr->map, tr->swap);
+	tr->nsec = (magic == PCAP_MAGIC_NSEC);
+	if ((magic != PCAP_MAGIC && !tr->nsec) ||
+	    get32(tr->map + 20, tr->swap) != DLT_EN10MB) {
+		munmap((void *)tr->map, tr->size);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+trace_close(trace_t *tr)
+{
+	munmap((void *)tr->map, tr->size);
+}
+
+/* Calls each with every TCP or UDP packet of the trace, until it
+ * returns nonzero.
+ */
+static int
+trace_scan(trace_t *tr, int (*each)(void *ctx, const packet_t *pkt),
+           void *ctx)
+{
+	const uint8_t *p = tr->map + PCAP_HDR_LEN, *end = tr->map + tr->size;
+	packet_t pkt;
+	int rv;
+
+	while (end - p >= PCAP_REC_LEN) {
+		uint32_t sec = get32(p, tr->swap), frac = get32(p + 4, tr->swap);
+		uint32_t caplen = get32(p + 8, tr->swap);
+		uint32_t len = get32(p + 12, tr->swap);
+		const uint8_t *frame = p + PCAP_REC_LEN;
+
+		if (caplen > (size_t)(end - frame))
+			break;	/* truncated trace */
+		p = frame + caplen;
+
+		if (len != caplen)
+			fprintf(stderr, "Warning, only captured %u of %u bytes\n",
+			        caplen, len);
+		if (!decode(frame, caplen, &pkt))
+			continue;
+		pkt.ts = sec + frac / (tr->nsec ? 1.0e9 : 1.0e6);
+
+		if ((rv = each(ctx, &pkt)) != 0)
+			return rv;
+	}
+	return 0;
+}
+
+pktstreams_t *
+pktstreams_new(double timeout, int save_data, stream_fn fn, void *arg)
+{
+	pktstreams_t *ps = calloc(1, sizeof(pktstreams_t));
+
+	if (ps == NULL)
+		return NULL;
+	if (table_init(&ps->table) < 0) {
+		free(ps);
+		return NULL;
+	}
+	ps->timeout = timeout;
+	ps->save_data = save_data;
+	ps->fn = fn;
+	ps->arg = arg;
+	return ps;
+}
+
+static int
+handle_any(void *ctx, const packet_t *pkt)
+{
+	return handle((pktstreams_t *)ctx, pkt);
+}
+
+int
+pktstreams_add_trace(pktstreams_t *ps, const char *trace_name)
+{
+	trace_t tr;
+	int rv;
+
+	if (trace_open(&tr, trace_name) < 0)
+		return -1;
+	errno = 0;
+	rv = trace_scan(&tr, handle_any, ps);
+	trace_close(&tr);
+	if (rv < 0 && errno == 0)
+		errno = ENOMEM;
+	return rv;
+}
+
+int
+pktstreams_finish(pktstreams_t *ps)
+{
+	table_t *t = &ps->table;
+	stream_t *s;
+	int rv;
+
+	/* the least recently active ones first */
+	while (t->tail) {
+		s = t->tail;
+		table_remove(t, s);
+		if ((rv = finish(ps, s)) != 0)
+			return rv;
+	}
+	return 0;
+}
+
+void
+pktstreams_free(pktstreams_t *ps)
+{
+	table_free(&ps->table);
+	free(ps);
+}
+
+int
+pktstreams_process(const char *trace_name, double timeout, int save_data,
+                   stream_fn fn, void *arg)
+{
+	pktstreams_t *ps;
+	int rv;
+
+	if ((ps = pktstreams_new(timeout, save_data, fn, arg)) == NULL)
+		return -1;
+	rv = pktstreams_add_trace(ps, trace_name);
+	if (rv == 0)
+		rv = pktstreams_finish(ps);
+	pktstreams_free(ps);
+	return rv;
+}
+
+/*
+ * Parallel reassembly. The packets of all the traces are read in order
+ * by the calling thread and dealt to the workers by connection, so that
+ * each worker sees every packet of its connections in order and keeps
+ * them in a table of its own. Packets are passed in batches that point
+ * into the mapped traces, which stay mapped until the workers are done.
+ */
+
+#define BATCH_SIZE 4096
+#define QUEUE_LEN  8
+
+typedef struct {
+	packet_t pkts[BATCH_SIZE];
+	int n;
+} batch_t;
+
+typedef struct {
+	pthread_t thread;
+	pktstreams_t *ps;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	batch_t *queue[QUEUE_LEN];
+	int head, count;
+	int done;               /* no more batches */
+	double last_now;        /* expiry time after the last batch */
+	int rv;
+	batch_t *filling;       /* batch being filled by the reader */
+	batch_t *free_batch;    /* a spare batch returned by the worker */
+	uint64_t last;          /* TCP packets dealt before its last packet */
+} worker_t;
+
+/* Time stamps of the TCP packets dealt so far that are later than all
+ * those dealt after them, with their sequence numbers: the latest time
+ * stamp since the nth TCP packet is the first one past n.
+ */
+typedef struct {
+	double *ts;
+	uint64_t *seq;
+	uint32_t len, alloc;
+	uint64_t ntcp;          /* TCP packets dealt */
+} maxstack_t;
+
+typedef struct {
+	worker_t *workers;
+	int nworkers;
+	maxstack_t max;
+} dealer_t;
+
+static batch_t *
+batch_get(worker_t *w)
+{
+	batch_t *b;
+
+	pthread_mutex_lock(&w->lock);
+	b = w->free_batch;
+	w->free_batch = NULL;
+	pthread_mutex_unlock(&w->lock);
+	if (b == NULL)
+		b = malloc(sizeof(batch_t));
+	if (b)
+		b->n = 0;
+	return b;
+}
+
+/* Queues a batch for the worker, or returns nonzero if the worker
+ * stopped early.
+ */
+static int
+batch_put(worker_t *w, batch_t *b)
+{
+	int rv = 0;
+
+	pthread_mutex_lock(&w->lock);
+	while (w->count == QUEUE_LEN && !w->done)
+		pthread_cond_wait(&w->cond, &w->lock);
+	if (w->done) {
+		rv = w->rv ? w->rv : -1;
+		free(b);
+	} else {
+		w->queue[(w->head + w->count) % QUEUE_LEN] = b;
+		w->count++;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return rv;
+}
+
+static void *
+worker_main(void *arg)
+{
+	worker_t *w = (worker_t *)arg;
+	batch_t *b;
+	int i, rv = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		while (w->count == 0 && !w->done)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->count == 0) {
+			pthread_mutex_unlock(&w->lock);
+			break;
+		}
+		b = w->queue[w->head];
+		w->head = (w->head + 1) % QUEUE_LEN;
+		w->count--;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+
+		/* the expiry checks done on other workers' packets */
+		for (i = 0; rv == 0 && i < b->n; i++) {
+			rv = expire(w->ps, b->pkts[i].now);
+			if (rv == 0)
+				rv = handle(w->ps, &b->pkts[i]);
+		}
+
+		pthread_mutex_lock(&w->lock);
+		if (w->free_batch == NULL) {
+			w->free_batch = b;
+			b = NULL;
+		}
+		pthread_mutex_unlock(&w->lock);
+		free(b);
+		if (rv != 0)
+			break;
+	}
+
+	/* the packets of other workers after the last one of this worker */
+	if (rv == 0)
+		rv = expire(w->ps, w->last_now);
+	if (rv == 0)
+		rv = pktstreams_finish(w->ps);
+	w->rv = rv;
+
+	/* drain the queue so that the reader is never left waiting */
+	pthread_mutex_lock(&w->lock);
+	w->done = 1;
+	while (w->count > 0) {
+		free(w->queue[w->head]);
+		w->head = (w->head + 1) % QUEUE_LEN;
+		w->count--;
+	}
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/* The latest time stamp of the TCP packets dealt after the first n. */
+static double
+max_since(maxstack_t *m, uint64_t n)
+{
+	uint32_t lo = 0, hi = m->len;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (m->seq[mid] < n)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < m->len ? m->ts[lo] : -HUGE_VAL;
+}
+
+static int
+max_push(maxstack_t *m, double ts, const dealer_t *d)
+{
+	uint64_t oldest;
+	uint32_t i, k;
+
+	while (m->len > 0 && m->ts[m->len - 1] <= ts)
+		m->len--;
+	if (m->len == m->alloc) {
+		/* drop the entries no worker can ask for any more */
+		oldest = m->ntcp;
+		for (i = 0; i < (uint32_t)d->nworkers; i++) {
+			if (d->workers[i].last < oldest)
+				oldest = d->workers[i].last;
+		}
+		for (k = 0; k < m->len && m->seq[k] < oldest; k++)
+			;
+		memmove(m->ts, m->ts + k, (m->len - k) * sizeof(double));
+		memmove(m->seq, m->seq + k, (m->len - k) * sizeof(uint64_t));
+		m->len -= k;
+	}
+	if (m->len == m->alloc) {
+		uint32_t alloc = m->alloc ? 2 * m->alloc : 1024;
+		double *nts = realloc(m->ts, alloc * sizeof(double));
+		uint64_t *nseq;
+
+		if (nts == NULL)
+			return -1;
+		m->ts = nts;
+		if ((nseq = realloc(m->seq, alloc * sizeof(uint64_t))) == NULL)
+			return -1;
+		m->seq = nseq;
+		m->alloc = alloc;
+	}
+	m->ts[m->len] = ts;
+	m->seq[m->len] = m->ntcp++;
+	m->len++;
+	return 0;
+}
+
+/* Hands a packet to the worker of its connection. A serial run closes
+ * idle connections after every TCP packet, at its time stamp; the
+ * worker sees only its own packets, so each one carries the latest
+ * time stamp of the other TCP packets since the worker's previous one,
+ * which closes the same connections as all of them in turn.
+ */
+static int
+deal(void *ctx, const packet_t *pkt)
+{
+	dealer_t *d = (dealer_t *)ctx;
+	uint32_t h = hash_of(pkt->src, pkt->dst, pkt->sport, pkt->dport);
+	worker_t *w = &d->workers[(h >> 8) % d->nworkers];
+	batch_t *b;
+
+	if (w->filling == NULL && (w->filling = batch_get(w)) == NULL)
+		return -1;
+	w->filling->pkts[w->filling->n] = *pkt;
+	w->filling->pkts[w->filling->n].now = max_since(&d->max, w->last);
+	w->filling->n++;
+	if (pkt->type == STREAM_TCP && max_push(&d->max, pkt->ts, d) < 0)
+		return -1;
+	w->last = d->max.ntcp;
+	if (w->filling->n == BATCH_SIZE) {
+		b = w->filling;
+		w->filling = NULL;
+		return batch_put(w, b);
+	}
+	return 0;
+}
+
+int
+pktstreams_process_parallel(const char **trace_names, int ntraces,
+                            double timeout, int save_data, int nworkers,
+                            stream_fn fn, void **args)
+{
+	trace_t *traces;
+	dealer_t d;
+	int i, ntraces_open = 0, nstarted = 0, rv = 0;
+
+	traces = calloc(ntraces, sizeof(trace_t));
+	d.workers = calloc(nworkers, sizeof(worker_t));
+	d.nworkers = nworkers;
+	memset(&d.max, 0, sizeof(d.max));
+	if (traces == NULL || d.workers == NULL) {
+		free(traces);
+		free(d.workers);
+		return -1;
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		worker_t *w = &d.workers[i];
+
+		if ((w->ps = pktstreams_new(timeout, save_data, fn,
+		                            args[i])) == NULL) {
+			rv = -1;
+			break;
+		}
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+			pktstreams_free(w->ps);
+			rv = -1;
+			break;
+		}
+		nstarted++;
+	}
+
+	errno = 0;
+	for (i = 0; rv == 0 && i < ntraces; i++) {
+		if (trace_open(&traces[i], trace_names[i]) < 0) {
+			rv = -1;
+			break;
+		}
+		ntraces_open++;
+		rv = trace_scan(&traces[i], deal, &d);
+	}
+	if (rv < 0 && errno == 0)
+		errno = ENOMEM;
+
+	for (i = 0; i < nstarted; i++) {
+		worker_t *w = &d.workers[i];
+
+		if (w->filling) {
+			if (rv == 0 && w->filling->n > 0)
+				rv = batch_put(w, w->filling);
+			else
+				free(w->filling);
+		}
+		pthread_mutex_lock(&w->lock);
+		w->last_now = max_since(&d.max, w->last);
+		w->done = 1;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+	}
+	for (i = 0; i < nstarted; i++) {
+		worker_t *w = &d.workers[i];
+
+		pthread_join(w->thread, NULL);
+		if (rv == 0)
+			rv = w->rv;
+		free(w->free_batch);
+		pktstreams_free(w->ps);
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->cond);
+	}
+
+	for (i = 0; i < ntraces_open; i++)
+		trace_close(&traces[i]);
+	free(traces);
+	free(d.workers);
+	free(d.max.ts);
+	free(d.max.seq);
+	return rv;
+}
@@ -0,0 +1,102 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+/* Reassembles the TCP and UDP streams of a libpcap file, as
+ * pkts_to_streams.process_trace does.
+ *
+ * The trace is mapped rather than read, open TCP connections are kept
+ * in a hash table threaded on a list from the most to the least
+ * recently active one, and payloads are gathered in growable buffers.
+ * Streams are handed to the caller in the same order, with the same
+ * contents, as the Python version.
+ *
+ * Several traces taken one after the other can be read as one, so that
+ * connections open at the end of a file go on in the next, and their
+ * packets can be spread over worker threads by connection.
+ */
+#ifndef PKTSTREAMS_H
+#define PKTSTREAMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum { STREAM_TCP, STREAM_UDP };
+enum { STREAM_OPEN, STREAM_FIN, STREAM_RST, STREAM_UDP_DONE,
+       STREAM_TIMEOUT };
+
+typedef struct stream {
+	uint32_t src, dst;      /* addresses, in network byte order */
+	uint16_t sport, dport;
+	int type;
+	int status;
+	uint32_t pkts;
+
+	double *ts;             /* time stamp of each packet */
+	uint32_t nts, ts_alloc;
+	char *data;             /* payload */
+	size_t len, alloc;
+
+	/* connection table */
+	uint32_t hash;
+	struct stream *chain;   /* next in the same bucket */
+	struct stream *prev;    /* more recently active */
+	struct stream *next;    /* less recently active */
+} stream_t;
+
+/* Called with each finished stream, which is freed when it returns.
+ * Return 0 to go on, 1 to stop quietly, -1 to stop with an error.
+ */
+typedef int (*stream_fn)(stream_t *stream, void *arg);
+
+/* Reassembles the streams of trace_name. A TCP connection is finished
+ * by a FIN or RST, by timeout seconds without a packet while other
+ * connections are active, or by the end of the trace. UDP packets are
+ * streams of their own. Without save_data, payloads are dropped, and
+ * so are TCP connections, which only start with a payload.
+ *
+ * Returns 0, what fn returned if it stopped early, or -1 with errno set
+ * (EINVAL if the file is not an Ethernet libpcap trace).
+ */
+int pktstreams_process(const char *trace_name, double timeout, int save_data,
+                       stream_fn fn, void *arg);
+
+/* The same, over several traces read in turn: connections still open
+ * at the end of a trace are carried over to the next one, and only
+ * pktstreams_finish closes them.
+ */
+typedef struct pktstreams pktstreams_t;
+
+pktstreams_t *pktstreams_new(double timeout, int save_data, stream_fn fn,
+                             void *arg);
+int pktstreams_add_trace(pktstreams_t *ps, const char *trace_name);
+int pktstreams_finish(pktstreams_t *ps);
+void pktstreams_free(pktstreams_t *ps);
+
+/* Reassembles the streams of the traces, in order, with nworkers
+ * threads. Each connection is given to one worker, by its hash, and
+ * the streams of worker i are passed to fn with args[i] from that
+ * worker's thread. The traces are read and decoded by the calling
+ * thread. The streams are those of a serial run, but the streams of
+ * different workers are not ordered with respect to each other. When
+ * time stamps go backwards, a serial run may keep an idle connection
+ * open behind a more recently active one that has not yet timed out,
+ * so a few connections can time out differently.
+ */
+int pktstreams_process_parallel(const char **trace_names, int ntraces,
+                                double timeout, int save_data, int nworkers,
+                                stream_fn fn, void **args);
+
+/* Name of a stream status, as in pkts_to_streams: "open", "fin"... */
+const char *pktstreams_status_name(int status);
+
+#endif
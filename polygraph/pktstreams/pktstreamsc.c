@@ -0,0 +1,478 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <Python.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pktstreams.h"
+
+/* A trace name or a sequence of them, as a new array of n names. The
+ * names are copied into the same block, as the callbacks may run code
+ * that drops the Python strings, so a single free() releases them.
+ */
+static const char **
+trace_names(PyObject *traces, int *n)
+{
+	const char **names;
+	PyObject *seq;
+	size_t size;
+	char *p;
+	int i;
+
+	if (PyString_Check(traces))
+		seq = Py_BuildValue("(O)", traces);
+	else
+		seq = PySequence_Fast(traces,
+		                      "traces must be a name or a list");
+	if (seq == NULL)
+		return NULL;
+	*n = PySequence_Fast_GET_SIZE(seq);
+	size = (*n + 1) * sizeof(char *);
+	for (i = 0; i < *n; i++) {
+		PyObject *name = PySequence_Fast_GET_ITEM(seq, i);
+
+		if (!PyString_Check(name)) {
+			PyErr_SetString(PyExc_TypeError,
+			                "trace names must be strings");
+			Py_DECREF(seq);
+			return NULL;
+		}
+		size += PyString_GET_SIZE(name) + 1;
+	}
+	if ((names = malloc(size)) == NULL) {
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	p = (char *)(names + *n + 1);
+	for (i = 0; i < *n; i++) {
+		PyObject *name = PySequence_Fast_GET_ITEM(seq, i);
+
+		memcpy(p, PyString_AS_STRING(name),
+		       PyString_GET_SIZE(name) + 1);
+		names[i] = p;
+		p += PyString_GET_SIZE(name) + 1;
+	}
+	names[*n] = NULL;
+	Py_DECREF(seq);
+	return names;
+}
+
+static PyObject*
+address(uint32_t addr)
+{
+	const unsigned char *b = (const unsigned char *)&addr;
+
+	return PyString_FromFormat("%d.%d.%d.%d", b[0], b[1], b[2], b[3]);
+}
+
+/* the stream dictionary of pkts_to_streams.process_trace */
+static PyObject*
+stream_dict(stream_t *s)
+{
+	PyObject *dict, *ts, *v;
+	uint32_t i;
+
+	if ((dict = PyDict_New()) == NULL)
+		return NULL;
+
+	v = Py_BuildValue("(NNii)", address(s->src), address(s->dst),
+	                  s->sport, s->dport);
+	if (v == NULL || PyDict_SetItemString(dict, "connection", v) < 0)
+		goto fail;
+	Py_DECREF(v);
+
+	if ((ts = PyList_New(s->nts)) == NULL)
+		goto fail_dict;
+	for (i = 0; i < s->nts; i++) {
+		if ((v = PyFloat_FromDouble(s->ts[i])) == NULL) {
+			Py_DECREF(ts);
+			goto fail_dict;
+		}
+		PyList_SET_ITEM(ts, i, v);
+	}
+	v = ts;
+	if (PyDict_SetItemString(dict, "ts", v) < 0)
+		goto fail;
+	Py_DECREF(v);
+
+	v = PyString_FromString(s->type == STREAM_TCP ? "tcp" : "udp");
+	if (v == NULL || PyDict_SetItemString(dict, "type", v) < 0)
+		goto fail;
+	Py_DECREF(v);
+
+	v = PyString_FromString(pktstreams_status_name(s->status));
+	if (v == NULL || PyDict_SetItemString(dict, "status", v) < 0)
+		goto fail;
+	Py_DECREF(v);
+
+	v = PyInt_FromLong(s->pkts);
+	if (v == NULL || PyDict_SetItemString(dict, "pkts", v) < 0)
+		goto fail;
+	Py_DECREF(v);
+
+	v = PyString_FromStringAndSize(s->data ? s->data : "", s->len);
+	if (v == NULL || PyDict_SetItemString(dict, "data", v) < 0)
+		goto fail;
+	Py_DECREF(v);
+
+	return dict;
+
+fail:
+	Py_XDECREF(v);
+fail_dict:
+	Py_DECREF(dict);
+	return NULL;
+}
+
+static int
+call_back(stream_t *s, void *arg)
+{
+	PyObject *dict, *rv;
+
+	if ((dict = stream_dict(s)) == NULL)
+		return -1;
+	rv = PyObject_CallFunctionObjArgs((PyObject *)arg, dict, NULL);
+	Py_DECREF(dict);
+	if (rv == NULL) {
+		/* callback may raise IndexError to halt processing */
+		if (PyErr_ExceptionMatches(PyExc_IndexError)) {
+			PyErr_Clear();
+			return 1;
+		}
+		return -1;
+	}
+	Py_DECREF(rv);
+	return 0;
+}
+
+static PyObject*
+py_process_trace(PyObject* self, PyObject* args)
+{
+	PyObject *traces, *callback;
+	const char **names;
+	double timeout = 2000;
+	int save_data = 1;
+	int i, n, rv = 0;
+	pktstreams_t *ps;
+
+	if (!PyArg_ParseTuple(args, "OO|di:process_trace", &traces,
+	                      &callback, &timeout, &save_data))
+		return NULL;
+	if ((names = trace_names(traces, &n)) == NULL)
+		return NULL;
+	if ((ps = pktstreams_new(timeout, save_data, call_back,
+	                         callback)) == NULL) {
+		free(names);
+		return PyErr_NoMemory();
+	}
+
+	/* connections go on from one trace to the next */
+	errno = 0;
+	for (i = 0; rv == 0 && i < n; i++)
+		rv = pktstreams_add_trace(ps, names[i]);
+	if (rv == 0)
+		rv = pktstreams_finish(ps);
+	pktstreams_free(ps);
+
+	if (rv < 0) {
+		if (!PyErr_Occurred())
+			PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+			                               (char *)names[i - 1]);
+		free(names);
+		return NULL;
+	}
+	free(names);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/* Streamfile writer. Offsets are little endian 64 bit integers, and
+ * the metadata records are laid out as in stream_trace.py.
+ */
+#define META_LEN 40
+
+typedef struct {
+	FILE *data;
+	FILE *offsets;
+	FILE *meta;             /* NULL for no metadata */
+	uint64_t offset;
+	const char *name;       /* of the data file */
+} writer_t;
+
+static void
+put_le(unsigned char *p, uint64_t v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++, v >>= 8)
+		p[i] = (unsigned char)v;
+}
+
+static uint64_t
+get_le(const unsigned char *p, int n)
+{
+	uint64_t v = 0;
+
+	while (n-- > 0)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+static void
+put_double(unsigned char *p, double d)
+{
+	uint64_t v;
+
+	memcpy(&v, &d, 8);
+	put_le(p, v, 8);
+}
+
+static int
+write_stream(stream_t *s, void *arg)
+{
+	writer_t *w = (writer_t *)arg;
+	unsigned char off[8], meta[META_LEN];
+
+	if (s->len == 0)
+		return 0;
+	put_le(off, w->offset, 8);
+	if (fwrite(off, 8, 1, w->offsets) != 1 ||
+	    fwrite(s->data, 1, s->len, w->data) != s->len)
+		return -1;
+	if (w->meta) {
+		memset(meta, 0, sizeof(meta));
+		memcpy(meta, &s->src, 4);
+		memcpy(meta + 4, &s->dst, 4);
+		put_le(meta + 8, s->sport, 2);
+		put_le(meta + 10, s->dport, 2);
+		meta[12] = s->type;
+		meta[13] = s->status;
+		put_le(meta + 16, s->pkts, 4);
+		put_double(meta + 24, s->ts[0]);
+		put_double(meta + 32, s->ts[s->nts - 1]);
+		if (fwrite(meta, META_LEN, 1, w->meta) != 1)
+			return -1;
+	}
+	w->offset += s->len;
+	return 0;
+}
+
+static int
+copy_file(FILE *from, FILE *to)
+{
+	char buf[65536];
+	size_t n;
+
+	rewind(from);
+	while ((n = fread(buf, 1, sizeof(buf), from)) > 0) {
+		if (fwrite(buf, 1, n, to) != n)
+			return -1;
+	}
+	return ferror(from) ? -1 : 0;
+}
+
+/* Appends the temporary files of the workers to the streamfile, the
+ * offsets of each moved up past the data of the ones before it.
+ */
+static int
+merge_parts(writer_t *out, writer_t *parts, int nparts)
+{
+	unsigned char off[8];
+	int i;
+
+	for (i = 0; i < nparts; i++) {
+		if (copy_file(parts[i].data, out->data) < 0)
+			return -1;
+		if (out->meta && copy_file(parts[i].meta, out->meta) < 0)
+			return -1;
+
+		rewind(parts[i].offsets);
+		while (fread(off, 8, 1, parts[i].offsets) == 1) {
+			put_le(off, get_le(off, 8) + out->offset, 8);
+			if (fwrite(off, 8, 1, out->offsets) != 1)
+				return -1;
+		}
+		if (ferror(parts[i].offsets))
+			return -1;
+		out->offset += parts[i].offset;
+	}
+	return 0;
+}
+
+/* An anonymous temporary file next to name, so that it is on the same
+ * file system as the streamfile rather than in /tmp.
+ */
+static FILE *
+part_file(const char *name, int i)
+{
+	char *path = malloc(strlen(name) + 32);
+	FILE *f;
+
+	if (path == NULL)
+		return NULL;
+	sprintf(path, "%s.part%d.%d", name, i, (int)getpid());
+	if ((f = fopen(path, "w+b")) != NULL)
+		unlink(path);
+	free(path);
+	return f;
+}
+
+static int
+write_parallel(const char **names, int n, double timeout, writer_t *out,
+               int jobs)
+{
+	writer_t *parts;
+	void **args;
+	int i, rv = 0;
+
+	parts = calloc(jobs, sizeof(writer_t));
+	args = calloc(jobs, sizeof(void *));
+	if (parts == NULL || args == NULL) {
+		free(parts);
+		free(args);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; rv == 0 && i < jobs; i++) {
+		parts[i].data = part_file(out->name, 3 * i);
+		parts[i].offsets = part_file(out->name, 3 * i + 1);
+		if (parts[i].data == NULL || parts[i].offsets == NULL)
+			rv = -1;
+		if (out->meta &&
+		    (parts[i].meta = part_file(out->name, 3 * i + 2)) == NULL)
+			rv = -1;
+		args[i] = &parts[i];
+	}
+
+	if (rv == 0)
+		rv = pktstreams_process_parallel(names, n, timeout, 1, jobs,
+		                                 write_stream, args);
+	if (rv == 0)
+		rv = merge_parts(out, parts, jobs);
+
+	for (i = 0; i < jobs; i++) {
+		if (parts[i].data)
+			fclose(parts[i].data);
+		if (parts[i].offsets)
+			fclose(parts[i].offsets);
+		if (parts[i].meta)
+			fclose(parts[i].meta);
+	}
+	free(parts);
+	free(args);
+	return rv;
+}
+
+static PyObject*
+py_write_streams(PyObject* self, PyObject* args)
+{
+	PyObject *traces;
+	const char **names;
+	char *data_name, *offsets_name, *meta_name = NULL;
+	unsigned long long offset;
+	double timeout = 60;
+	writer_t w;
+	pktstreams_t *ps;
+	int i, n, rv = 0, jobs = 1;
+
+	if (!PyArg_ParseTuple(args, "OssK|diz:write_streams", &traces,
+	                      &data_name, &offsets_name, &offset, &timeout,
+	                      &jobs, &meta_name))
+		return NULL;
+	if (jobs < 1) {
+		PyErr_SetString(PyExc_ValueError, "jobs must be at least 1");
+		return NULL;
+	}
+	if ((names = trace_names(traces, &n)) == NULL)
+		return NULL;
+	w.offset = offset;
+	w.name = data_name;
+	w.meta = NULL;
+
+	if ((w.data = fopen(data_name, "ab")) == NULL) {
+		free(names);
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, data_name);
+	}
+	if ((w.offsets = fopen(offsets_name, "ab")) == NULL) {
+		free(names);
+		fclose(w.data);
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+		                                      offsets_name);
+	}
+	if (meta_name && (w.meta = fopen(meta_name, "ab")) == NULL) {
+		free(names);
+		fclose(w.data);
+		fclose(w.offsets);
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, meta_name);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	errno = 0;
+	if (jobs > 1) {
+		rv = write_parallel(names, n, timeout, &w, jobs);
+		i = n;
+	} else if ((ps = pktstreams_new(timeout, 1, write_stream,
+	                                &w)) == NULL) {
+		rv = -1;
+		i = 0;
+	} else {
+		/* connections go on from one trace to the next */
+		for (i = 0; rv == 0 && i < n; i++)
+			rv = pktstreams_add_trace(ps, names[i]);
+		if (rv == 0)
+			rv = pktstreams_finish(ps);
+		pktstreams_free(ps);
+	}
+	if (fclose(w.data) != 0)
+		rv = -1;
+	if (fclose(w.offsets) != 0)
+		rv = -1;
+	if (w.meta && fclose(w.meta) != 0)
+		rv = -1;
+	Py_END_ALLOW_THREADS
+
+	if (rv < 0) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+		                               (char *)names[i > 0 ? i - 1 : 0]);
+		free(names);
+		return NULL;
+	}
+	free(names);
+
+	return PyLong_FromUnsignedLongLong(w.offset);
+}
+
+static PyMethodDef pktstreamsc_funcs[] = {
+	{"process_trace", (PyCFunction)py_process_trace, METH_VARARGS,
+	 "process_trace(traces, callback, timeout=2000, save_data=1): "
+	 "see pkts_to_streams.process_traces"},
+	{"write_streams", (PyCFunction)py_write_streams, METH_VARARGS,
+	 "write_streams(traces, data, offsets, offset, timeout=60, jobs=1, "
+	 "meta=None): append the streams of traces to a streamfile, with jobs "
+	 "threads, returns the new offset"},
+	{NULL}
+};
+
+void initpktstreamsc(void)
+{
+	Py_InitModule3(
+		"pktstreamsc",
+		pktstreamsc_funcs,
+		"native stream reassembly of libpcap traces"
+	);
+}
@@ -70,3 +70,12 @@ extern gchar*          saryer_peek_next_position       (Saryer *saryer);
 extern SaryInt         saryer_count_occurrences        (Saryer *saryer);
 extern void            saryer_sort_occurrences         (Saryer *saryer);
 extern void            saryer_enable_cache             (Saryer *saryer);
+extern gboolean        saryer_enable_lcp               (Saryer *saryer,
+                                                 const gchar *lcp_name);
+extern void            saryer_enable_cache2            (Saryer *saryer,
+                                                 SaryInt max_entries);
+extern gboolean        saryer_enable_shared_cache      (Saryer *saryer,
+                                                 const gchar *cache_name,
+                                                 SaryInt max_entries);
+extern gboolean        saryer_enable_bucket            (Saryer *saryer,
+                                                 const gchar *bucket_name);
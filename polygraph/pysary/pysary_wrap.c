@@ -586,6 +586,10 @@ extern gchar *saryer_peek_next_position(Saryer *);
 extern SaryInt saryer_count_occurrences(Saryer *);
 extern void saryer_sort_occurrences(Saryer *);
 extern void saryer_enable_cache(Saryer *);
+extern gboolean saryer_enable_lcp(Saryer *,const gchar *);
+extern void saryer_enable_cache2(Saryer *,SaryInt );
+extern gboolean saryer_enable_shared_cache(Saryer *,const gchar *,SaryInt );
+extern gboolean saryer_enable_bucket(Saryer *,const gchar *);
 static PyObject *_wrap_saryer_new(PyObject *self, PyObject *args) {
     PyObject * _resultobj;
     Saryer * _result;
@@ -1085,7 +1089,96 @@ static PyObject *_wrap_saryer_enable_cache(PyObject *self, PyObject *args) {
     return _resultobj;
 }
 
+static PyObject *_wrap_saryer_enable_lcp(PyObject *self, PyObject *args) {
+    PyObject * _resultobj;
+    gboolean  _result;
+    Saryer * _arg0;
+    gchar * _arg1;
+    char * _argc0 = 0;
+
+    self = self;
+    if(!PyArg_ParseTuple(args,"ss:saryer_enable_lcp",&_argc0,&_arg1)) 
+        return NULL;
+    if (_argc0) {
+        if (SWIG_GetPtr(_argc0,(void **) &_arg0,"_Saryer_p")) {
+            PyErr_SetString(PyExc_TypeError,"Type error in argument 1 of saryer_enable_lcp. Expected _Saryer_p.");
+        return NULL;
+        }
+    }
+    _result = (gboolean )saryer_enable_lcp(_arg0,_arg1);
+    _resultobj = Py_BuildValue("i",_result);
+    return _resultobj;
+}
+
+static PyObject *_wrap_saryer_enable_cache2(PyObject *self, PyObject *args) {
+    PyObject * _resultobj;
+    Saryer * _arg0;
+    SaryInt  _arg1;
+    char * _argc0 = 0;
+
+    self = self;
+    if(!PyArg_ParseTuple(args,"si:saryer_enable_cache2",&_argc0,&_arg1)) 
+        return NULL;
+    if (_argc0) {
+        if (SWIG_GetPtr(_argc0,(void **) &_arg0,"_Saryer_p")) {
+            PyErr_SetString(PyExc_TypeError,"Type error in argument 1 of saryer_enable_cache2. Expected _Saryer_p.");
+        return NULL;
+        }
+    }
+    saryer_enable_cache2(_arg0,_arg1);
+    Py_INCREF(Py_None);
+    _resultobj = Py_None;
+    return _resultobj;
+}
+
+static PyObject *_wrap_saryer_enable_shared_cache(PyObject *self, PyObject *args) {
+    PyObject * _resultobj;
+    gboolean  _result;
+    Saryer * _arg0;
+    gchar * _arg1;
+    SaryInt  _arg2;
+    char * _argc0 = 0;
+
+    self = self;
+    if(!PyArg_ParseTuple(args,"ssi:saryer_enable_shared_cache",&_argc0,&_arg1,&_arg2)) 
+        return NULL;
+    if (_argc0) {
+        if (SWIG_GetPtr(_argc0,(void **) &_arg0,"_Saryer_p")) {
+            PyErr_SetString(PyExc_TypeError,"Type error in argument 1 of saryer_enable_shared_cache. Expected _Saryer_p.");
+        return NULL;
+        }
+    }
+    _result = (gboolean )saryer_enable_shared_cache(_arg0,_arg1,_arg2);
+    _resultobj = Py_BuildValue("i",_result);
+    return _resultobj;
+}
+
+static PyObject *_wrap_saryer_enable_bucket(PyObject *self, PyObject *args) {
+    PyObject * _resultobj;
+    gboolean  _result;
+    Saryer * _arg0;
+    gchar * _arg1;
+    char * _argc0 = 0;
+
+    self = self;
+    if(!PyArg_ParseTuple(args,"ss:saryer_enable_bucket",&_argc0,&_arg1)) 
+        return NULL;
+    if (_argc0) {
+        if (SWIG_GetPtr(_argc0,(void **) &_arg0,"_Saryer_p")) {
+            PyErr_SetString(PyExc_TypeError,"Type error in argument 1 of saryer_enable_bucket. Expected _Saryer_p.");
+        return NULL;
+        }
+    }
+    _result = (gboolean )saryer_enable_bucket(_arg0,_arg1);
+    _resultobj = Py_BuildValue("i",_result);
+    return _resultobj;
+}
+
 static PyMethodDef pysaryMethods[] = {
+	 { "saryer_enable_bucket", _wrap_saryer_enable_bucket, 1 },
+	 { "saryer_enable_shared_cache", _wrap_saryer_enable_shared_cache, 1 },
+	 { "saryer_enable_cache2", _wrap_saryer_enable_cache2, 1 },
+	 { "saryer_enable_lcp", _wrap_saryer_enable_lcp, 1 },
 	 { "saryer_enable_cache", _wrap_saryer_enable_cache, 1 },
 	 { "saryer_sort_occurrences", _wrap_saryer_sort_occurrences, 1 },
 	 { "saryer_count_occurrences", _wrap_saryer_count_occurrences, 1 },
@@ -0,0 +1,651 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "sarytrace.h"
+#include "fmindex.h"
+
+/* Layout of data.fmi (native byte order):
+ *   header        fm_header_t
+ *   bwt           uint8_t[len], padded to 8
+ *   super         uint32_t[nsuper][256], counts before each superblock
+ *   blocks        uint16_t[nblocks][256], counts before each block,
+ *                 relative to its superblock
+ *   dup           uint64_t[dwords]
+ *   select        uint32_t[nselect], position of every SELECT'th 0 in dup
+ * Row 0 is the empty suffix; row r > 0 is rank r-1 of the sary array.
+ * The sentinel is stored as a 0 byte at row dollar and left out of
+ * the counts by rank().
+ *
+ * dup holds, for each boundary k between rows k and k+1, H[k] 1 bits
+ * followed by a 0. For every pair of rows i < j from the same stream
+ * with no row of that stream in between, H is incremented at the
+ * boundary where their longest common prefix is first reached, i.e.
+ * at the suffix tree node where the pair joins. The rows of a pattern
+ * are the leaves below one node, so the pairs counted strictly inside
+ * them are the ones joining below that node, and each stream adds one
+ * such pair per occurrence after its first (Sadakane's document
+ * frequency structure).
+ */
+#define FM_MAGIC "PGFMI1"
+#define FM_BYTEORDER 0x01020304
+#define BLOCK 1024
+#define SUPER 65536
+#define SELECT 256
+
+typedef struct {
+	char magic[8];
+	uint32_t byteorder;
+	uint32_t len;
+	uint32_t dollar;
+	uint32_t numstreams;
+	uint32_t text_size;
+	uint32_t dup_bits;
+	uint32_t C[257];
+} fm_header_t;
+
+typedef struct {
+	size_t bwt;
+	size_t super;
+	size_t blocks;
+	size_t dup;
+	size_t select;
+	size_t size;
+	uint32_t nsuper;
+	uint32_t nblocks;
+	uint32_t dwords;
+	uint32_t nselect;
+} fm_layout_t;
+
+static void
+layout(uint32_t len, uint32_t dup_bits, fm_layout_t *l)
+{
+	uint32_t zeros = len > 0 ? len - 1 : 0;
+
+	l->nblocks = len / BLOCK + 1;
+	l->nsuper = len / SUPER + 1;
+	l->dwords = (dup_bits + 63) / 64 + 1;
+	l->nselect = zeros / SELECT + 1;
+
+	l->bwt = (sizeof(fm_header_t) + 7) & ~(size_t)7;
+	l->super = (l->bwt + len + 7) & ~(size_t)7;
+	l->blocks = l->super + (size_t)l->nsuper * 256 * sizeof(uint32_t);
+	l->dup = l->blocks + (size_t)l->nblocks * 256 * sizeof(uint16_t);
+	l->dup = (l->dup + 7) & ~(size_t)7;
+	l->select = l->dup + (size_t)l->dwords * sizeof(uint64_t);
+	l->size = l->select + (size_t)l->nselect * sizeof(uint32_t);
+}
+
+static inline uint32_t
+block_count(const fmindex_t *fm, uint32_t block, int c)
+{
+	return fm->super[(size_t)(block / (SUPER / BLOCK)) * 256 + c] +
+		fm->blocks[(size_t)block * 256 + c];
+}
+
+/* occurrences of byte c in [p, end), eight bytes at a time */
+static inline uint32_t
+count_byte(const uint8_t *p, const uint8_t *end, int c)
+{
+	const uint64_t lo7 = 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t pattern = 0x0101010101010101ULL * (uint8_t)c, x;
+	uint32_t count = 0;
+
+	for (; p + 8 <= end; p += 8) {
+		memcpy(&x, p, 8);
+		x ^= pattern;
+		/* high bit set in each byte of x that is zero */
+		x = ~(((x & lo7) + lo7) | x | lo7);
+		count += __builtin_popcountll(x);
+	}
+	for (; p < end; p++)
+		count += (*p == c);
+	return count;
+}
+
+/* occurrences of byte c in bwt[0, i) */
+static inline uint32_t
+rank(const fmindex_t *fm, int c, uint32_t i)
+{
+	uint32_t block = i / BLOCK, start = block * BLOCK, r;
+
+	/* count from whichever block boundary is nearer */
+	if (i - start > BLOCK / 2 && start + BLOCK <= fm->len) {
+		r = block_count(fm, block + 1, c) -
+			count_byte(fm->bwt + i, fm->bwt + start + BLOCK, c);
+	} else {
+		r = block_count(fm, block, c) +
+			count_byte(fm->bwt + start, fm->bwt + i, c);
+	}
+	if (c == 0 && fm->dollar < i)
+		r--;
+	return r;
+}
+
+/* position in dup of the k'th 0 bit, counting from 0 */
+static uint32_t
+select0(const fmindex_t *fm, uint32_t k)
+{
+	uint32_t pos = fm->select[k / SELECT], rest = k % SELECT, word, n;
+	uint64_t zeros;
+
+	word = pos / 64;
+	zeros = ~fm->dup[word] & (~0ULL << (pos % 64));
+	while ((n = __builtin_popcountll(zeros)) <= rest) {
+		rest -= n;
+		zeros = ~fm->dup[++word];
+	}
+	while (rest-- > 0)
+		zeros &= zeros - 1;
+	return word * 64 + __builtin_ctzll(zeros);
+}
+
+/* 1 bits in dup for the boundaries up to and including k */
+static inline uint32_t
+dup_through(const fmindex_t *fm, uint32_t k)
+{
+	return select0(fm, k) - k;
+}
+
+/* distinct streams among the rows [first, first+count) of a pattern */
+static int32_t
+distinct(const fmindex_t *fm, uint32_t first, int32_t count)
+{
+	uint32_t dups;
+
+	if (count <= 1)
+		return count;
+	/* boundaries first .. first+count-2 lie inside the rows; row 0
+	 * never matches a pattern, so first > 0
+	 */
+	dups = dup_through(fm, first + count - 2) - dup_through(fm, first - 1);
+	return count - dups;
+}
+
+fmindex_t *
+fmindex_open(const char *data_name, const char *fm_name)
+{
+	fmindex_t *fm;
+	const fm_header_t *header;
+	fm_layout_t l;
+	struct stat st;
+	const char *base;
+
+	if (stat(data_name, &st) < 0)
+		return NULL;
+
+	fm = calloc(1, sizeof(fmindex_t));
+	if (fm == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	fm->map = sary_mmap(fm_name, "r");
+	if (fm->map == NULL) {
+		free(fm);
+		return NULL;
+	}
+
+	header = fm->map->map;
+	if (fm->map->len < sizeof(fm_header_t) ||
+	    memcmp(header->magic, FM_MAGIC, sizeof(FM_MAGIC)) != 0 ||
+	    header->byteorder != FM_BYTEORDER ||
+	    header->len != (uint32_t)st.st_size + 1 ||
+	    header->text_size != (uint32_t)st.st_size) {
+		sary_munmap(fm->map);
+		free(fm);
+		errno = EINVAL;
+		return NULL;
+	}
+	layout(header->len, header->dup_bits, &l);
+	if (fm->map->len != l.size) {
+		sary_munmap(fm->map);
+		free(fm);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	base = (const char *)header;
+	fm->len = header->len;
+	fm->dollar = header->dollar;
+	fm->numstreams = header->numstreams;
+	fm->C = header->C;
+	fm->bwt = (const uint8_t *)(base + l.bwt);
+	fm->super = (const uint32_t *)(base + l.super);
+	fm->blocks = (const uint16_t *)(base + l.blocks);
+	fm->dup = (const uint64_t *)(base + l.dup);
+	fm->select = (const uint32_t *)(base + l.select);
+
+	return fm;
+}
+
+void
+fmindex_close(fmindex_t *fm)
+{
+	if (fm == NULL)
+		return;
+	sary_munmap(fm->map);
+	free(fm);
+}
+
+int32_t
+fmindex_range(fmindex_t *fm, const char *pattern, int32_t len,
+              int32_t *first)
+{
+	uint32_t sp = 0, ep = fm->len;
+	int c;
+
+	while (len > 0 && sp < ep) {
+		c = (unsigned char)pattern[--len];
+		sp = fm->C[c] + rank(fm, c, sp);
+		ep = fm->C[c] + rank(fm, c, ep);
+	}
+	*first = sp;
+	return sp < ep ? ep - sp : 0;
+}
+
+int32_t
+fmindex_count_unique(fmindex_t *fm, const char *pattern, int32_t len)
+{
+	int32_t first, count;
+
+	if (len == 0)
+		return fm->numstreams;
+	count = fmindex_range(fm, pattern, len, &first);
+	return distinct(fm, first, count);
+}
+
+typedef struct {
+	const char *pattern;
+	int32_t len;
+	int32_t index;
+} query_t;
+
+/* compares the reversed patterns */
+static int
+query_cmp(const void *a, const void *b)
+{
+	const query_t *qa = a, *qb = b;
+	const unsigned char *pa = (const unsigned char *)qa->pattern + qa->len;
+	const unsigned char *pb = (const unsigned char *)qb->pattern + qb->len;
+	int32_t n = qa->len < qb->len ? qa->len : qb->len;
+
+	while (n-- > 0) {
+		pa--;
+		pb--;
+		if (*pa != *pb)
+			return *pa - *pb;
+	}
+	return qa->len - qb->len;
+}
+
+int
+fmindex_count_many(fmindex_t *fm, const char **patterns,
+                   const int32_t *lens, int32_t n, int unique,
+                   int32_t *counts)
+{
+	query_t *queries;
+	uint32_t *sp = NULL, *ep = NULL;
+	int32_t i, d, maxlen = 0, valid, common;
+	const query_t *prev = NULL;
+	int c;
+
+	queries = malloc((size_t)n * sizeof(query_t) + 1);
+	if (queries == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		queries[i].pattern = patterns[i];
+		queries[i].len = lens[i];
+		queries[i].index = i;
+		if (lens[i] > maxlen)
+			maxlen = lens[i];
+	}
+	qsort(queries, n, sizeof(query_t), query_cmp);
+
+	/* sp[d], ep[d]: rows of the suffixes starting with the last d
+	 * bytes of the previous query; depths below valid are reusable
+	 */
+	sp = malloc(((size_t)maxlen + 1) * sizeof(uint32_t));
+	ep = malloc(((size_t)maxlen + 1) * sizeof(uint32_t));
+	if (sp == NULL || ep == NULL) {
+		free(queries);
+		free(sp);
+		free(ep);
+		errno = ENOMEM;
+		return -1;
+	}
+	sp[0] = 0;
+	ep[0] = fm->len;
+	valid = 1;
+
+	for (i = 0; i < n; i++) {
+		const query_t *q = &queries[i];
+
+		common = 0;
+		if (prev != NULL) {
+			int32_t m = prev->len < q->len ? prev->len : q->len;
+
+			while (common < m &&
+			       prev->pattern[prev->len - 1 - common] ==
+			       q->pattern[q->len - 1 - common])
+				common++;
+		}
+		if (valid > common + 1)
+			valid = common + 1;
+
+		for (d = valid; d <= q->len; d++) {
+			sp[d] = sp[d-1];
+			ep[d] = ep[d-1];
+			if (sp[d] < ep[d]) {
+				c = (unsigned char)q->pattern[q->len - d];
+				sp[d] = fm->C[c] + rank(fm, c, sp[d-1]);
+				ep[d] = fm->C[c] + rank(fm, c, ep[d-1]);
+			}
+		}
+		valid = q->len + 1;
+		prev = q;
+
+		if (unique && q->len == 0)
+			counts[q->index] = fm->numstreams;
+		else if (unique)
+			counts[q->index] = distinct(fm, sp[q->len],
+			                            ep[q->len] - sp[q->len]);
+		else
+			counts[q->index] = ep[q->len] - sp[q->len];
+	}
+
+	free(queries);
+	free(sp);
+	free(ep);
+	return 0;
+}
+
+int
+fmindex_count_substrings(fmindex_t *fm, const char *token, int32_t len,
+                         int unique, int32_t *counts)
+{
+	int32_t start, end;
+	uint32_t sp, ep;
+	int c;
+
+	for (end = 1; end <= len; end++) {
+		sp = 0;
+		ep = fm->len;
+		for (start = end - 1; start >= 0; start--) {
+			size_t i = SUBSTRING_INDEX(len, start, end);
+
+			if (sp < ep) {
+				c = (unsigned char)token[start];
+				sp = fm->C[c] + rank(fm, c, sp);
+				ep = fm->C[c] + rank(fm, c, ep);
+			}
+			if (sp >= ep)
+				counts[i] = 0;
+			else if (unique)
+				counts[i] = distinct(fm, sp, ep - sp);
+			else
+				counts[i] = ep - sp;
+		}
+	}
+	return 0;
+}
+
+/* stream containing text position pos: the last offset <= pos */
+static uint32_t
+stream_of(const uint64_t *offsets, uint32_t num, uint64_t pos)
+{
+	uint32_t low = 0, high = num, mid;
+
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if (offsets[mid] <= pos)
+			low = mid;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* lcp[r] = longest common prefix of the suffixes at sary ranks r-1
+ * and r (Kasai et al.), lcp[0] = 0. rank is scratch space.
+ */
+static void
+build_lcp(const SaryInt *ary, const unsigned char *bof, uint32_t size,
+          uint32_t *rank, uint32_t *lcp)
+{
+	uint32_t i, j, r, h = 0;
+
+	for (r = 0; r < size; r++)
+		rank[GINT_FROM_BE(ary[r])] = r;
+	if (size > 0)
+		lcp[0] = 0;
+	for (i = 0; i < size; i++) {
+		r = rank[i];
+		if (r == 0) {
+			h = 0;
+			continue;
+		}
+		j = GINT_FROM_BE(ary[r-1]);
+		while (i + h < size && j + h < size && bof[i+h] == bof[j+h])
+			h++;
+		lcp[r] = h;
+		if (h > 0)
+			h--;
+	}
+}
+
+/* longest common prefix of rows row-1 and row */
+#define ROW_LCP(lcp, row) ((row) <= 1 ? 0 : (lcp)[(row) - 1])
+
+int
+fmindex_build(const char *data_name, const char *array_name,
+              const char *offsets_name, int offset_size,
+              const char *fm_name)
+{
+	SaryText *text = NULL;
+	SaryMmap *array = NULL;
+	const SaryInt *ary;
+	const unsigned char *bof;
+	uint64_t *offsets = NULL;
+	uint8_t *bwt = NULL;
+	uint32_t *super = NULL;
+	uint16_t *blocks = NULL;
+	uint32_t *lcp = NULL, *h = NULL, *stack = NULL, *last = NULL;
+	uint64_t *dup = NULL;
+	uint32_t *select = NULL;
+	uint32_t counts[256];
+	fm_header_t header;
+	fm_layout_t l;
+	uint32_t size, len, numstreams = 0, row, pos, doc, i, k;
+	uint32_t top, low, high, mid, bit, zeros;
+	int c;
+	FILE *fp = NULL;
+	int rv = -1, saved_errno;
+	static const char pad[8];
+
+	text = sary_text_new(data_name);
+	if (text == NULL)
+		goto out;
+	array = sary_mmap(array_name, "r");
+	if (array == NULL)
+		goto out;
+	offsets = sarytrace_read_offsets(offsets_name, offset_size, &numstreams);
+	if (offsets == NULL)
+		goto out;
+
+	/* every byte must be an index point */
+	size = sary_text_get_size(text);
+	if (array->len / sizeof(SaryInt) != size || numstreams == 0) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	ary = array->map;
+	bof = (const unsigned char *)sary_text_get_bof(text);
+	len = size + 1;
+
+	bwt = malloc(len);
+	super = calloc((size_t)len / SUPER + 1, 256 * sizeof(uint32_t));
+	blocks = calloc((size_t)len / BLOCK + 1, 256 * sizeof(uint16_t));
+	lcp = malloc((size_t)size * sizeof(uint32_t) + 1);
+	h = malloc((size_t)len * sizeof(uint32_t));
+	stack = malloc((size_t)len * sizeof(uint32_t));
+	last = calloc(numstreams, sizeof(uint32_t));
+	if (!bwt || !super || !blocks || !lcp || !h || !stack || !last) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FM_MAGIC, sizeof(FM_MAGIC));
+	header.byteorder = FM_BYTEORDER;
+	header.len = len;
+	header.numstreams = numstreams;
+	header.text_size = size;
+
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < size; i++)
+		counts[bof[i]]++;
+	header.C[0] = 1;
+	for (c = 0; c < 256; c++)
+		header.C[c+1] = header.C[c] + counts[c];
+
+	/* BWT and occurrence counts, in row order; the block counts run
+	 * one past the last row
+	 */
+	memset(counts, 0, sizeof(counts));
+	for (row = 0; row <= len; row++) {
+		if (row % SUPER == 0)
+			memcpy(super + (size_t)(row / SUPER) * 256, counts,
+			       sizeof(counts));
+		if (row % BLOCK == 0) {
+			uint32_t *base = super + (size_t)(row / SUPER) * 256;
+			uint16_t *block = blocks + (size_t)(row / BLOCK) * 256;
+
+			for (c = 0; c < 256; c++)
+				block[c] = counts[c] - base[c];
+		}
+		if (row == len)
+			break;
+
+		pos = row == 0 ? size : (uint32_t)GINT_FROM_BE(ary[row-1]);
+		if (pos == 0) {
+			header.dollar = row;
+			bwt[row] = 0;
+		} else {
+			bwt[row] = bof[pos-1];
+		}
+		counts[bwt[row]]++;
+	}
+
+	/* H, with h used as Kasai's rank array first. The stack holds
+	 * rows in increasing order with non-decreasing ROW_LCP, so the
+	 * first of them after some row is where the smallest lcp since
+	 * that row is first reached.
+	 */
+	build_lcp(ary, bof, size, h, lcp);
+	memset(h, 0, (size_t)len * sizeof(uint32_t));
+	top = 0;
+	for (row = 1; row < len; row++) {
+		while (top > 0 && ROW_LCP(lcp, stack[top-1]) > ROW_LCP(lcp, row))
+			top--;
+		stack[top++] = row;
+
+		doc = stream_of(offsets, numstreams, GINT_FROM_BE(ary[row-1]));
+		if (last[doc] != 0) {
+			low = 0;
+			high = top - 1;
+			while (low < high) {
+				mid = low + (high - low) / 2;
+				if (stack[mid] > last[doc])
+					high = mid;
+				else
+					low = mid + 1;
+			}
+			/* the boundary before row stack[low] */
+			h[stack[low] - 1]++;
+		}
+		last[doc] = row;
+	}
+
+	header.dup_bits = 0;
+	for (k = 0; k + 1 < len; k++)
+		header.dup_bits += h[k] + 1;
+	layout(len, header.dup_bits, &l);
+
+	dup = calloc(l.dwords, sizeof(uint64_t));
+	select = malloc((size_t)l.nselect * sizeof(uint32_t));
+	if (!dup || !select) {
+		errno = ENOMEM;
+		goto out;
+	}
+	bit = 0;
+	zeros = 0;
+	for (k = 0; k + 1 < len; k++) {
+		for (i = 0; i < h[k]; i++, bit++)
+			dup[bit / 64] |= 1ULL << (bit % 64);
+		if (zeros % SELECT == 0)
+			select[zeros / SELECT] = bit;
+		zeros++;
+		bit++;
+	}
+	if (zeros % SELECT == 0)
+		select[zeros / SELECT] = bit;
+
+	fp = fopen(fm_name, "wb");
+	if (fp == NULL)
+		goto out;
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(pad, 1, l.bwt - sizeof(header), fp);
+	fwrite(bwt, 1, len, fp);
+	fwrite(pad, 1, l.super - l.bwt - len, fp);
+	fwrite(super, sizeof(uint32_t), (size_t)l.nsuper * 256, fp);
+	fwrite(blocks, sizeof(uint16_t), (size_t)l.nblocks * 256, fp);
+	fwrite(pad, 1, l.dup - l.blocks -
+	       (size_t)l.nblocks * 256 * sizeof(uint16_t), fp);
+	fwrite(dup, sizeof(uint64_t), l.dwords, fp);
+	fwrite(select, sizeof(uint32_t), l.nselect, fp);
+	if (ferror(fp)) {
+		errno = EIO;
+		goto out;
+	}
+	rv = 0;
+
+out:
+	saved_errno = errno;
+	if (fp != NULL && fclose(fp) != 0 && rv == 0) {
+		saved_errno = errno;
+		rv = -1;
+	}
+	free(bwt);
+	free(super);
+	free(blocks);
+	free(lcp);
+	free(h);
+	free(stack);
+	free(last);
+	free(dup);
+	free(select);
+	free(offsets);
+	if (array)
+		sary_munmap(array);
+	if (text)
+		sary_text_destroy(text);
+	errno = saved_errno;
+	return rv;
+}
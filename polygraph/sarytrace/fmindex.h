@@ -0,0 +1,81 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+/* FM-index of a streamfile (data.fmi), a compact alternative to the
+ * sary array for training traces.
+ *
+ * It holds the Burrows-Wheeler transform of the text with sampled
+ * occurrence counts, about 1.5 bytes per text byte, and a bit vector
+ * of about 2 bits per text byte that counts repeated streams. Token
+ * counts take one backward search step per byte, and distinct-stream
+ * counts two select queries more. Neither the text nor the suffix
+ * array is needed once the index is built.
+ */
+#ifndef FMINDEX_H
+#define FMINDEX_H
+
+#include <stdint.h>
+#include <sary.h>
+
+typedef struct {
+	SaryMmap *map;
+	uint32_t len;           /* rows, text size + 1 */
+	uint32_t dollar;        /* row whose BWT byte is the sentinel */
+	uint32_t numstreams;
+	const uint32_t *C;      /* [257], first row of each byte */
+	const uint8_t *bwt;     /* [len] */
+	const uint32_t *super;  /* [nsuper][256] */
+	const uint16_t *blocks; /* [nblocks][256] */
+	const uint64_t *dup;    /* repeated streams, see fmindex.c */
+	const uint32_t *select; /* samples of the 0 bits in dup */
+} fmindex_t;
+
+/* Returns NULL, with errno set, if the index is missing, unreadable
+ * or was built for a different version of data_name.
+ */
+fmindex_t *fmindex_open(const char *data_name, const char *fm_name);
+void fmindex_close(fmindex_t *fm);
+
+/* Sets *first to the first row of the suffixes starting with pattern,
+ * and returns their number.
+ */
+int32_t fmindex_range(fmindex_t *fm, const char *pattern, int32_t len,
+                      int32_t *first);
+
+/* Number of distinct streams containing pattern. */
+int32_t fmindex_count_unique(fmindex_t *fm, const char *pattern,
+                             int32_t len);
+
+/* As sarytrace_count_many. Backward search extends patterns at the
+ * front, so here the queries are sorted by their reversal and share
+ * the search of a common suffix.
+ */
+int fmindex_count_many(fmindex_t *fm, const char **patterns,
+                       const int32_t *lens, int32_t n, int unique,
+                       int32_t *counts);
+
+/* As sarytrace_count_substrings. Backward search extends patterns at
+ * the front, so here the substrings ending at the same byte share it.
+ */
+int fmindex_count_substrings(fmindex_t *fm, const char *token, int32_t len,
+                             int unique, int32_t *counts);
+
+/* Writes the FM-index of data_name to fm_name, using the sary array
+ * built by mksary with the default index points (every byte).
+ * Returns 0, or -1 with errno set.
+ */
+int fmindex_build(const char *data_name, const char *array_name,
+                  const char *offsets_name, int offset_size,
+                  const char *fm_name);
+
+#endif
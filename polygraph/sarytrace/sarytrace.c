@@ -0,0 +1,861 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sarytrace.h"
+
+/* Layout of the document index (native byte order):
+ *   header      doc_header_t
+ *   docs        uint32_t[len], stream of each suffix rank
+ *   bits        uint64_t[levels * nwords]
+ *   ranks       uint32_t[levels * (nwords+1)]
+ * The wavelet matrix holds prev[i]+1 for every rank i, where prev[i]
+ * is the largest rank j < i with docs[j] == docs[i], or -1.
+ */
+#define DOC_MAGIC "PGDOCS1"
+#define DOC_BYTEORDER 0x01020304
+#define MAX_LEVELS 32
+#define NSAMPLES 64
+
+typedef struct {
+	char magic[8];
+	uint32_t byteorder;
+	uint32_t len;
+	uint32_t numstreams;
+	uint32_t levels;
+	uint32_t fingerprint;   /* of the suffix array */
+	uint32_t text_size;
+	uint32_t zeros[MAX_LEVELS];
+} doc_header_t;
+
+typedef struct {
+	size_t docs;
+	size_t bits;
+	size_t ranks;
+	size_t size;
+} doc_layout_t;
+
+static uint32_t
+fingerprint(const SaryInt *array, int32_t len)
+{
+	uint32_t h = len;
+	int32_t i, step;
+
+	step = len / NSAMPLES + 1;
+	for (i = 0; i < len; i += step)
+		h = (h << 5) - h + (uint32_t)array[i];
+	if (len > 0)
+		h = (h << 5) - h + (uint32_t)array[len-1];
+	return h;
+}
+
+static uint32_t
+levels_for(uint32_t maxval)
+{
+	uint32_t levels = 1;
+
+	while (levels < MAX_LEVELS && (maxval >> levels) != 0)
+		levels++;
+	return levels;
+}
+
+static void
+layout(uint32_t len, uint32_t levels, doc_layout_t *l)
+{
+	uint32_t nwords = (len + 63) / 64;
+
+	l->docs = sizeof(doc_header_t);
+	l->bits = l->docs + (size_t)len * sizeof(uint32_t);
+	l->bits = (l->bits + 7) & ~(size_t)7;
+	l->ranks = l->bits + (size_t)levels * nwords * sizeof(uint64_t);
+	l->size = l->ranks + (size_t)levels * (nwords + 1) * sizeof(uint32_t);
+}
+
+static inline uint32_t
+rank1(const wavelet_t *wm, uint32_t level, uint32_t i)
+{
+	const uint32_t *ranks = wm->ranks + (size_t)level * (wm->nwords + 1);
+	const uint64_t *bits = wm->bits + (size_t)level * wm->nwords;
+	uint32_t r = ranks[i / 64];
+
+	if (i % 64)
+		r += __builtin_popcountll(bits[i / 64] &
+		                          ((1ULL << (i % 64)) - 1));
+	return r;
+}
+
+/* number of values < x at positions [a, b) */
+static uint32_t
+count_less(const wavelet_t *wm, uint32_t a, uint32_t b, uint32_t x)
+{
+	uint32_t level, bit, ra, rb, count = 0;
+
+	if (wm->levels < 32 && x >= (1U << wm->levels))
+		return b - a;
+
+	for (level = 0; level < wm->levels && a < b; level++) {
+		bit = (x >> (wm->levels - 1 - level)) & 1;
+		ra = rank1(wm, level, a);
+		rb = rank1(wm, level, b);
+		if (bit) {
+			/* everything going to the 0 side is smaller */
+			count += (b - a) - (rb - ra);
+			a = wm->zeros[level] + ra;
+			b = wm->zeros[level] + rb;
+		} else {
+			a -= ra;
+			b -= rb;
+		}
+	}
+	return count;
+}
+
+static int
+compare(const char *pattern, int32_t len, const char *pos, const char *eof)
+{
+	int32_t rest = eof - pos;
+	int c = memcmp(pattern, pos, len < rest ? len : rest);
+
+	if (c != 0)
+		return c;
+	/* a suffix cut off by the end of the text sorts first */
+	return rest < len ? 1 : 0;
+}
+
+/* first rank in array[0, len) whose suffix is >= pattern (upper == 0),
+ * or whose prefix is > pattern (upper == 1), for the text [bof, eof)
+ */
+static int32_t
+bound_in(const SaryInt *array, int32_t len, const char *bof, const char *eof,
+         const char *pattern, int32_t plen, int upper)
+{
+	int32_t low = 0, high = len, mid;
+	int c;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		c = compare(pattern, plen, bof + GINT_FROM_BE(array[mid]), eof);
+		if (c > 0 || (upper && c == 0))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static int32_t
+bound(sarytrace_t *trace, const char *pattern, int32_t len, int upper)
+{
+	return bound_in(trace->array->map, trace->len,
+	                sary_text_get_bof(trace->text),
+	                sary_text_get_eof(trace->text), pattern, len, upper);
+}
+
+sarytrace_t *
+sarytrace_open(const char *data_name, const char *array_name)
+{
+	sarytrace_t *trace;
+	char *name;
+	const doc_header_t *header;
+	doc_layout_t l;
+
+	trace = calloc(1, sizeof(sarytrace_t));
+	if (trace == NULL)
+		return NULL;
+
+	trace->text = sary_text_new(data_name);
+	if (trace->text == NULL) {
+		free(trace);
+		return NULL;
+	}
+	trace->array = sary_mmap(array_name, "r");
+	if (trace->array == NULL) {
+		sary_text_destroy(trace->text);
+		free(trace);
+		return NULL;
+	}
+	trace->len = trace->array->len / sizeof(SaryInt);
+
+	name = g_strconcat(array_name, ".lcp", NULL);
+	trace->lcp = sary_lcp_new(name, trace->array);
+	g_free(name);
+
+	/* the document index is optional, and ignored if it was built
+	 * for another array
+	 */
+	name = g_strconcat(array_name, ".doc", NULL);
+	trace->docmap = sary_mmap(name, "r");
+	g_free(name);
+	if (trace->docmap == NULL)
+		return trace;
+
+	header = trace->docmap->map;
+	if (trace->docmap->len < sizeof(doc_header_t) ||
+	    memcmp(header->magic, DOC_MAGIC, sizeof(DOC_MAGIC)) != 0 ||
+	    header->byteorder != DOC_BYTEORDER ||
+	    header->len != (uint32_t)trace->len ||
+	    header->levels == 0 || header->levels > MAX_LEVELS ||
+	    header->text_size != (uint32_t)sary_text_get_size(trace->text) ||
+	    header->fingerprint != fingerprint(trace->array->map, trace->len)) {
+		sary_munmap(trace->docmap);
+		trace->docmap = NULL;
+		return trace;
+	}
+	layout(header->len, header->levels, &l);
+	if (trace->docmap->len != l.size) {
+		sary_munmap(trace->docmap);
+		trace->docmap = NULL;
+		return trace;
+	}
+
+	trace->docs = (const uint32_t *)((char *)header + l.docs);
+	trace->numstreams = header->numstreams;
+	trace->prev.len = header->len;
+	trace->prev.levels = header->levels;
+	trace->prev.nwords = (header->len + 63) / 64;
+	trace->prev.zeros = header->zeros;
+	trace->prev.bits = (const uint64_t *)((char *)header + l.bits);
+	trace->prev.ranks = (const uint32_t *)((char *)header + l.ranks);
+
+	return trace;
+}
+
+void
+sarytrace_close(sarytrace_t *trace)
+{
+	if (trace == NULL)
+		return;
+	if (trace->docmap)
+		sary_munmap(trace->docmap);
+	sary_lcp_destroy(trace->lcp);
+	sary_munmap(trace->array);
+	sary_text_destroy(trace->text);
+	free(trace);
+}
+
+int32_t
+sarytrace_range(sarytrace_t *trace, const char *pattern, int32_t len,
+                int32_t *first)
+{
+	SaryInt *lcp_first, *lcp_last;
+	int32_t last;
+
+	if (trace->len == 0) {
+		*first = 0;
+		return 0;
+	}
+	if (len == 0) {
+		*first = 0;
+		return trace->len;
+	}
+
+	if (trace->lcp) {
+		if (!sary_lcp_search(trace->lcp, trace->text, pattern, len,
+		                     &lcp_first, &lcp_last)) {
+			*first = 0;
+			return 0;
+		}
+		*first = lcp_first - (SaryInt *)trace->array->map;
+		return lcp_last - lcp_first + 1;
+	}
+
+	*first = bound(trace, pattern, len, 0);
+	last = bound(trace, pattern, len, 1);
+	return last - *first;
+}
+
+int32_t
+sarytrace_distinct(sarytrace_t *trace, int32_t first, int32_t count)
+{
+	if (count <= 0)
+		return 0;
+	/* a rank starts a new stream iff the previous rank from the same
+	 * stream lies before the range, i.e. prev[i]+1 <= first
+	 */
+	return count_less(&trace->prev, first, first + count, first + 1);
+}
+
+int32_t
+sarytrace_count_unique(sarytrace_t *trace, const char *pattern, int32_t len)
+{
+	int32_t first, count;
+
+	if (trace->docmap == NULL)
+		return -1;
+	count = sarytrace_range(trace, pattern, len, &first);
+	return sarytrace_distinct(trace, first, count);
+}
+
+typedef struct {
+	const char *pattern;
+	int32_t len;
+	int32_t index;
+} query_t;
+
+static int
+query_cmp(const void *a, const void *b)
+{
+	const query_t *qa = a, *qb = b;
+	int32_t n = qa->len < qb->len ? qa->len : qb->len;
+	int c = memcmp(qa->pattern, qb->pattern, n);
+
+	if (c != 0)
+		return c;
+	return qa->len - qb->len;
+}
+
+/* byte at depth d of the suffix at rank i, or -1 past the end of
+ * the text, which sorts before every byte
+ */
+static inline int
+suffix_byte(const SaryInt *array, const unsigned char *bof, int32_t size,
+            int32_t i, int32_t d)
+{
+	int32_t pos = GINT_FROM_BE(array[i]) + d;
+
+	return pos < size ? bof[pos] : -1;
+}
+
+/* narrow [*lo, *hi), whose suffixes all share their first d bytes,
+ * to the suffixes whose byte at depth d is c
+ */
+static void
+narrow(const SaryInt *array, const unsigned char *bof, int32_t size,
+       int32_t d, int c, int32_t *lo, int32_t *hi)
+{
+	int32_t low = *lo, high = *hi, mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (suffix_byte(array, bof, size, mid, d) < c)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	*lo = low;
+	high = *hi;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (suffix_byte(array, bof, size, mid, d) <= c)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	*hi = low;
+}
+
+int
+sarytrace_count_many(sarytrace_t *trace, const char **patterns,
+                     const int32_t *lens, int32_t n, int unique,
+                     int32_t *counts)
+{
+	const SaryInt *array = trace->array->map;
+	const unsigned char *bof =
+		(const unsigned char *)sary_text_get_bof(trace->text);
+	int32_t size = sary_text_get_size(trace->text);
+	query_t *queries;
+	int32_t *lo = NULL, *hi = NULL;
+	int32_t i, d, maxlen = 0, valid = 0, common;
+	const query_t *prev = NULL;
+
+	if (unique && trace->docmap == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	queries = malloc((size_t)n * sizeof(query_t) + 1);
+	if (queries == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		queries[i].pattern = patterns[i];
+		queries[i].len = lens[i];
+		queries[i].index = i;
+		if (lens[i] > maxlen)
+			maxlen = lens[i];
+	}
+	qsort(queries, n, sizeof(query_t), query_cmp);
+
+	/* lo[d], hi[d]: ranks of the suffixes starting with the first d
+	 * bytes of the previous query; depths below valid are reusable
+	 */
+	lo = malloc(((size_t)maxlen + 1) * sizeof(int32_t));
+	hi = malloc(((size_t)maxlen + 1) * sizeof(int32_t));
+	if (lo == NULL || hi == NULL) {
+		free(queries);
+		free(lo);
+		free(hi);
+		errno = ENOMEM;
+		return -1;
+	}
+	lo[0] = 0;
+	hi[0] = trace->len;
+	valid = 1;
+
+	for (i = 0; i < n; i++) {
+		const query_t *q = &queries[i];
+
+		common = 0;
+		if (prev != NULL) {
+			int32_t m = prev->len < q->len ? prev->len : q->len;
+
+			while (common < m &&
+			       prev->pattern[common] == q->pattern[common])
+				common++;
+		}
+		if (valid > common + 1)
+			valid = common + 1;
+
+		for (d = valid; d <= q->len; d++) {
+			lo[d] = lo[d-1];
+			hi[d] = hi[d-1];
+			if (lo[d] < hi[d])
+				narrow(array, bof, size, d - 1,
+				       (unsigned char)q->pattern[d-1],
+				       &lo[d], &hi[d]);
+		}
+		valid = q->len + 1;
+		prev = q;
+
+		if (unique)
+			counts[q->index] = sarytrace_distinct(trace, lo[q->len],
+			                                      hi[q->len] - lo[q->len]);
+		else
+			counts[q->index] = hi[q->len] - lo[q->len];
+	}
+
+	free(queries);
+	free(lo);
+	free(hi);
+	return 0;
+}
+
+int
+sarytrace_count_substrings(sarytrace_t *trace, const char *token,
+                           int32_t len, int unique, int32_t *counts)
+{
+	const SaryInt *array = trace->array->map;
+	const unsigned char *bof =
+		(const unsigned char *)sary_text_get_bof(trace->text);
+	int32_t size = sary_text_get_size(trace->text);
+	int32_t start, end, lo, hi;
+
+	if (unique && trace->docmap == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (start = 0; start < len; start++) {
+		lo = 0;
+		hi = trace->len;
+		for (end = start + 1; end <= len; end++) {
+			size_t i = SUBSTRING_INDEX(len, start, end);
+
+			if (lo < hi)
+				narrow(array, bof, size, end - start - 1,
+				       (unsigned char)token[end - 1], &lo, &hi);
+			if (lo >= hi)
+				counts[i] = 0;
+			else if (unique)
+				counts[i] = sarytrace_distinct(trace, lo, hi - lo);
+			else
+				counts[i] = hi - lo;
+		}
+	}
+	return 0;
+}
+
+/* compares the suffixes at a and b, a suffix cut off by eof first */
+static int
+suffix_cmp(const char *a, const char *b, const char *eof)
+{
+	int32_t la = eof - a, lb = eof - b;
+	int c = memcmp(a, b, la < lb ? la : lb);
+
+	if (c != 0)
+		return c;
+	return la - lb;
+}
+
+int
+sarytrace_append(const char *data_name, const char *array_name,
+                 int32_t old_size)
+{
+	SaryText *text = NULL;
+	SaryMmap *array = NULL;
+	const SaryInt *old;
+	const char *bof, *eof, *old_eof;
+	SaryInt *out = NULL, *block = NULL;
+	int32_t *where = NULL;
+	int32_t size, old_len, tail, keep, nblock, i, j, k, low, high, mid;
+	char *tmp_name = NULL;
+	FILE *fp = NULL;
+	int rv = -1, saved_errno;
+
+	text = sary_text_new(data_name);
+	if (text == NULL)
+		goto out;
+	array = sary_mmap(array_name, "r");
+	if (array == NULL)
+		goto out;
+
+	/* every byte must be an index point */
+	size = sary_text_get_size(text);
+	old = array->map;
+	old_len = array->len / sizeof(SaryInt);
+	if (old_len != old_size || old_size > size) {
+		errno = EINVAL;
+		goto out;
+	}
+	bof = sary_text_get_bof(text);
+	eof = sary_text_get_eof(text);
+	old_eof = bof + old_size;
+
+	/* An old suffix keeps its place among the old ones unless it ran
+	 * into the old end of the text while equal to the start of
+	 * another suffix; then the appended bytes decide their order.
+	 * Those are the suffixes starting in the longest tail of the old
+	 * text that occurs more than once in it; shorter tails then occur
+	 * more than once too.
+	 */
+	low = 0;
+	high = old_size;
+	while (low < high) {
+		mid = high - (high - low) / 2;
+		if (bound_in(old, old_len, bof, old_eof, old_eof - mid, mid, 1) -
+		    bound_in(old, old_len, bof, old_eof, old_eof - mid, mid, 0) > 1)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	tail = low;
+	keep = old_size - tail;
+
+	/* the new block: the tail suffixes and the appended ones */
+	nblock = size - keep;
+	out = malloc((size_t)size * sizeof(SaryInt) + 1);
+	block = malloc((size_t)nblock * sizeof(SaryInt) + 1);
+	where = malloc((size_t)nblock * sizeof(int32_t) + 1);
+	if (out == NULL || block == NULL || where == NULL) {
+		errno = ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < nblock; i++)
+		block[i] = GINT_TO_BE(keep + i);
+	sary_multikey_qsort(NULL, block, nblock, 0, bof, eof);
+
+	/* the old suffixes that stay, in their order */
+	for (i = j = 0; i < old_len; i++)
+		if (GINT_FROM_BE(old[i]) < keep)
+			out[j++] = old[i];
+
+	/* insertion points, non-decreasing as the block is sorted */
+	low = 0;
+	for (i = 0; i < nblock; i++) {
+		const char *suffix = bof + GINT_FROM_BE(block[i]);
+
+		high = keep;
+		while (low < high) {
+			mid = low + (high - low) / 2;
+			if (suffix_cmp(bof + GINT_FROM_BE(out[mid]), suffix, eof) < 0)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		where[i] = low;
+	}
+
+	/* merge from the back, in place */
+	j = keep - 1;
+	k = size - 1;
+	for (i = nblock - 1; i >= 0; i--) {
+		while (j >= where[i])
+			out[k--] = out[j--];
+		out[k--] = block[i];
+	}
+
+	tmp_name = g_strconcat(array_name, ".tmp", NULL);
+	fp = fopen(tmp_name, "wb");
+	if (fp == NULL)
+		goto out;
+	fwrite(out, sizeof(SaryInt), size, fp);
+	if (ferror(fp)) {
+		errno = EIO;
+		goto out;
+	}
+	if (fclose(fp) != 0) {
+		fp = NULL;
+		goto out;
+	}
+	fp = NULL;
+	if (rename(tmp_name, array_name) < 0)
+		goto out;
+	rv = 0;
+
+out:
+	saved_errno = errno;
+	if (fp != NULL)
+		fclose(fp);
+	if (rv < 0 && tmp_name != NULL)
+		unlink(tmp_name);
+	g_free(tmp_name);
+	free(out);
+	free(block);
+	free(where);
+	if (array)
+		sary_munmap(array);
+	if (text)
+		sary_text_destroy(text);
+	errno = saved_errno;
+	return rv;
+}
+
+static uint64_t
+get_le64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+uint64_t *
+sarytrace_read_offsets(const char *offsets_name, int offset_size, uint32_t *num)
+{
+	FILE *fp;
+	struct stat st;
+	uint64_t *offsets;
+	unsigned char buf[STREAMS_HEADER_LEN];
+	long header = 0;
+	int le = 0;
+	uint32_t i;
+
+	if (offset_size != 4 && offset_size != 8) {
+		errno = EINVAL;
+		return NULL;
+	}
+	fp = fopen(offsets_name, "rb");
+	if (fp == NULL)
+		return NULL;
+	if (fstat(fileno(fp), &st) < 0) {
+		fclose(fp);
+		return NULL;
+	}
+
+	/* a versioned file has a header and little endian 64 bit offsets;
+	 * older ones hold native integers of offset_size bytes */
+	if (st.st_size >= STREAMS_HEADER_LEN &&
+	    fread(buf, STREAMS_HEADER_LEN, 1, fp) == 1 &&
+	    memcmp(buf, STREAMS_MAGIC, 8) == 0) {
+		if (buf[8] != STREAMS_VERSION || buf[9] || buf[10] || buf[11]) {
+			fclose(fp);
+			errno = EINVAL;
+			return NULL;
+		}
+		header = STREAMS_HEADER_LEN;
+		offset_size = 8;
+		le = 1;
+	}
+	if (fseek(fp, header, SEEK_SET) < 0) {
+		fclose(fp);
+		return NULL;
+	}
+
+	*num = (st.st_size - header) / offset_size;
+	offsets = malloc(((size_t)*num + 1) * sizeof(uint64_t));
+	if (offsets == NULL) {
+		fclose(fp);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (i = 0; i < *num; i++) {
+		if (fread(buf, offset_size, 1, fp) != 1) {
+			free(offsets);
+			fclose(fp);
+			errno = EIO;
+			return NULL;
+		}
+		if (le)
+			offsets[i] = get_le64(buf);
+		else if (offset_size == 4)
+			offsets[i] = *(uint32_t *)buf;
+		else
+			offsets[i] = *(uint64_t *)buf;
+	}
+	fclose(fp);
+	return offsets;
+}
+
+/* stream containing text position pos: the last offset <= pos */
+static uint32_t
+stream_of(const uint64_t *offsets, uint32_t num, uint64_t pos)
+{
+	uint32_t low = 0, high = num, mid;
+
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if (offsets[mid] <= pos)
+			low = mid;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+int
+sarytrace_build_docs(const char *data_name, const char *array_name,
+                     const char *offsets_name, int offset_size,
+                     const char *doc_name)
+{
+	SaryText *text = NULL;
+	SaryMmap *array = NULL;
+	const SaryInt *ary;
+	uint64_t *offsets = NULL;
+	uint32_t numstreams = 0;
+	uint32_t *docs = NULL, *cur = NULL, *next = NULL;
+	int32_t *last = NULL;
+	uint64_t *bits = NULL;
+	uint32_t *ranks = NULL;
+	doc_header_t header;
+	doc_layout_t l;
+	uint32_t len, nwords, levels, level, i, zeros, ones, bit;
+	FILE *fp = NULL;
+	int rv = -1, saved_errno;
+	static const char pad[8];
+
+	text = sary_text_new(data_name);
+	if (text == NULL)
+		goto out;
+	array = sary_mmap(array_name, "r");
+	if (array == NULL)
+		goto out;
+	offsets = sarytrace_read_offsets(offsets_name, offset_size, &numstreams);
+	if (offsets == NULL)
+		goto out;
+	if (numstreams == 0 && array->len > 0) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	ary = array->map;
+	len = array->len / sizeof(SaryInt);
+	nwords = (len + 63) / 64;
+	levels = levels_for(len);
+	layout(len, levels, &l);
+
+	docs = malloc((size_t)len * sizeof(uint32_t) + 1);
+	cur = malloc((size_t)len * sizeof(uint32_t) + 1);
+	next = malloc((size_t)len * sizeof(uint32_t) + 1);
+	last = malloc((size_t)numstreams * sizeof(int32_t) + 1);
+	bits = calloc((size_t)levels * nwords + 1, sizeof(uint64_t));
+	ranks = malloc(((size_t)levels * (nwords + 1)) * sizeof(uint32_t));
+	if (!docs || !cur || !next || !last || !bits || !ranks) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < numstreams; i++)
+		last[i] = -1;
+	for (i = 0; i < len; i++) {
+		docs[i] = stream_of(offsets, numstreams,
+		                    (uint32_t)GINT_FROM_BE(ary[i]));
+		cur[i] = last[docs[i]] + 1;
+		last[docs[i]] = i;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DOC_MAGIC, sizeof(DOC_MAGIC));
+	header.byteorder = DOC_BYTEORDER;
+	header.len = len;
+	header.numstreams = numstreams;
+	header.levels = levels;
+	header.fingerprint = fingerprint(ary, len);
+	header.text_size = sary_text_get_size(text);
+
+	/* wavelet matrix, most significant bit first; each level is a
+	 * stable partition of the previous one by its bit
+	 */
+	for (level = 0; level < levels; level++) {
+		uint64_t *lbits = bits + (size_t)level * nwords;
+		uint32_t *lranks = ranks + (size_t)level * (nwords + 1);
+		uint32_t *tmp;
+
+		bit = levels - 1 - level;
+		zeros = 0;
+		for (i = 0; i < len; i++) {
+			if ((cur[i] >> bit) & 1)
+				lbits[i / 64] |= 1ULL << (i % 64);
+			else
+				zeros++;
+		}
+		header.zeros[level] = zeros;
+
+		lranks[0] = 0;
+		for (i = 0; i < nwords; i++)
+			lranks[i+1] = lranks[i] + __builtin_popcountll(lbits[i]);
+
+		ones = zeros;
+		zeros = 0;
+		for (i = 0; i < len; i++) {
+			if ((cur[i] >> bit) & 1)
+				next[ones++] = cur[i];
+			else
+				next[zeros++] = cur[i];
+		}
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	fp = fopen(doc_name, "wb");
+	if (fp == NULL)
+		goto out;
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(docs, sizeof(uint32_t), len, fp);
+	fwrite(pad, 1, l.bits - l.docs - (size_t)len * sizeof(uint32_t), fp);
+	fwrite(bits, sizeof(uint64_t), (size_t)levels * nwords, fp);
+	fwrite(ranks, sizeof(uint32_t), (size_t)levels * (nwords + 1), fp);
+	if (ferror(fp)) {
+		errno = EIO;
+		goto out;
+	}
+	rv = 0;
+
+out:
+	saved_errno = errno;
+	if (fp != NULL && fclose(fp) != 0 && rv == 0) {
+		saved_errno = errno;
+		rv = -1;
+	}
+	free(docs);
+	free(cur);
+	free(next);
+	free(last);
+	free(bits);
+	free(ranks);
+	free(offsets);
+	if (array)
+		sary_munmap(array);
+	if (text)
+		sary_text_destroy(text);
+	errno = saved_errno;
+	return rv;
+}
@@ -0,0 +1,134 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+/* Token statistics over a streamfile's suffix array.
+ *
+ * Besides the text and the sary array, a streamfile may have a
+ * document index (data.ary.doc) mapping every suffix rank to the
+ * stream it starts in. Together with a wavelet matrix over the rank
+ * of the previous suffix from the same stream, it answers "how many
+ * distinct streams contain this token" in O(m + log n) without
+ * visiting the occurrences.
+ */
+#ifndef SARYTRACE_H
+#define SARYTRACE_H
+
+#include <stdint.h>
+#include <sary.h>
+
+typedef struct {
+	uint32_t len;           /* number of values */
+	uint32_t levels;        /* bits per value */
+	uint32_t nwords;        /* 64 bit words per level */
+	const uint32_t *zeros;  /* number of 0 bits in each level */
+	const uint64_t *bits;   /* levels * nwords */
+	const uint32_t *ranks;  /* levels * (nwords+1), 1 bits before each word */
+} wavelet_t;
+
+typedef struct {
+	SaryText *text;
+	SaryMmap *array;
+	SaryLcp *lcp;           /* NULL if there is no LCP table */
+	int32_t len;            /* number of suffixes */
+
+	/* document index; docmap is NULL if there is none */
+	SaryMmap *docmap;
+	const uint32_t *docs;
+	uint32_t numstreams;
+	wavelet_t prev;
+} sarytrace_t;
+
+sarytrace_t *sarytrace_open(const char *data_name, const char *array_name);
+void sarytrace_close(sarytrace_t *trace);
+
+/* Sets *first to the rank of the first suffix starting with pattern,
+ * and returns the number of such suffixes.
+ */
+int32_t sarytrace_range(sarytrace_t *trace, const char *pattern, int32_t len,
+                        int32_t *first);
+
+/* Number of distinct streams among suffix ranks [first, first+count).
+ * Requires the document index.
+ */
+int32_t sarytrace_distinct(sarytrace_t *trace, int32_t first, int32_t count);
+
+/* Number of distinct streams containing pattern, or -1 if there is no
+ * document index.
+ */
+int32_t sarytrace_count_unique(sarytrace_t *trace, const char *pattern,
+                               int32_t len);
+
+/* Counts every pattern at once: sets counts[i] to the number of
+ * occurrences of patterns[i], or to the number of distinct streams
+ * containing it if unique is set. The patterns are searched in sorted
+ * order and each one starts from the suffix array interval of the
+ * prefix it shares with the previous one, so the substrings of a
+ * token cost little more than the token itself. Returns 0, or -1 with
+ * errno set (EINVAL if unique is set and there is no document index).
+ */
+int sarytrace_count_many(sarytrace_t *trace, const char **patterns,
+                         const int32_t *lens, int32_t n, int unique,
+                         int32_t *counts);
+
+/* Counts of every substring of token, as sarytrace_count_many, in
+ * counts[SUBSTRING_INDEX(len, start, end)]. The substrings starting at
+ * the same byte are counted by narrowing one suffix array interval a
+ * byte at a time, so the whole token takes len * (len + 1) / 2 narrowing
+ * steps at most, and none past a substring that does not occur.
+ */
+int sarytrace_count_substrings(sarytrace_t *trace, const char *token,
+                               int32_t len, int unique, int32_t *counts);
+
+/* index of token[start:end], 0 <= start < end <= len, in a triangular
+ * table of len * (len + 1) / 2 entries
+ */
+#define SUBSTRING_INDEX(len, start, end) \
+	((size_t)(start) * (len) - (size_t)(start) * ((start) - 1) / 2 + \
+	 (end) - (start) - 1)
+
+/* Writes the document index of array_name to doc_name. offsets_name
+ * holds the start of each stream, read by sarytrace_read_offsets.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int sarytrace_build_docs(const char *data_name, const char *array_name,
+                         const char *offsets_name, int offset_size,
+                         const char *doc_name);
+
+/* Brings the sary array of data_name up to date after bytes were
+ * appended to the text, which had old_size bytes when the array was
+ * built. Only the new suffixes are sorted, and each is placed with a
+ * binary search of the old array, so the comparisons are in the size
+ * of the appended data. The whole array is still copied and written
+ * out again, in time and space linear in the text. The array must
+ * index every byte. Returns 0, or -1 with errno set.
+ */
+int sarytrace_append(const char *data_name, const char *array_name,
+                     int32_t old_size);
+
+/* Streamfile offsets files start with a 16 byte header: the magic,
+ * a little endian 32 bit version and 32 bits of flags (see
+ * stream_trace.py). Offsets follow as little endian 64 bit integers.
+ */
+#define STREAMS_MAGIC      "PGSTREAM"
+#define STREAMS_VERSION    1
+#define STREAMS_HEADER_LEN 16
+
+/* Reads a stream offsets file, versioned or, for streamfiles written
+ * before the header was introduced, of native integers of offset_size
+ * bytes. Sets *num to the number of streams and returns a malloc'ed
+ * array with room for one more entry, or NULL with errno set.
+ */
+uint64_t *sarytrace_read_offsets(const char *offsets_name, int offset_size,
+                                 uint32_t *num);
+
+#endif
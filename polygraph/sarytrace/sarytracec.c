@@ -0,0 +1,580 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <Python.h>
+#include <errno.h>
+#include "sarytrace.h"
+#include "fmindex.h"
+
+static PyObject*
+py_open(PyObject* self, PyObject* args)
+{
+	char *data_name, *array_name;
+	sarytrace_t *trace;
+
+	if (!PyArg_ParseTuple(args, "ss:open", &data_name, &array_name))
+		return NULL;
+
+	trace = sarytrace_open(data_name, array_name);
+	if (trace == NULL) {
+		if (errno == 0)
+			errno = ENOENT;
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, array_name);
+	}
+
+	/* return pointer to the handle */
+	return Py_BuildValue("l", (long)trace);
+}
+
+static PyObject*
+py_close(PyObject* self, PyObject* args)
+{
+	sarytrace_t *trace;
+
+	if (!PyArg_ParseTuple(args, "l:close", (long*)&trace)) return NULL;
+
+	sarytrace_close(trace);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_has_docs(PyObject* self, PyObject* args)
+{
+	sarytrace_t *trace;
+
+	if (!PyArg_ParseTuple(args, "l:has_docs", (long*)&trace)) return NULL;
+
+	return PyBool_FromLong(trace->docmap != NULL);
+}
+
+static PyObject*
+py_numstreams(PyObject* self, PyObject* args)
+{
+	sarytrace_t *trace;
+
+	if (!PyArg_ParseTuple(args, "l:numstreams", (long*)&trace)) return NULL;
+
+	return PyInt_FromLong(trace->numstreams);
+}
+
+static PyObject*
+py_count(PyObject* self, PyObject* args)
+{
+	sarytrace_t *trace;
+	char *token;
+	int len;
+	int32_t first, count;
+
+	if (!PyArg_ParseTuple(args, "ls#:count", (long*)&trace, &token, &len))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	count = sarytrace_range(trace, token, len, &first);
+	Py_END_ALLOW_THREADS
+
+	return PyInt_FromLong(count);
+}
+
+static PyObject*
+py_count_unique(PyObject* self, PyObject* args)
+{
+	sarytrace_t *trace;
+	char *token;
+	int len;
+	int32_t count;
+
+	if (!PyArg_ParseTuple(args, "ls#:count_unique", (long*)&trace,
+	                      &token, &len))
+		return NULL;
+
+	if (trace->docmap == NULL) {
+		PyErr_SetString(PyExc_ValueError, "no document index");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	count = sarytrace_count_unique(trace, token, len);
+	Py_END_ALLOW_THREADS
+
+	return PyInt_FromLong(count);
+}
+
+typedef int (*count_many_fn)(void *index, const char **patterns,
+                             const int32_t *lens, int32_t n, int unique,
+                             int32_t *counts);
+
+/* the sequence keeps the strings alive while the GIL is released */
+static PyObject*
+count_many(count_many_fn fn, void *index, PyObject *tokens, int unique)
+{
+	PyObject *seq, *item, *result = NULL;
+	int i, n, rv;
+	const char **patterns = NULL;
+	int32_t *lens = NULL, *counts = NULL;
+
+	seq = PySequence_Fast(tokens, "count_many expects a sequence of strings");
+	if (seq == NULL)
+		return NULL;
+	n = PySequence_Fast_GET_SIZE(seq);
+
+	patterns = PyMem_Malloc(n * sizeof(char *) + 1);
+	lens = PyMem_Malloc(n * sizeof(int32_t) + 1);
+	counts = PyMem_Malloc(n * sizeof(int32_t) + 1);
+	if (!patterns || !lens || !counts) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		item = PySequence_Fast_GET_ITEM(seq, i);
+		if (!PyString_Check(item)) {
+			PyErr_SetString(PyExc_TypeError,
+			                "count_many expects a sequence of strings");
+			goto out;
+		}
+		patterns[i] = PyString_AS_STRING(item);
+		lens[i] = PyString_GET_SIZE(item);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	rv = fn(index, patterns, lens, n, unique, counts);
+	Py_END_ALLOW_THREADS
+
+	if (rv < 0) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		goto out;
+	}
+
+	result = PyList_New(n);
+	if (result == NULL)
+		goto out;
+	for (i = 0; i < n; i++)
+		PyList_SET_ITEM(result, i, PyInt_FromLong(counts[i]));
+
+out:
+	PyMem_Free(patterns);
+	PyMem_Free(lens);
+	PyMem_Free(counts);
+	Py_DECREF(seq);
+	return result;
+}
+
+static PyObject*
+py_count_many(PyObject* self, PyObject* args)
+{
+	sarytrace_t *trace;
+	PyObject *tokens;
+	int unique = 0;
+
+	if (!PyArg_ParseTuple(args, "lO|i:count_many", (long*)&trace,
+	                      &tokens, &unique))
+		return NULL;
+
+	if (unique && trace->docmap == NULL) {
+		PyErr_SetString(PyExc_ValueError, "no document index");
+		return NULL;
+	}
+	return count_many((count_many_fn)sarytrace_count_many, trace,
+	                  tokens, unique);
+}
+
+typedef int (*count_substrings_fn)(void *index, const char *token,
+                                   int32_t len, int unique, int32_t *counts);
+
+/* tokensplit.mpp: the most probable split of a token into pieces, each
+ * with probability min(.999, count / numstreams), and the probability
+ * of the split. The bottom up program is the one of tokensplit.py, with
+ * the same arithmetic; a split is kept as the end of its first piece,
+ * first[end][start], the rest being the split of [end, len) from the
+ * line after.
+ */
+static int
+split_dp(const int32_t *counts, int32_t len, double numstreams,
+         double minprob, int minlen, double *prob, int32_t *ends,
+         int32_t *nends)
+{
+	double *p;
+	int32_t *first, start, end, n;
+
+#define PIECE_PROB(s, e) \
+	((double)counts[SUBSTRING_INDEX(len, s, e)] / numstreams > .999 ? \
+	 .999 : (double)counts[SUBSTRING_INDEX(len, s, e)] / numstreams)
+#define FIRST(e, s) first[(size_t)(e) * ((e) - 1) / 2 + (s)]
+
+	if (len <= 0)
+		return -1;
+	p = malloc((size_t)len * sizeof(double));
+	first = malloc(((size_t)len * (len + 1) / 2 + 1) * sizeof(int32_t));
+	if (p == NULL || first == NULL) {
+		free(p);
+		free(first);
+		return -1;
+	}
+
+	for (start = 0; start < len; start++) {
+		p[start] = PIECE_PROB(start, len);
+		FIRST(len, start) = len;
+	}
+	for (end = len - 1; end > 0; end--) {
+		for (start = 0; start < end; start++) {
+			double split = PIECE_PROB(start, end) * p[end];
+
+			if (split > p[start] && p[start] < minprob &&
+			    end - start > minlen) {
+				p[start] = split;
+				FIRST(end, start) = end;
+			} else {
+				FIRST(end, start) = FIRST(end + 1, start);
+			}
+		}
+	}
+
+	*prob = p[0];
+	n = 0;
+	for (start = 0, end = 1; start < len; start = ends[n++], end = start + 1)
+		ends[n] = FIRST(end, start);
+	*nends = n;
+#undef PIECE_PROB
+#undef FIRST
+
+	free(p);
+	free(first);
+	return 0;
+}
+
+static PyObject*
+mpp(count_substrings_fn fn, PyObject *args, const char *format)
+{
+	PyObject *result, *pieces;
+	long handle;
+	const char *token;
+	int len, numstreams, minlen = 1, unique = 0, rv;
+	double minprob = 1, prob = 0;
+	int32_t *counts, *ends, nends = 0, i, start;
+
+	if (!PyArg_ParseTuple(args, format, &handle, &token, &len,
+	                      &numstreams, &minprob, &minlen, &unique))
+		return NULL;
+	if (len == 0 || numstreams <= 0) {
+		PyErr_SetString(PyExc_ValueError, "empty token or trace");
+		return NULL;
+	}
+
+	counts = malloc(((size_t)len * (len + 1) / 2) * sizeof(int32_t));
+	ends = malloc((size_t)len * sizeof(int32_t));
+	if (counts == NULL || ends == NULL) {
+		free(counts);
+		free(ends);
+		return PyErr_NoMemory();
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	errno = 0;
+	rv = fn((void *)handle, token, len, unique, counts);
+	if (rv == 0)
+		rv = split_dp(counts, len, numstreams, minprob, minlen,
+		              &prob, ends, &nends);
+	Py_END_ALLOW_THREADS
+	free(counts);
+
+	if (rv < 0) {
+		free(ends);
+		if (errno == EINVAL) {
+			PyErr_SetString(PyExc_ValueError, "no document index");
+			return NULL;
+		}
+		return PyErr_NoMemory();
+	}
+
+	if ((pieces = PyList_New(nends)) == NULL) {
+		free(ends);
+		return NULL;
+	}
+	for (i = 0, start = 0; i < nends; start = ends[i++])
+		PyList_SET_ITEM(pieces, i, Py_BuildValue("(ii)", start, ends[i]));
+	free(ends);
+	result = Py_BuildValue("(dO)", prob, pieces);
+	Py_DECREF(pieces);
+	return result;
+}
+
+static PyObject*
+py_mpp(PyObject* self, PyObject* args)
+{
+	return mpp((count_substrings_fn)sarytrace_count_substrings, args,
+	           "ls#i|dii:mpp");
+}
+
+static PyObject*
+py_build_docs(PyObject* self, PyObject* args)
+{
+	char *data_name, *array_name, *offsets_name, *doc_name;
+	int offset_size, rv;
+
+	if (!PyArg_ParseTuple(args, "sssis:build_docs", &data_name, &array_name,
+	                      &offsets_name, &offset_size, &doc_name))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	rv = sarytrace_build_docs(data_name, array_name, offsets_name,
+	                          offset_size, doc_name);
+	Py_END_ALLOW_THREADS
+
+	if (rv < 0)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, doc_name);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_append(PyObject* self, PyObject* args)
+{
+	char *data_name, *array_name;
+	int old_size, rv;
+
+	if (!PyArg_ParseTuple(args, "ssi:append", &data_name, &array_name,
+	                      &old_size))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	rv = sarytrace_append(data_name, array_name, old_size);
+	Py_END_ALLOW_THREADS
+
+	if (rv < 0)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, array_name);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_build_lcp(PyObject* self, PyObject* args)
+{
+	char *data_name, *array_name, *lcp_name;
+	gboolean ok;
+
+	if (!PyArg_ParseTuple(args, "sss:build_lcp", &data_name, &array_name,
+	                      &lcp_name))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = sary_lcp_build(data_name, array_name, lcp_name);
+	Py_END_ALLOW_THREADS
+
+	if (!ok)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, lcp_name);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_build_bucket(PyObject* self, PyObject* args)
+{
+	char *data_name, *array_name, *bucket_name;
+	int width = SARY_BUCKET_DEFAULT_WIDTH;
+	gboolean ok;
+
+	if (!PyArg_ParseTuple(args, "sss|i:build_bucket", &data_name,
+	                      &array_name, &bucket_name, &width))
+		return NULL;
+	if (width < 1 || width > 3) {
+		PyErr_SetString(PyExc_ValueError, "width must be 1 to 3");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = sary_bucket_build(data_name, array_name, bucket_name, width);
+	Py_END_ALLOW_THREADS
+
+	if (!ok)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+		                                      bucket_name);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_fm_open(PyObject* self, PyObject* args)
+{
+	char *data_name, *fm_name;
+	fmindex_t *fm;
+
+	if (!PyArg_ParseTuple(args, "ss:fm_open", &data_name, &fm_name))
+		return NULL;
+
+	fm = fmindex_open(data_name, fm_name);
+	if (fm == NULL)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, fm_name);
+
+	/* return pointer to the handle */
+	return Py_BuildValue("l", (long)fm);
+}
+
+static PyObject*
+py_fm_close(PyObject* self, PyObject* args)
+{
+	fmindex_t *fm;
+
+	if (!PyArg_ParseTuple(args, "l:fm_close", (long*)&fm)) return NULL;
+
+	fmindex_close(fm);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_fm_numstreams(PyObject* self, PyObject* args)
+{
+	fmindex_t *fm;
+
+	if (!PyArg_ParseTuple(args, "l:fm_numstreams", (long*)&fm)) return NULL;
+
+	return PyInt_FromLong(fm->numstreams);
+}
+
+static PyObject*
+py_fm_count(PyObject* self, PyObject* args)
+{
+	fmindex_t *fm;
+	char *token;
+	int len;
+	int32_t first, count;
+
+	if (!PyArg_ParseTuple(args, "ls#:fm_count", (long*)&fm, &token, &len))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	count = fmindex_range(fm, token, len, &first);
+	Py_END_ALLOW_THREADS
+
+	return PyInt_FromLong(count);
+}
+
+static PyObject*
+py_fm_count_unique(PyObject* self, PyObject* args)
+{
+	fmindex_t *fm;
+	char *token;
+	int len;
+	int32_t count;
+
+	if (!PyArg_ParseTuple(args, "ls#:fm_count_unique", (long*)&fm,
+	                      &token, &len))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	count = fmindex_count_unique(fm, token, len);
+	Py_END_ALLOW_THREADS
+
+	if (count < 0)
+		return PyErr_NoMemory();
+	return PyInt_FromLong(count);
+}
+
+static PyObject*
+py_fm_count_many(PyObject* self, PyObject* args)
+{
+	fmindex_t *fm;
+	PyObject *tokens;
+	int unique = 0;
+
+	if (!PyArg_ParseTuple(args, "lO|i:fm_count_many", (long*)&fm,
+	                      &tokens, &unique))
+		return NULL;
+
+	return count_many((count_many_fn)fmindex_count_many, fm, tokens, unique);
+}
+
+static PyObject*
+py_fm_mpp(PyObject* self, PyObject* args)
+{
+	return mpp((count_substrings_fn)fmindex_count_substrings, args,
+	           "ls#i|dii:fm_mpp");
+}
+
+static PyObject*
+py_build_fm(PyObject* self, PyObject* args)
+{
+	char *data_name, *array_name, *offsets_name, *fm_name;
+	int offset_size, rv;
+
+	if (!PyArg_ParseTuple(args, "sssis:build_fm", &data_name, &array_name,
+	                      &offsets_name, &offset_size, &fm_name))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	rv = fmindex_build(data_name, array_name, offsets_name,
+	                   offset_size, fm_name);
+	Py_END_ALLOW_THREADS
+
+	if (rv < 0)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, fm_name);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyMethodDef sarytracec_funcs[] = {
+	{"open", (PyCFunction)py_open, METH_VARARGS,
+	 "open(data, array): open the suffix array of a streamfile"},
+	{"close", (PyCFunction)py_close, METH_VARARGS, "fillmein"},
+	{"has_docs", (PyCFunction)py_has_docs, METH_VARARGS,
+	 "True if a document index matching the array was found"},
+	{"numstreams", (PyCFunction)py_numstreams, METH_VARARGS, "fillmein"},
+	{"count", (PyCFunction)py_count, METH_VARARGS,
+	 "number of occurrences of a token"},
+	{"count_unique", (PyCFunction)py_count_unique, METH_VARARGS,
+	 "number of distinct streams containing a token"},
+	{"count_many", (PyCFunction)py_count_many, METH_VARARGS,
+	 "count_many(trace, tokens, unique=0): list of counts, one per token"},
+	{"mpp", (PyCFunction)py_mpp, METH_VARARGS,
+	 "mpp(trace, token, numstreams, minprob=1, minlen=1, unique=0): "
+	 "(prob, [(start, end), ...]), see tokensplit.mpp"},
+	{"build_docs", (PyCFunction)py_build_docs, METH_VARARGS,
+	 "build_docs(data, array, offsets, offset_size, docname)"},
+	{"append", (PyCFunction)py_append, METH_VARARGS,
+	 "append(data, array, old_size): merge appended text into the array"},
+	{"build_lcp", (PyCFunction)py_build_lcp, METH_VARARGS,
+	 "build_lcp(data, array, lcp): write the LCP table of an array"},
+	{"build_bucket", (PyCFunction)py_build_bucket, METH_VARARGS,
+	 "build_bucket(data, array, bkt, width=2): write the prefix bucket "
+	 "table of an array"},
+	{"fm_open", (PyCFunction)py_fm_open, METH_VARARGS,
+	 "fm_open(data, fmi): open the FM-index of a streamfile"},
+	{"fm_close", (PyCFunction)py_fm_close, METH_VARARGS, "fillmein"},
+	{"fm_numstreams", (PyCFunction)py_fm_numstreams, METH_VARARGS, "fillmein"},
+	{"fm_count", (PyCFunction)py_fm_count, METH_VARARGS,
+	 "number of occurrences of a token"},
+	{"fm_count_unique", (PyCFunction)py_fm_count_unique, METH_VARARGS,
+	 "number of distinct streams containing a token"},
+	{"fm_count_many", (PyCFunction)py_fm_count_many, METH_VARARGS,
+	 "fm_count_many(fm, tokens, unique=0): list of counts, one per token"},
+	{"fm_mpp", (PyCFunction)py_fm_mpp, METH_VARARGS,
+	 "fm_mpp(fm, token, numstreams, minprob=1, minlen=1, unique=0): "
+	 "as mpp"},
+	{"build_fm", (PyCFunction)py_build_fm, METH_VARARGS,
+	 "build_fm(data, array, offsets, offset_size, fmi)"},
+	{NULL}
+};
+
+void initsarytracec(void)
+{
+	Py_InitModule3(
+		"sarytracec",
+		sarytracec_funcs,
+		"token counts on streamfile suffix arrays and FM-indexes"
+	);
+}
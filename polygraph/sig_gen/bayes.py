@@ -19,6 +19,10 @@ import polygraph.util.sutil as sutil
 import sets
 import polygraph.sigprob.sigprob as sigprob
 import pickle
+try:
+    import polygraph.util.tokmatch as tokmatch
+except ImportError:
+    tokmatch = None
 
 def _float_eps(x):
     """
@@ -42,6 +46,16 @@ def _float_eps(x):
         eps = last_eps
     return eps 
 
+def token_score(prob_tok_giv_worm, prob_tok_giv_nworm):
+    """
+    Score of a token found in a fraction prob_tok_giv_worm of the
+    suspicious pool, with an estimated false positive rate of
+    prob_tok_giv_nworm, based on Bayes law.
+    """
+    part = prob_tok_giv_nworm \
+           / (.5*prob_tok_giv_worm + .5*prob_tok_giv_nworm) + 1e-300
+    return max(-1 * math.log(part)/math.log(10),0)
+
 class Bayes(sig_gen.SigGen):
     fpos_rate = {}
     trace_fpos_rate = {}
@@ -49,7 +63,7 @@ class Bayes(sig_gen.SigGen):
     nostats_fpos_rate = {}
 
     def __init__(self, pname="Bayes", fname="bayes",
-                minlen=2, maxlen=1000, kmin=2, kfrac=1.0, statsfile=None, prune=True, threshold_style='min', max_fpos=None, training_trace=None):
+                minlen=2, maxlen=1000, kmin=2, kfrac=1.0, statsfile=None, prune=True, threshold_style='min', max_fpos=None, training_trace=None, jobs=1):
         self.minlen = minlen
         self.maxlen = maxlen
         self.pname = pname
@@ -57,6 +71,8 @@ class Bayes(sig_gen.SigGen):
         self.token_scores = None
         self.tokens = None
         self.tokentree = None
+        self.scorer = None
+        self.coverage = None # token -> number of samples containing it
         # set to 'min' or 'biggest_jump' or 'bound' or a number
         self.threshold_style = threshold_style
         self.max_fpos = max_fpos # used for 'bound' threshold
@@ -66,6 +82,7 @@ class Bayes(sig_gen.SigGen):
         self.stats = None
         self.prune = prune
         self.training_trace = training_trace
+        self.jobs = jobs # threads scoring the training trace
         
         self.pos_samples = None
 
@@ -74,12 +91,22 @@ class Bayes(sig_gen.SigGen):
 
         if statsfile:
             try:
-                f = open(statsfile)
-                self.stats = pickle.load(f)
-                f.close()
+                import polygraph.trace_crunching.context_model as context_model
+                self.stats = context_model.load(statsfile)
             except TypeError:
                 self.stats = statsfile
 
+    def __getstate__(self):
+        # the compiled scorer is a handle; compile again when unpickled
+        state = self.__dict__.copy()
+        state['scorer'] = None
+        return state
+
+    def __setstate__(self, state):
+        self.__dict__.update(state)
+        if self.token_scores:
+            self.compile()
+
     def set_threshold(self):
         """
         Set the threshold for the signature.
@@ -131,17 +158,24 @@ class Bayes(sig_gen.SigGen):
 
         # Find Tmin, the threshold that achieves no more than the max
         # acceptable false positive rate.
-        import polygraph.trace_crunching.stream_trace as stream_trace
-        trace = stream_trace.StreamTrace(self.training_trace)
-        sample = trace.next()
-        while sample:
-            score = self.score(sample)
-            if len(top_neg_scores) < (self.max_fpos+1) or score > top_neg_scores[0]:
-                top_neg_scores.append(score)
-                top_neg_scores.sort()
-                if len(top_neg_scores) > (self.max_fpos + 1):
-                    del top_neg_scores[0]
+        if self.scorer:
+            # the trace in self.jobs shards, each keeping its highest
+            # scores, without the streams scoring below them
+            top_neg_scores = self.scorer.top_scores(self.training_trace,
+                                                    self.max_fpos + 1,
+                                                    self.jobs)
+        else:
+            import polygraph.trace_crunching.stream_trace as stream_trace
+            trace = stream_trace.StreamTrace(self.training_trace)
             sample = trace.next()
+            while sample is not None:
+                score = self.score(sample)
+                if len(top_neg_scores) < (self.max_fpos+1) or score > top_neg_scores[0]:
+                    top_neg_scores.append(score)
+                    top_neg_scores.sort()
+                    if len(top_neg_scores) > (self.max_fpos + 1):
+                        del top_neg_scores[0]
+                sample = trace.next()
         Tmin = top_neg_scores[0]
         Tmin += _float_eps(Tmin)
 
@@ -168,7 +202,20 @@ class Bayes(sig_gen.SigGen):
         # reduce false positives.
         self.threshold = Tmax * aggressiveness + Tmin * (1.0 - aggressiveness)
 
+    def compile(self):
+        """
+        Compile token_scores into a native scorer, which score and match
+        then use. It gives the same scores as the code below, in one
+        scan of the sample.
+        """
+        self.scorer = None
+        if tokmatch and self.token_scores:
+            self.scorer = tokmatch.BayesScorer(self.token_scores)
+
     def score(self, sample):
+        if self.scorer:
+            return self.scorer.score(sample)
+
         sample_score = 0
         sample_tokens = self.get_sample_occurrences(sample, False, False) 
 
@@ -193,33 +240,73 @@ class Bayes(sig_gen.SigGen):
         self.token_scores = None
         self.tokens = None
         self.tokentree = None
+        self.scorer = None
+        self.coverage = None
         self.pos_samples = pos_samples
 
+        # the suffix tree annotates each token with the samples it
+        # occurs in, which the coverage summary counts; pruning then
+        # drops the samples where it only occurs inside longer tokens,
+        # and the token is scored by the samples left. with kfrac < 1,
+        # the summary also counts the tokens of two samples or more, for
+        # BayesTree to find the tokens of a merged cluster from.
+        k = min(len(pos_samples), max(self.kmin, int(self.kfrac*len(pos_samples))))
+        summary_k = k
+        if self.kfrac < 1:
+            summary_k = min(k, 2)
         stree = sutil.STree(pos_samples)
-        tokens = stree.common_sub(self.minlen, min(len(pos_samples), max(self.kmin, int(self.kfrac*len(pos_samples)))), prune=self.prune)
+        tokens = stree.common_sub(self.minlen, summary_k, prune=False)
         stree = None
+        covered = {}
+        for (token, strings) in tokens.items():
+            covered[token] = len(strings)
+            if len(strings) < k:
+                del tokens[token]
+        if self.prune:
+            sutil.prune_counts(tokens, k)
         self.tokens = tokens.keys()
 #        self.tokentree = sutil.STree(tokens.keys())
+        if self.kfrac < 1:
+            # a token inside a longer one of as many samples tells
+            # BayesTree nothing more
+            self.coverage = {}
+            by_count = {}
+            for (token, count) in covered.items():
+                by_count.setdefault(count, []).append(token)
+            for group in by_count.values():
+                group.sort(lambda x,y: cmp(len(y), len(x)))
+                for i in xrange(len(group)):
+                    for longer in group[:i]:
+                        if group[i] in longer:
+                            break
+                    else:
+                        self.coverage[group[i]] = covered[group[i]]
+        else:
+            self.coverage = {}
+            for token in self.tokens:
+                self.coverage[token] = covered[token]
 
-        token_strings = self.get_all_occurrences(pos_samples)
         self.token_scores = {}
+        counts = {}
+        for (token, strings) in tokens.items():
+            counts[token] = len(strings)
 
         # calculate scores based on Bayes law
-        for token in token_strings.keys():
-            prob_tok_giv_worm = 1.0 * len(token_strings[token])  \
-                                / len(pos_samples)
-            prob_tok_giv_nworm = sig_gen.est_fpos_rate(token, 
-                                                       self.training_trace)
-            part = prob_tok_giv_nworm \
-                   / (.5*prob_tok_giv_worm + .5*prob_tok_giv_nworm) + 1e-300
-            token_score = max(-1 * math.log(part)/math.log(10),0)
-            if token_score > 0:
-                self.token_scores[token] = token_score
+        fpos_rates = dict(zip(self.tokens,
+                              sig_gen.est_fpos_rates(self.tokens,
+                                                     self.training_trace)))
+        for token in self.tokens:
+            prob_tok_giv_worm = 1.0 * counts[token] / len(pos_samples)
+            prob_tok_giv_nworm = fpos_rates[token]
+            score = token_score(prob_tok_giv_worm, prob_tok_giv_nworm)
+            if score > 0:
+                self.token_scores[token] = score
 
         # prevents a subtle bug later, when there turn out to be no
         # tokens kept. (i.e., they all had score 0)
         self.tokens = self.token_scores.keys()
 
+        self.compile()
         self.set_threshold()
 
         # Signature generation and signature matching code is tightly
@@ -227,8 +314,17 @@ class Bayes(sig_gen.SigGen):
         return [self]
 
     def match(self, sample):
+        if self.scorer:
+            return self.scorer.match(sample, self.threshold)
         return self.score(sample) >= self.threshold
 
+    def match_tokens(self):
+        # the score of a sample is a sum of the scores of tokens it
+        # contains
+        if self.token_scores is None or self.threshold is None:
+            return None
+        return (self.token_scores, self.threshold)
+
     def sig_str(self):
         sorted_tokens = self.token_scores.keys()
         sorted_tokens.sort(lambda x,y: cmp(self.token_scores[x], self.token_scores[y]))
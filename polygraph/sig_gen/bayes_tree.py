@@ -15,15 +15,17 @@ import sys
 import math
 import cluster
 import bayes
+import polygraph.util.sutil as sutil
 
 class BayesTree(sig_gen.SigGen):
-    def __init__(self, pname="Bayes with Tree", fname="bayes_tree", minlen=2, spec_threshold=40, min_cluster_size=3, kmin=2, kfrac=1.0, statsfile=None, threshold_style=None, max_fp_count=None, fpos_training_streams=None, bound_similarity=False, max_tokens_in_est=5):
+    def __init__(self, pname="Bayes with Tree", fname="bayes_tree", minlen=2, spec_threshold=40, min_cluster_size=3, kmin=2, kfrac=1.0, statsfile=None, threshold_style=None, max_fp_count=None, fpos_training_streams=None, bound_similarity=False, max_tokens_in_est=5, jobs=1):
         self.pname = pname
         self.fname = fname
         self.minlen = minlen
         self.spec_threshold = spec_threshold
         self.min_cluster_size = min_cluster_size
         self.clusters = []
+        self.pos_samples = None
         self.statsfile = statsfile
         self.kmin = kmin
         self.kfrac = kfrac
@@ -32,46 +34,27 @@ class BayesTree(sig_gen.SigGen):
         self.fpos_training_streams = fpos_training_streams
         self.bound_similarity = bound_similarity
         self.max_tokens_in_est = max_tokens_in_est
+        self.jobs = jobs # processes comparing sample pairs
 
         if statsfile:
             try:
-                f = open(statsfile)
-                import pickle
-                self.statsfile = pickle.load(f)
-                f.close()
+                import polygraph.trace_crunching.context_model as context_model
+                self.statsfile = context_model.load(statsfile)
             except TypeError:
                 self.statsfile = statsfile
 
 
     def train(self, pos_samples):
-            def sig_gen_cb(left, right):
-                samples = [pos_samples[s] for s in left['samples'] + 
-                          right['samples']]
-                new_sig = bayes.Bayes(minlen=self.minlen, 
-                                      kmin=self.kmin, kfrac=self.kfrac, 
-                                      prune=True, 
-                                      statsfile=self.statsfile,
-                                      threshold_style='min',
-                                      max_fpos=self.max_fp_count,
-                                      training_trace=self.fpos_training_streams)
-                                  
-                new_sig.train(samples)
-#                score = min([new_sig.score(s) for s in samples])
-                score = new_sig.threshold
-                token_scores = new_sig.token_scores.values()
-                if self.max_tokens_in_est:
-                    token_scores.sort(lambda x,y: cmp(y,x))
-                    score = sum(token_scores[:self.max_tokens_in_est])
-                else:
-                    score = sum(token_scores)
-                return (new_sig, score)
+            self.pos_samples = pos_samples
 
             import cluster
-            self.clusters = cluster.cluster(sig_gen_cb, self.spec_threshold, 
+            self.clusters = cluster.cluster(self.merge_sig, self.spec_threshold, 
                                    pos_samples, 
                                    max_fp_count=self.max_fp_count,
                                    fpos_training_streams=self.fpos_training_streams,
-                                   bound_similarity=self.bound_similarity)
+                                   bound_similarity=self.bound_similarity,
+                                   jobs=self.jobs,
+                                   estimate_cb=self.estimate_merge)
 
             if self.threshold_style != 'min':
                 for c in self.clusters:
@@ -84,6 +67,143 @@ class BayesTree(sig_gen.SigGen):
                     sigs.append(c['sig'])
             return sigs
 
+    def merge_sig(self, left, right):
+        """
+        The signature of the samples of clusters left and right, and
+        its merge score.
+        """
+        samples = [self.pos_samples[s] for s in left['samples'] + 
+                  right['samples']]
+        new_sig = bayes.Bayes(minlen=self.minlen, 
+                              kmin=self.kmin, kfrac=self.kfrac, 
+                              prune=True, 
+                              statsfile=self.statsfile,
+                              threshold_style='min',
+                              max_fpos=self.max_fp_count,
+                              training_trace=self.fpos_training_streams)
+                          
+        new_sig.train(samples)
+#        score = min([new_sig.score(s) for s in samples])
+        score = new_sig.threshold
+        token_scores = new_sig.token_scores.values()
+        if self.max_tokens_in_est:
+            token_scores.sort(lambda x,y: cmp(y,x))
+            score = sum(token_scores[:self.max_tokens_in_est])
+        else:
+            score = sum(token_scores)
+        return (new_sig, score)
+
+    def _coverage(self, c, token):
+        # number of samples of cluster c containing token: from the
+        # summary its signature keeps of its tokens, or counted once
+        # and kept with the cluster.
+        if c['sig'] and c['sig'].coverage.has_key(token):
+            return c['sig'].coverage[token]
+        counts = c['cb_data'].setdefault('coverage', {})
+        if not counts.has_key(token):
+            count = 0
+            for s in c['samples']:
+                if token in self.pos_samples[s]:
+                    count += 1
+            counts[token] = count
+        return counts[token]
+
+    def _token_strings(self, c):
+        # strings holding every token of cluster c: the tokens of its
+        # signature, or its sample.
+        if c['sig']:
+            return c['sig'].coverage.keys()
+        return [self.pos_samples[c['samples'][0]]]
+
+    def _summary_counts(self, left, right):
+        # the number of samples of clusters left and right containing
+        # each token of their summaries, or a common substring of them:
+        # in each cluster, the largest count of its summary tokens
+        # containing it, if any, and otherwise at most one sample.
+        strings = []
+        owners = [] # (cluster, count) of each string
+        for (j, c) in ((0, left), (1, right)):
+            if c['sig']:
+                for (token, count) in c['sig'].coverage.items():
+                    strings.append(token)
+                    owners.append((j, count))
+            else:
+                strings.append(self.pos_samples[c['samples'][0]])
+                owners.append((j, 1))
+        stree = sutil.STree(strings)
+        candidates = stree.common_sub(self.minlen, 2, prune=False)
+        for token in strings:
+            if len(token) >= self.minlen:
+                candidates[token] = 1
+        token_counts = {}
+        for token in candidates.keys():
+            counts = [0, 0]
+            for i in stree.find(token).keys():
+                (j, count) = owners[i]
+                counts[j] = max(counts[j], count)
+            for (j, c) in ((0, left), (1, right)):
+                if not counts[j] and c['sig']:
+                    counts[j] = 1
+            token_counts[token] = counts[0] + counts[1]
+        stree = None
+        return token_counts
+
+    def estimate_merge(self, left, right):
+        """
+        Estimate the merge score of clusters left and right, so that
+        the signature is only trained for the merges that come up.
+        When a token of the merged cluster must occur in all of its
+        samples, it is a substring of a token of each cluster, so the
+        candidates are the tokens and the substrings they have in
+        common. Otherwise it may occur in only some samples of a
+        cluster, so the summary of a cluster trained with kfrac < 1
+        keeps every token of two of its samples or more: a token of the
+        merged cluster is then inside a summary token of a cluster it
+        occurs twice in, or a substring of the sample of a single sample
+        cluster, and is counted by the summary tokens containing it.
+        The candidates are scored as train would, but by the number of
+        samples containing them, which is never less than the count
+        train scores by, so that a merge is not given up for an
+        estimate that is too low.
+        """
+        n = len(left['samples']) + len(right['samples'])
+        k = min(n, max(self.kmin, int(self.kfrac*n)))
+        if k < n:
+            if k < 3 and left['sig'] and right['sig']:
+                # a token of one sample of each cluster is in neither
+                # summary
+                return self.merge_sig(left, right)[1]
+            token_counts = self._summary_counts(left, right)
+        else:
+            strings = self._token_strings(left) + self._token_strings(right)
+            stree = sutil.STree(strings)
+            candidates = stree.common_sub(self.minlen, 2, prune=True)
+            stree = None
+            for c in (left, right):
+                if c['sig']:
+                    for token in c['sig'].coverage.keys():
+                        candidates[token] = 1
+            token_counts = {}
+            for token in candidates.keys():
+                token_counts[token] = (self._coverage(left, token) +
+                                       self._coverage(right, token))
+        for token in token_counts.keys():
+            if token_counts[token] < k:
+                del token_counts[token]
+        tokens = token_counts.keys()
+        fpos_rates = sig_gen.est_fpos_rates(tokens,
+                                          self.fpos_training_streams)
+        token_scores = []
+        for (token, fpos_rate) in zip(tokens, fpos_rates):
+            score = bayes.token_score(1.0 * token_counts[token] / n,
+                                      fpos_rate)
+            if score > 0:
+                token_scores.append(score)
+        if self.max_tokens_in_est:
+            token_scores.sort(lambda x,y: cmp(y,x))
+            token_scores = token_scores[:self.max_tokens_in_est]
+        return sum(token_scores)
+
     def match(self, sample):
         for c in self.clusters:
             if len(c['samples']) >= self.min_cluster_size and c['sig'].match(sample):
@@ -99,3 +219,39 @@ class BayesTree(sig_gen.SigGen):
 
     def __str__(self):
         return self.sig_str()
+
+if __name__ == "__main__":
+    # check that estimate_merge is never below the score of the merge
+    # it estimates, with kfrac < 1 as well, on samples read one per
+    # file: a growing cluster of the first samples is merged with each
+    # of the rest.
+    if len(sys.argv) < 5:
+        print "Usage: %s streamfile kfrac file1 file2 file3..." % sys.argv[0]
+        sys.exit(1)
+    samples = []
+    for fname in sys.argv[3:]:
+        f = open(fname)
+        samples.append(f.read())
+        f.close()
+
+    tree = BayesTree(kfrac=float(sys.argv[2]),
+                     fpos_training_streams=sys.argv[1])
+    tree.pos_samples = samples
+    def leaf(i):
+        return {'samples': [i], 'sig': None, 'cb_data': {}}
+
+    low = 0
+    merged = leaf(0)
+    for i in xrange(1, len(samples)):
+        for j in xrange(i, len(samples)):
+            estimate = tree.estimate_merge(merged, leaf(j))
+            (sig, score) = tree.merge_sig(merged, leaf(j))
+            print merged['samples'], j, estimate, score
+            if estimate < score:
+                print "estimate too low"
+                low += 1
+        (sig, score) = tree.merge_sig(merged, leaf(i))
+        merged = {'samples': merged['samples'] + [i], 'sig': sig,
+                  'cb_data': {}}
+    if low:
+        sys.exit(1)
@@ -9,7 +9,9 @@
 #  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
 #  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
 import sets
+import heapq
 import polygraph.trace_crunching.stream_trace as stream_trace
+import polygraph.util.forkpool as forkpool
 
 # clusters are dictionaries with keys:
 # 'samples' = []	list of incoorporated sample indices
@@ -40,36 +42,135 @@ def graph_clusters(clusters):
 
     return graph
 
+def count_fpos(sigs, max_fp_count, fpos_training_streams):
+    """
+    The number of streams of fpos_training_streams each signature of
+    sigs matches, counted in one pass over them. A signature is no
+    longer tried once it passes max_fp_count, so its count then is
+    max_fp_count + 1, and the pass ends when every signature has.
+    """
+    counts = [0] * len(sigs)
+    active = range(len(sigs))
+    st = stream_trace.StreamTrace(fpos_training_streams)
+    sample = st.next()
+    while sample is not None and active:
+        still_active = []
+        for i in active:
+            if sigs[i].match(sample):
+                counts[i] += 1
+                if counts[i] > max_fp_count:
+                    continue
+            still_active.append(i)
+        active = still_active
+        sample = st.next()
+    return counts
+
+def backtrack_all(max_fp_count, fpos_training_streams, clusters, min_cluster_size):
+    """
+    backtrack every cluster of clusters, with the false positives of
+    each cluster below them all counted in a single pass over the
+    training streams.
+    """
+    # every cluster that backtracking may check
+    checked = []
+    todo = list(clusters)
+    while todo:
+        c = todo.pop()
+        if len(c['samples']) < min_cluster_size:
+            continue
+        checked.append(c)
+        if c['left']:
+            todo.append(c['left'])
+            todo.append(c['right'])
+    counts = count_fpos([c['sig'] for c in checked], max_fp_count,
+                        fpos_training_streams)
+    fp_counts = {}
+    for (c, count) in zip(checked, counts):
+        fp_counts[id(c)] = count
+
+    def decide(cluster):
+        if len(cluster['samples']) < min_cluster_size:
+            return [cluster]
+        if fp_counts[id(cluster)] <= max_fp_count:
+            # fp rate was low. no need to backtrack
+            print "Cluster OK"
+            return [cluster]
+
+        # fp rate was too high. unmerge, and backtrack each child
+        print "Splitting cluster"
+        return decide(cluster['left']) + decide(cluster['right'])
+
+    roots = []
+    for c in clusters:
+        roots.extend(decide(c))
+    return roots
+
 def backtrack(max_fp_count, fpos_training_streams, cluster, min_cluster_size):
     """
     If false positive rate of cluster exceeds max_fp_count, undo the
     the last merge and call 'backtrack' on both resulting clusters.
     """
+    return backtrack_all(max_fp_count, fpos_training_streams, [cluster],
+                         min_cluster_size)
 
-    if len(cluster['samples']) < min_cluster_size:
-        return [cluster]
+class MergePool(object):
+    """
+    The potential merges of cluster(), best first: a heap of pairs, and
+    for each cluster the pairs it is in, so that the pairs of merged
+    clusters are dropped without looking at the others. A dropped pair
+    stays in the heap, marked dead, until it comes to the top.
 
-    st = stream_trace.StreamTrace(fpos_training_streams)
-    count = 0
-    sample = st.next()
-    while (sample):
-        if cluster['sig'].match(sample):
-            count += 1
-            if count > max_fp_count: break
-        sample = st.next()
-    else:
-        # fp rate was low. no need to backtrack
-        print "Cluster OK"
-        return [cluster]
-
-    # fp rate was too high. unmerge, and backtrack each child
-    print "Splitting cluster"
-    st = None
-    rv = backtrack(max_fp_count, fpos_training_streams, cluster['left'], min_cluster_size)
-    rv.extend(backtrack(max_fp_count, fpos_training_streams, cluster['right'], min_cluster_size))
-    return rv
-
-def cluster(sig_generation_cb, min_score, samples, bound_similarity=False, cluster_seeds=None, max_fp_count=None, fpos_training_streams=None, min_cluster_size=3):
+    Pairs of equal scores come out latest added first, as they did
+    from the end of the sorted list this replaces.
+    """
+    def __init__(self):
+        self.heap = []
+        self.adjacent = {} # cluster -> {pair seq: pair}
+        self.count = 0
+        self.seq = 0
+
+    def __len__(self):
+        return self.count
+
+    def push(self, pair):
+        self.seq += 1
+        pair['seq'] = self.seq
+        pair['dead'] = False
+        heapq.heappush(self.heap, (-pair['score'], -pair['seq'], pair))
+        for c in (pair['left'], pair['right']):
+            self.adjacent.setdefault(c, {})[pair['seq']] = pair
+        self.count += 1
+
+    def _unlink(self, pair):
+        pair['dead'] = True
+        for c in (pair['left'], pair['right']):
+            if self.adjacent.has_key(c):
+                del self.adjacent[c][pair['seq']]
+        self.count -= 1
+
+    def _clean(self):
+        while self.heap and self.heap[0][2]['dead']:
+            heapq.heappop(self.heap)
+
+    def pop(self):
+        "The best pair, removed from the pool."
+        self._clean()
+        pair = heapq.heappop(self.heap)[2]
+        self._unlink(pair)
+        return pair
+
+    def best_score(self):
+        self._clean()
+        return self.heap[0][2]['score']
+
+    def remove_cluster(self, c):
+        "Removes the pairs of cluster c, and returns them."
+        pairs = self.adjacent.pop(c, {}).values()
+        for pair in pairs:
+            self._unlink(pair)
+        return pairs
+
+def cluster(sig_generation_cb, min_score, samples, bound_similarity=False, cluster_seeds=None, max_fp_count=None, fpos_training_streams=None, min_cluster_size=3, jobs=1, estimate_cb=None):
     """
     Perform hierarchical clustering.
 
@@ -82,10 +183,16 @@ def cluster(sig_generation_cb, min_score, samples, bound_similarity=False, clust
     max_fp_count=None
     fpos_training_streams=None
     min_cluster_size=3
+    jobs=1            -- processes comparing the initial sample pairs
+    estimate_cb=None  -- estimate_cb(left, right) estimates the merge score
+                         of a merged cluster with another one without
+                         generating its signature, which is generated
+                         when the pair comes up for merging, as with
+                         bound_similarity
     """
 
     clusters = [] # sequence of all clusters
-    cluster_pairs = [] # sequence of potential merges, sorted by score
+    cluster_pairs = MergePool() # potential merges, best first
     unmerged_clusters = sets.Set(range(len(samples)))
 
     # initialize clusters
@@ -104,17 +211,29 @@ def cluster(sig_generation_cb, min_score, samples, bound_similarity=False, clust
     if not cluster_seeds:
         cluster_seeds = range(len(clusters))
     print "*" * 10, "Comparing all sample pairs", "*" * 10
+    pairs = []
     for i in cluster_seeds:
         for j in xrange(i+1, len(clusters)):
-            (sig, score) = sig_generation_cb(clusters[i], clusters[j])
-            print i,j,score,
-            if score >= min_score:
-                cluster_pairs.append({'left': i, 'right': j,'score': score, 'sig': sig})
-                print "added to merge pool"
-            else:
-                print "too low; not added"
+            pairs.append((i, j))
 
-    cluster_pairs.sort(lambda x,y: cmp(x['score'], y['score']))
+    # the pairs are compared by jobs worker processes, which only send
+    # back the signatures of pairs good enough to merge. a signature
+    # that cannot be sent back comes back as None, and is generated
+    # again if the pair is ever merged, as with bound_similarity.
+    def compare_pair((i, j)):
+        (sig, score) = sig_generation_cb(clusters[i], clusters[j])
+        if score < min_score:
+            sig = None
+        return (sig, score)
+    results = forkpool.map_forked(compare_pair, pairs, jobs)
+
+    for ((i, j), (sig, score)) in zip(pairs, results):
+        print i,j,score,
+        if score >= min_score:
+            cluster_pairs.push({'left': i, 'right': j,'score': score, 'sig': sig})
+            print "added to merge pool"
+        else:
+            print "too low; not added"
 
     # it's merge time!
     print "*" * 10, "Merging Clusters", "*" * 10
@@ -148,11 +267,10 @@ def cluster(sig_generation_cb, min_score, samples, bound_similarity=False, clust
             if new_score < min_score:
                 print "too low; dropped"
                 continue
-            if len(cluster_pairs) > 0 and new_score < cluster_pairs[-1]['score']:
+            if len(cluster_pairs) > 0 and new_score < cluster_pairs.best_score():
                 pair['sig'] = new_sig
                 pair['score'] = new_score
-                cluster_pairs.append(pair)
-                cluster_pairs.sort(lambda x,y: cmp(x['score'], y['score']))
+                cluster_pairs.push(pair)
                 print "not best current merge; back into merge pool"
                 continue
 
@@ -170,58 +288,54 @@ def cluster(sig_generation_cb, min_score, samples, bound_similarity=False, clust
         unmerged_clusters.remove(right_i)
         unmerged_clusters.add(new_cluster['index'])
 
-        # figure out which pairs need to be deleted, and what new
-        # pairs should be computed
-        pairs_to_delete = []
+        # drop the pairs of the merged clusters, and figure out what
+        # new pairs should be computed. the pairs are visited in the
+        # order of the sorted list they used to be in, which gives
+        # merges_to_compute the same order of keys.
         merges_to_compute = {}
-        for i in xrange(len(cluster_pairs)):
-            if cluster_pairs[i]['left'] == left_i or cluster_pairs[i]['left'] == right_i: 
-                pairs_to_delete.append(i)
-                if merges_to_compute.has_key(cluster_pairs[i]['right']):
-                    merges_to_compute[cluster_pairs[i]['right']] = \
-                    min(merges_to_compute[cluster_pairs[i]['right']], cluster_pairs[i]['score'])
+        pairs = cluster_pairs.remove_cluster(left_i) + \
+                cluster_pairs.remove_cluster(right_i)
+        pairs.sort(lambda x,y: cmp((x['score'], x['seq']), (y['score'], y['seq'])))
+        for pair in pairs:
+            if pair['left'] == left_i or pair['left'] == right_i: 
+                if merges_to_compute.has_key(pair['right']):
+                    merges_to_compute[pair['right']] = \
+                    min(merges_to_compute[pair['right']], pair['score'])
                 else:
-                    merges_to_compute[cluster_pairs[i]['right']] = \
-                    cluster_pairs[i]['score']
-            if cluster_pairs[i]['right'] == left_i or cluster_pairs[i]['right'] == right_i:
-                pairs_to_delete.append(i)
-                if merges_to_compute.has_key(cluster_pairs[i]['left']):
-                    merges_to_compute[cluster_pairs[i]['left']] = \
-                    min(merges_to_compute[cluster_pairs[i]['left']], cluster_pairs[i]['score'])
+                    merges_to_compute[pair['right']] = pair['score']
+            if pair['right'] == left_i or pair['right'] == right_i:
+                if merges_to_compute.has_key(pair['left']):
+                    merges_to_compute[pair['left']] = \
+                    min(merges_to_compute[pair['left']], pair['score'])
                 else:
-                    merges_to_compute[cluster_pairs[i]['left']] = \
-                    cluster_pairs[i]['score']
-
-        # delete the invalid pairs
-        pairs_to_delete.reverse()
-        for i in pairs_to_delete:
-            del cluster_pairs[i]
-                
+                    merges_to_compute[pair['left']] = pair['score']
+
         # compute merge pairs for new cluster
         for i in merges_to_compute.keys():
             if bound_similarity:
                 score = merges_to_compute[i]
                 sig = None
+            elif estimate_cb:
+                score = estimate_cb(clusters[i], new_cluster)
+                sig = None
             else:
                 (sig, score) = sig_generation_cb(clusters[i], new_cluster)
             print new_cluster['index'],i,score,
             if score >= min_score:
-                cluster_pairs.append({'left': i, 
-                                      'right': new_cluster['index'],
-                                      'score': score, 'sig': sig})
+                cluster_pairs.push({'left': i, 
+                                    'right': new_cluster['index'],
+                                    'score': score, 'sig': sig})
                 print "added to merge pool"
             else:
                 print "too low; not added"
 
-        # re-sort pairs
-        cluster_pairs.sort(lambda x,y: cmp(x['score'], y['score']))
-
 
     # measure false positives in training data and unmerge as necessary
     roots = []
     if fpos_training_streams:
-        for cluster in unmerged_clusters:
-            roots.extend(backtrack(max_fp_count, fpos_training_streams, clusters[cluster], min_cluster_size))
+        roots = backtrack_all(max_fp_count, fpos_training_streams,
+                              [clusters[i] for i in unmerged_clusters],
+                              min_cluster_size)
     else:
         for i in unmerged_clusters:
             roots.append(clusters[i])
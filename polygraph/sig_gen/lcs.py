@@ -43,6 +43,11 @@ class LCS(sig_gen.SigGen):
     def match(self, sample):
         return sample.find(self.sig) >= 0
 
+    def match_tokens(self):
+        if not self.sig:
+            return ({}, 0.0)
+        return ({self.sig: 1.0}, 1.0)
+
 def test():
     samples = []
     samples.append("gagghua one afehauifheau two heuighriga three")
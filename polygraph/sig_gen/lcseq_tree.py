@@ -16,6 +16,10 @@ import re
 #import polygraph.sigprob.sigprob as sigprob
 import math
 import cluster
+try:
+    import polygraph.util.tokmatch as tokmatch
+except ImportError:
+    tokmatch = None
 
 #def tuple_match(tuple_sig, sample):
 #    pos = 0
@@ -30,8 +34,26 @@ class TupleSig(sig_gen.Sig):
     def __init__(self, lcs, tuplesig):
         self.lcs = lcs
         self.tuplesig = tuplesig
+        self.pattern = None # compiled when first matched
+
+    def __getstate__(self):
+        # the compiled pattern is a handle; compile again when matched
+        state = self.__dict__.copy()
+        state['pattern'] = None
+        return state
+
+    def __setstate__(self, state):
+        self.__dict__.update(state)
+        self.pattern = None
 
     def match(self, sample):
+        if tokmatch:
+            if self.pattern is None:
+                n = len(self.tuplesig)
+                self.pattern = tokmatch.GapPattern(self.tuplesig, [0] * n,
+                                                   [True] * n)
+            return self.pattern.match(sample)
+
         pos = 0
         for token in self.tuplesig:
             new_pos = sample.find(token, pos)
@@ -40,21 +62,120 @@ class TupleSig(sig_gen.Sig):
             pos = new_pos + len(token)
         return True
 
+    def match_tokens(self):
+        tokens = {}
+        for token in self.tuplesig:
+            if token:
+                tokens[token] = 1.0
+        return (tokens, float(len(tokens)))
+
     def __str__(self):
         return self.tuplesig.__repr__()
 
+_regex_escapes = {'t': '\t', 'n': '\n', 'r': '\r'}
+_fixed_gap = re.compile(r'\.\{(\d+)\}')
+
+def _regex_to_gaps(pattern):
+    """
+    A regex of LCSeqTree._lcs_to_regex, literal tokens escaped with
+    sig_gen.regex_esc between .*, .{n} and .*.{n} gaps, as (tokens,
+    skips, variable) for a tokmatch.GapPattern matching what re.match
+    does: token i comes skips[i] bytes after the one before, or at
+    least that many if variable[i]. None for any other regex.
+    """
+    tokens = []
+    skips = []
+    variable = []
+    token = []
+    (skip, var) = (0, False)
+    i = 0
+    while i < len(pattern):
+        c = pattern[i]
+        if c == '.':
+            if token:
+                tokens.append(''.join(token))
+                skips.append(skip)
+                variable.append(var)
+                token = []
+                (skip, var) = (0, False)
+            m = _fixed_gap.match(pattern, i)
+            if pattern[i+1:i+2] == '*':
+                var = True
+                i += 2
+            elif m:
+                skip += int(m.group(1))
+                i = m.end()
+            else:
+                return None
+        elif c == '\\':
+            e = pattern[i+1:i+2]
+            if _regex_escapes.has_key(e):
+                token.append(_regex_escapes[e])
+                i += 2
+            elif e == 'x' and re.match('[0-9a-fA-F]{2}$',
+                                       pattern[i+2:i+4]):
+                token.append(chr(int(pattern[i+2:i+4], 16)))
+                i += 4
+            elif e and not e.isalnum():
+                token.append(e)
+                i += 2
+            else:
+                return None
+        elif c.isalnum():
+            token.append(c)
+            i += 1
+        else:
+            return None
+    if token:
+        tokens.append(''.join(token))
+        skips.append(skip)
+        variable.append(var)
+    elif skip:
+        # a trailing .{n} still needs n more bytes
+        return None
+    return (tokens, skips, variable)
+
 class RegexSig(sig_gen.Sig):
     def __init__(self, pattern):
         self.regex = re.compile(pattern, re.DOTALL)
+        # the same pattern, matched in one pass by tokmatch.GapPattern
+        # rather than by backtracking in re
+        self.gaps = _regex_to_gaps(pattern)
+        self.pattern = None # compiled when first matched
+
+    def __getstate__(self):
+        # the compiled pattern is a handle; compile again when matched
+        state = self.__dict__.copy()
+        state['pattern'] = None
+        return state
+
+    def __setstate__(self, state):
+        self.__dict__.update(state)
+        if not state.has_key('gaps'):
+            self.gaps = _regex_to_gaps(self.regex.pattern)
+        self.pattern = None
 
     def match(self, sample):
+        if tokmatch and self.gaps is not None:
+            if self.pattern is None:
+                (tokens, skips, variable) = self.gaps
+                self.pattern = tokmatch.GapPattern(tokens, skips, variable)
+            return self.pattern.match(sample)
         return self.regex.match(sample)
 
+    def match_tokens(self):
+        if self.gaps is None:
+            return None
+        tokens = {}
+        for token in self.gaps[0]:
+            tokens[token] = 1.0
+        return (tokens, float(len(tokens)))
+
     def __str__(self):
         return self.regex.pattern.__repr__()
 
 class LCSeqTree(sig_gen.SigGen):
-    def __init__(self, pname="Longest Common Subsequence with Tree", fname="lcseq", gap_penalty=0.8, tokenize_pairs=True, tokenize_all=False, k=5, kfrac=0, minlen=2, use_fixed_gaps=False, do_cluster=True, spec_threshold=40, min_cluster_size=3, max_fp_count=None, fpos_training_streams=None, statsfile=None, bound_similarity=False, max_tokens_in_est=5):
+    def __init__(self, pname="Longest Common Subsequence with Tree", fname="lcseq", gap_penalty=0.8, tokenize_pairs=True, tokenize_all=False, k=5, kfrac=0, minlen=2, use_fixed_gaps=False, do_cluster=True, spec_threshold=40, min_cluster_size=3, max_fp_count=None, fpos_training_streams=None, statsfile=None, bound_similarity=False, max_tokens_in_est=5, jobs=1):
         self.regex = None
         self.pname = pname
         self.fname = fname
@@ -75,6 +196,7 @@ class LCSeqTree(sig_gen.SigGen):
         self.fpos_training_streams = fpos_training_streams
         self.bound_similarity = bound_similarity
         self.max_tokens_in_est = max_tokens_in_est
+        self.jobs = jobs # processes comparing sample pairs
 
         if use_fixed_gaps:
             raise NotImplementedError('use_fixed_gaps option is currently broken.')
@@ -196,9 +318,8 @@ class LCSeqTree(sig_gen.SigGen):
 
                 # calculate a score for the resulting signature
                 scores = []
-                for token in t:
+                for prob in sig_gen.est_fpos_rates(t, self.fpos_training_streams):
 #                    prob = sigprob.regex_prob(token, 1000, stats=self.statsfile)[-1]
-                    prob = sig_gen.est_fpos_rate(token, self.fpos_training_streams)
                     scores.append(- math.log(prob + 1e-300)/math.log(10))
 
                 # using all the token scores overly favors signatures
@@ -216,7 +337,8 @@ class LCSeqTree(sig_gen.SigGen):
                               pos_samples, max_fp_count = self.max_fp_count,
                               fpos_training_streams=self.fpos_training_streams,
                               min_cluster_size=self.min_cluster_size,
-                              bound_similarity=self.bound_similarity)
+                              bound_similarity=self.bound_similarity,
+                              jobs=self.jobs)
 
             # return the tuple signatures for the final clusters
             self.tuple_list = []
@@ -33,6 +33,15 @@ class Sig(object):
         "Return whether current signature matches the sample"
         raise NotImplementedError
 
+    def match_tokens(self):
+        """
+        (weights, need): a sample can only match if the weights of the
+        distinct tokens in weights that it contains add up to need.
+        None if there is no such condition. Lets a SignatureSet (see
+        util/tokmatch.py) screen samples for many signatures at once.
+        """
+        return None
+
     def __str__(self):
         raise NotImplementedError
 
@@ -56,7 +65,27 @@ def regex_esc(s):
             escaped.append("\\x%02x" % ord(c))
     return ''.join(escaped)
 
-estd_fpos_rate = {} # memoize
+# estimates of est_fpos_rates, see set_fpos_store
+fpos_store = None
+
+# names of the ways est_fpos_rates estimates, kept with the estimates:
+# change them with the estimators so that older estimates go unused
+TRACE_ESTIMATOR = 'tokensplit3+maxcontext10'
+STATS_ESTIMATOR = 'markov1000'
+
+def set_fpos_store(filename=None, entries=None):
+    """
+    Keep the estimates of est_fpos_rates in the store file filename,
+    shared by every process using it, as well as in memory; or only
+    in memory if filename is None. entries is the number of estimates
+    a new store file has room for.
+    """
+    global fpos_store
+    import polygraph.util.fpstore as fpstore
+    if entries is None:
+        entries = fpstore.FILE_ENTRIES
+    fpos_store = fpstore.EstimateStore(filename, file_entries=entries)
+
 def est_fpos_rate(token, trace=None, stats=None):
     """
     Estimate false positive rate of a single-token signature.
@@ -66,30 +95,86 @@ def est_fpos_rate(token, trace=None, stats=None):
     of these estimates are strictly equal to or higher than the actual 
     fraction of streams that 'token' occurs in within the trace.
     """
+    return est_fpos_rates([token], trace, stats)[0]
 
-    global estd_fpos_rate
-
-    # if we don't have it cached, figure it out
-    if not (estd_fpos_rate.has_key(trace) and estd_fpos_rate[trace].has_key(token)):
-        # make sure there's a dictionary for this trace
-        if not estd_fpos_rate.has_key(trace):
-            estd_fpos_rate[trace] = {}
-
-        # use most pessimistic (highest) estimate 
-        import polygraph.sigprob.tokensplit as tokensplit
-        import polygraph.sigprob.sigprob as sigprob
-        if trace:
-            split_prob = tokensplit.mpp(token, trace, minlen=3)[0]
-            stat_prob = tokensplit.maxcontextprob(token, trace)[0]
-            estd_fpos_rate[trace][token] = max(split_prob, stat_prob)
-        else:
-            estd_fpos_rate[trace][token] = sigprob.token_prob(token, 1000, stats=stats)[-1]
-    rv = estd_fpos_rate[trace][token]
+# bound on the substrings counted together by est_fpos_rates
+EST_BATCH_SUBSTRINGS = 1 << 18
+# longest context of the trace model used by est_fpos_rates
+EST_CONTEXT_LEN = 10
+
+def est_fpos_rates(tokens, trace=None, stats=None):
+    """
+    est_fpos_rate of every token, in a list.
+
+    The tokens not estimated before are estimated together: the
+    substrings of all of them that the trace model looks at are
+    counted in the trace at once, and tokens sharing a prefix share
+    the work of estimating it (see sigprob.token_final_probs). The
+    split estimate of each token is computed natively (see
+    TraceSary.mpp).
+
+    Estimates are kept in fpos_store by the identity of the trace or
+    stats file, so they are reused for as long as it is unchanged.
+    """
+
+    import polygraph.util.fpstore as fpstore
+    if fpos_store is None:
+        set_fpos_store()
+
+    if trace:
+        source = fpstore.file_identity(trace + '/data')
+        estimator = TRACE_ESTIMATOR
+    else:
+        # stats loaded from a pickle have no file to name them by
+        source = fpstore.file_identity(getattr(stats, 'model_name', ''))
+        estimator = STATS_ESTIMATOR
+
+    # reuse the estimates we have
+    rates = fpos_store.get_many(source, estimator, tokens)
+    todo = []
+    for token in tokens:
+        if not rates.has_key(token):
+            rates[token] = None
+            todo.append(token)
+
+    # otherwise figure them out, using the most pessimistic (highest)
+    # estimate
+    import polygraph.sigprob.tokensplit as tokensplit
+    import polygraph.sigprob.sigprob as sigprob
+    new_rates = {}
+    if trace:
+        import polygraph.trace_crunching.sarray_trace as sarray_trace
+        ts = sarray_trace.open_trace(trace)
+        while todo:
+            batch = []
+            substrings = {}
+            while todo and (not batch or
+                            len(substrings) < EST_BATCH_SUBSTRINGS):
+                token = todo.pop(0)
+                batch.append(token)
+                for start in xrange(len(token)):
+                    for end in xrange(start+1,
+                                      min(len(token),
+                                          start+EST_CONTEXT_LEN)+1):
+                        substrings[token[start:end]] = 1
+            substrings = substrings.keys()
+            counts = dict(zip(substrings, ts.token_counts(substrings)))
+            substrings = None
+
+            stat_probs = tokensplit.maxcontextprobs(batch, trace,
+                                                    maxlen=EST_CONTEXT_LEN,
+                                                    counts=counts)
+            counts = None
+            for (token, stat_prob) in zip(batch, stat_probs):
+                split_prob = ts.mpp(token, 1, 3)[0]
+                new_rates[token] = max(split_prob, stat_prob)
+    elif todo:
+        for (token, rv) in zip(todo,
+                               sigprob.token_final_probs(todo, 1000,
+                                                         stats=stats)):
+            new_rates[token] = rv
 
-    # conserve memory
-    if len(token) > 20:
-        del estd_fpos_rate[trace][token]
-    if len(estd_fpos_rate[trace].keys()) > 200:
-        estd_fpos_rate[trace].clear() # XXX should delete least recently accessed
+    rates.update(new_rates)
+    fpos_store.put_many(source, estimator, new_rates)
 
-    return rv
+    return [rates[t] for t in tokens]
@@ -14,10 +14,20 @@ from __future__ import division
 import re
 #import priorprob
 
+# native engine for fsm_prob, see polygraph/fsmprob
+try:
+    import polygraph.util.fsmprobc as fsmprobc
+except ImportError:
+    fsmprobc = None
+
 def contextprob(context, byte, stats, max_context=2, a_size=256):
     if stats == None:
         return 1/a_size
 
+    # a mapped context model does the lookups natively
+    if hasattr(stats, 'contextprob'):
+        return stats.contextprob(context, byte, max_context)
+
     context = context[max(len(context)-max_context,0):]
 
 #    # if there's no data on this context, try one shorter
@@ -97,10 +107,14 @@ def add_substring(token, transitions, a_size, stats, max_context=2):
     t_len = len(token)
     init_state = len(transitions) - 1
 
+    # probability of each byte of the token after the ones before it;
+    # the mismatch transitions need the same ones again
+    charprobs = [contextprob(token[:i], token[i], stats, a_size=a_size,
+                             max_context=max_context) for i in xrange(t_len)]
+
     # match transitions
     for i in xrange(t_len):
-        transitions.append([(init_state+i, 
-            contextprob(token[:i], token[i], stats, a_size=a_size, max_context=max_context))])
+        transitions.append([(init_state+i, charprobs[i])])
 
     # mismatch transitions
     # track how many previous characters match prefix of the token
@@ -122,8 +136,8 @@ def add_substring(token, transitions, a_size, stats, max_context=2):
         # add the mismatch transitions
         # keep in mind that mismatched character may be able to match
         # the character after the return point
-        thischarprob = contextprob(token[:i], token[i], stats, a_size=a_size, max_context=max_context)
-        after_return_prob = contextprob(token[:return_point], token[return_point], stats, a_size=a_size, max_context=max_context)
+        thischarprob = charprobs[i]
+        after_return_prob = charprobs[return_point]
         if token[return_point] == token[i]: 
             transitions[init_state+return_point].append((init_state+i, 
                                                         1-thischarprob))
@@ -154,6 +168,9 @@ def add_substring(token, transitions, a_size, stats, max_context=2):
 # transitions[x] = [(y, p1),(z, p2)] indicates that y and z have transitions
 # into x, with probabilities p1 and p2 that those are taken, respectively
 def fsm_prob(transitions, n):
+    if fsmprobc:
+        return fsmprobc.dist(transitions, n)
+
     num_states = len(transitions)
     final_after = [0] # probability reached final state after i transitions
 
@@ -175,6 +192,13 @@ def fsm_prob(transitions, n):
 
     return final_after
 
+# fsm_prob(transitions, n)[-1]. The native engine takes about log n
+# matrix squarings instead of n steps when there are few states.
+def fsm_final_prob(transitions, n):
+    if fsmprobc:
+        return fsmprobc.final(transitions, n)
+    return fsm_prob(transitions, n)[-1]
+
 # token is string searched for
 # s_len is length of string being searched
 # a_size is alphabet size
@@ -296,6 +320,16 @@ def reorder_fixedgaps(s):
 # modeling as an ndfa for simplicity. assumes that transition probabilities
 # are independent, which is false. seems to be a good estimate though.
 def regex_prob(sig, str_len, a_size=256, stats=None, max_context=2):
+    return fsm_prob(regex_fsm(sig, a_size, stats, max_context), str_len)
+
+# regex_prob(...)[-1]: the probability of sig matching a string of
+# str_len bytes
+def regex_final_prob(sig, str_len, a_size=256, stats=None, max_context=2):
+    return fsm_final_prob(regex_fsm(sig, a_size, stats, max_context),
+                          str_len)
+
+# the transitions of regex_prob
+def regex_fsm(sig, a_size=256, stats=None, max_context=2):
     transitions = [[]]
 
     # implicit .* at the beginning
@@ -312,10 +346,74 @@ def regex_prob(sig, str_len, a_size=256, stats=None, max_context=2):
     laststate=len(transitions)-1
     transitions[laststate].append((laststate, 1))
 #    print_transitions(transitions)
-    return fsm_prob(transitions, str_len)
+    return transitions
+
+# token_final_prob of every token of a batch, in a list. Tokens that
+# share a prefix share the states for it, and the transitions out of
+# them: they are computed once per prefix, in a trie of the tokens,
+# rather than once per token as add_substring does.
+def token_final_probs(tokens, str_len, a_size=256, stats=None,
+                      max_context=2):
+    # prefix -> (probability of its last byte after the ones before it,
+    #            running prefix length of add_substring,
+    #            mismatch transitions out of the state before that byte)
+    nodes = {'': (None, 0, None)}
+    for token in tokens:
+        for i in xrange(len(token)):
+            prefix = token[:i+1]
+            if nodes.has_key(prefix):
+                continue
+            thischarprob = contextprob(token[:i], token[i], stats,
+                                       a_size=a_size, max_context=max_context)
+            prefix_len = nodes[token[:i]][1]
+            if token[i] == token[prefix_len]:
+                prefix_len += 1
+            else:
+                prefix_len = 0
+            if prefix_len == i+1:
+                return_point = 0
+            else:
+                return_point = prefix_len
+            if return_point == i:
+                after_return_prob = thischarprob
+            else:
+                after_return_prob = nodes[token[:return_point+1]][0]
+
+            if token[return_point] == token[i]:
+                mismatch = [(return_point, 1-thischarprob)]
+            elif a_size == 2:
+                mismatch = [(return_point+1, 1-thischarprob)]
+            else:
+                mismatch = [(return_point,
+                             (1-thischarprob) * (1-after_return_prob)),
+                            (return_point+1,
+                             (1-thischarprob) * after_return_prob)]
+            nodes[prefix] = (thischarprob, prefix_len, mismatch)
+
+    # the transitions of token_fsm, in the same order
+    probs = []
+    for token in tokens:
+        t_len = len(token)
+        path = [nodes[token[:i+1]] for i in xrange(t_len)]
+        transitions = [[]]
+        for i in xrange(t_len):
+            transitions.append([(i, path[i][0])])
+        for i in xrange(t_len):
+            for (state, prob) in path[i][2]:
+                transitions[state].append((i, prob))
+        transitions[t_len].append((t_len, 1))
+        probs.append(fsm_final_prob(transitions, str_len))
+    return probs
 
 # same as regex_prob, but for a literal token.
 def token_prob(sig, str_len, a_size=256, stats=None, max_context=2):
+    return fsm_prob(token_fsm(sig, a_size, stats, max_context), str_len)
+
+def token_final_prob(sig, str_len, a_size=256, stats=None, max_context=2):
+    return fsm_final_prob(token_fsm(sig, a_size, stats, max_context),
+                          str_len)
+
+def token_fsm(sig, a_size=256, stats=None, max_context=2):
     transitions = [[]]
 
     add_substring(sig, transitions, a_size, stats, max_context=max_context)
@@ -323,7 +421,7 @@ def token_prob(sig, str_len, a_size=256, stats=None, max_context=2):
     laststate=len(transitions)-1
     transitions[laststate].append((laststate, 1))
 #    print_transitions(transitions)
-    return fsm_prob(transitions, str_len)
+    return transitions
 #    fixedgap = re.compile(r'(?P<num>\d+)\}')
 #    while(i < len(sig)):
 #        prevstate = len(transitions) - 1
@@ -15,7 +15,7 @@ def tokenprob(token, streamfile):
     import re
     import polygraph.trace_crunching.sarray_trace as sarray_trace
 
-    ts = sarray_trace.TraceSary(streamfile)
+    ts = sarray_trace.open_trace(streamfile)
     return min(1, ts.token_count(token) / ts.numstreams)
 
 #    return sarray_trace.token_count(streamfile, token) / ts.numstreams
@@ -78,15 +78,35 @@ def mpp_old(token,tracefile=None,minprob=1,minlen=1):
     return mpp_helper(0, 1)
 
 # bottom up implementation of mpp
-def mpp(token,tracefile=None,minprob=1,minlen=1):
+# unique: estimate token probabilities from the number of streams containing
+# the token rather than its number of occurrences. Cheap if the trace has a
+# document index (see TraceSary.build_doc_index).
+def mpp(token,tracefile=None,minprob=1,minlen=1,unique=False):
     lastline = []
     thisline = []
 
     import polygraph.trace_crunching.sarray_trace as sarray_trace
-    ts = sarray_trace.TraceSary(tracefile)
+    ts = sarray_trace.open_trace(tracefile)
+
+    # the native program counts and splits in one pass
+    if token and (not unique or ts.has_doc_index()):
+        (prob, pieces) = ts.mpp(token, minprob, minlen, unique)
+        return prob, [token[start:end] for (start, end) in pieces]
+
+    # count every substring of the token in one batch
+    substrings = []
+    for start in xrange(len(token)):
+        for end in xrange(start+1, len(token)+1):
+            substrings.append(token[start:end])
+    counts = dict(zip(substrings,
+                      ts.token_counts(substrings,
+                                      unique and ts.has_doc_index())))
+    substrings = None
+
     def tokenprob(t):
-        return min(.999, ts.token_count(t) / ts.numstreams)
-#        return min(1, ts.token_count_unique(t) / ts.numstreams)
+        if unique and not ts.has_doc_index():
+            return min(.999, ts.token_count_unique(t) / ts.numstreams)
+        return min(.999, counts[t] / ts.numstreams)
 #        return min(1, ts.token_count_unique(t, estimate=True) / ts.numstreams)
 
     end = len(token)
@@ -116,10 +136,9 @@ def token_counts_mult(tokens, streamfile):
     import polygraph.util.pysary as pysary
     import polygraph.trace_crunching.sarray_trace as sarray_trace
 
-    counts = {}
-    tsary = sarray_trace.TraceSary(streamfile)
-    for t in tokens:
-        counts[t] = tsary.token_count(t)
+    tokens = list(tokens)
+    tsary = sarray_trace.open_trace(streamfile)
+    counts = dict(zip(tokens, tsary.token_counts(tokens)))
     return (tsary.length, tsary.numstreams, counts)
 
 #    counts = {}
@@ -182,4 +201,53 @@ def maxcontextprob(token, tracefile=None, stats=None, maxlen=10):
 
     # calculate probability
 #    print Calculating probability"
-    return sigprob.regex_prob(token, int(bytetotal/numstreams), stats=stats, max_context=maxlen)[-1], stats
+    return sigprob.regex_final_prob(token, int(bytetotal/numstreams), stats=stats, max_context=maxlen), stats
+
+# maxcontextprob of every token of a batch, in a list. The subtokens of
+# all of them are counted at once, or taken from counts if given, and
+# the literal tokens go through sigprob.token_final_probs together.
+def maxcontextprobs(tokens, tracefile, maxlen=10, counts=None):
+    import re
+    import sigprob
+    import polygraph.trace_crunching.sarray_trace as sarray_trace
+
+    ts = sarray_trace.open_trace(tracefile)
+    (bytetotal, numstreams) = (ts.length, ts.numstreams)
+
+    subtokens = {}
+    for token in tokens:
+        for start in xrange(len(token)):
+            for end in xrange(start+1, min(len(token), start+maxlen)+1):
+                subtokens[token[start:end]] = 1
+    if counts is None:
+        stcounts = token_counts_mult(subtokens.keys(), tracefile)[2]
+    else:
+        stcounts = counts
+    subtokens = subtokens.keys()
+
+    # the statistics of maxcontextprob, for all the tokens: each entry
+    # is the same whichever token asks for it
+    stats = {}
+    stats[''] = {'count': bytetotal, 'bytes': {}}
+    for st in subtokens:
+        stats[st] = {'count': stcounts[st], 'bytes': {}}
+    for token in tokens:
+        for byte in xrange(len(token)):
+            for contextstart in xrange(max(0, byte-maxlen+1), byte+1):
+                context = token[contextstart:byte]
+                stats[context]['bytes'][token[byte]] = \
+                    stcounts[token[contextstart:byte+1]]
+
+    # regex_prob reads .* and .{n} in a token as gaps
+    str_len = int(bytetotal/numstreams)
+    fixedgap = re.compile(r'\.\{\d+\}')
+    literal = [t for t in tokens if t.find('.*') < 0 and not fixedgap.search(t)]
+    probs = dict(zip(literal,
+                     sigprob.token_final_probs(literal, str_len, stats=stats,
+                                               max_context=maxlen)))
+    for token in tokens:
+        if not probs.has_key(token):
+            probs[token] = sigprob.regex_final_prob(token, str_len,
+                                                    stats=stats,
+                                                    max_context=maxlen)
+    return [probs[t] for t in tokens]
@@ -0,0 +1,898 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tokmatch.h"
+
+/* trie edges while the tokens are inserted */
+typedef struct {
+	unsigned char label;
+	int to;
+	int next;
+} edge_t;
+
+static int
+compare_edges(const void *a, const void *b)
+{
+	return (int)((const edge_t *)a)->label - (int)((const edge_t *)b)->label;
+}
+
+void
+tokmatch_free(tokmatch_t *tm)
+{
+	if (tm == NULL)
+		return;
+	free(tm->lens);
+	free(tm->same);
+	free(tm->first);
+	free(tm->label);
+	free(tm->child);
+	free(tm->fail);
+	free(tm->token);
+	free(tm->output);
+	free(tm);
+}
+
+/* the child of state s by byte c, or -1 */
+static inline int
+find_child(const tokmatch_t *tm, int s, unsigned char c)
+{
+	int lo = tm->first[s], hi = tm->first[s + 1], mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (tm->label[mid] < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < tm->first[s + 1] && tm->label[lo] == c) ?
+	       tm->child[lo] : -1;
+}
+
+static inline int
+next_state(const tokmatch_t *tm, int s, unsigned char c)
+{
+	int t;
+
+	while (s != 0) {
+		if ((t = find_child(tm, s, c)) >= 0)
+			return t;
+		s = tm->fail[s];
+	}
+	return tm->root[c];
+}
+
+tokmatch_t *
+tokmatch_new(const char **tokens, const int *lens, int n)
+{
+	tokmatch_t *tm;
+	edge_t *edges = NULL, *sorted = NULL;
+	int *head = NULL, *queue = NULL;
+	int total = 1, nedges = 0, i, j, s, t, e, k;
+
+	for (i = 0; i < n; i++) {
+		if (lens[i] <= 0) {
+			errno = EINVAL;
+			return NULL;
+		}
+		total += lens[i];
+	}
+	if ((tm = calloc(1, sizeof(tokmatch_t))) == NULL)
+		return NULL;
+	tm->ntokens = n;
+	if ((tm->lens = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (tm->same = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (tm->token = malloc(total * sizeof(int))) == NULL ||
+	    (head = malloc(total * sizeof(int))) == NULL ||
+	    (edges = malloc(total * sizeof(edge_t))) == NULL)
+		goto fail;
+
+	/* the trie */
+	tm->nstates = 1;
+	head[0] = -1;
+	tm->token[0] = -1;
+	for (i = 0; i < n; i++) {
+		const unsigned char *p = (const unsigned char *)tokens[i];
+
+		tm->lens[i] = lens[i];
+		if (lens[i] > tm->maxlen)
+			tm->maxlen = lens[i];
+		s = 0;
+		for (j = 0; j < lens[i]; j++) {
+			for (e = head[s]; e >= 0 && edges[e].label != p[j];
+			     e = edges[e].next)
+				;
+			if (e >= 0) {
+				s = edges[e].to;
+				continue;
+			}
+			t = tm->nstates++;
+			head[t] = -1;
+			tm->token[t] = -1;
+			edges[nedges].label = p[j];
+			edges[nedges].to = t;
+			edges[nedges].next = head[s];
+			head[s] = nedges++;
+			s = t;
+		}
+		if (tm->token[s] < 0)
+			tm->token[s] = i;
+		tm->same[i] = tm->token[s];
+	}
+
+	/* children sorted by byte */
+	if ((tm->first = malloc((tm->nstates + 1) * sizeof(int))) == NULL ||
+	    (tm->label = malloc((nedges + 1) * sizeof(unsigned char))) == NULL ||
+	    (tm->child = malloc((nedges + 1) * sizeof(int))) == NULL ||
+	    (sorted = malloc((nedges + 1) * sizeof(edge_t))) == NULL)
+		goto fail;
+	k = 0;
+	for (s = 0; s < tm->nstates; s++) {
+		tm->first[s] = k;
+		for (e = head[s], j = k; e >= 0; e = edges[e].next)
+			sorted[j++] = edges[e];
+		qsort(sorted + k, j - k, sizeof(edge_t), compare_edges);
+		for (; k < j; k++) {
+			tm->label[k] = sorted[k].label;
+			tm->child[k] = sorted[k].to;
+		}
+	}
+	tm->first[tm->nstates] = k;
+	free(sorted);
+	sorted = NULL;
+	free(edges);
+	edges = NULL;
+
+	/* failure and output links, breadth first */
+	if ((tm->fail = malloc(tm->nstates * sizeof(int))) == NULL ||
+	    (tm->output = malloc(tm->nstates * sizeof(int))) == NULL ||
+	    (queue = malloc(tm->nstates * sizeof(int))) == NULL)
+		goto fail;
+	memset(tm->root, 0, sizeof(tm->root));
+	tm->fail[0] = 0;
+	tm->output[0] = -1;
+	i = j = 0;
+	for (k = tm->first[0]; k < tm->first[1]; k++) {
+		t = tm->child[k];
+		tm->root[tm->label[k]] = t;
+		tm->fail[t] = 0;
+		tm->output[t] = -1;
+		queue[j++] = t;
+	}
+	while (i < j) {
+		s = queue[i++];
+		for (k = tm->first[s]; k < tm->first[s + 1]; k++) {
+			t = tm->child[k];
+			tm->fail[t] = next_state(tm, tm->fail[s], tm->label[k]);
+			tm->output[t] = tm->token[tm->fail[t]] >= 0 ?
+			                tm->fail[t] : tm->output[tm->fail[t]];
+			queue[j++] = t;
+		}
+	}
+	free(queue);
+	free(head);
+	return tm;
+
+fail:
+	free(queue);
+	free(sorted);
+	free(edges);
+	free(head);
+	tokmatch_free(tm);
+	errno = ENOMEM;
+	return NULL;
+}
+
+int
+tokmatch_scan(const tokmatch_t *tm, const unsigned char *s, size_t len,
+              int (*hit)(void *arg, int token, size_t end), void *arg)
+{
+	size_t i;
+	int state = 0, t, rv;
+
+	for (i = 0; i < len; i++) {
+		state = next_state(tm, state, s[i]);
+		t = tm->token[state] >= 0 ? state : tm->output[state];
+		for (; t >= 0; t = tm->output[t])
+			if ((rv = hit(arg, tm->token[t], i)) != 0)
+				return rv;
+	}
+	return 0;
+}
+
+tokmatch_bayes_t *
+tokmatch_bayes_new(const char **tokens, const int *lens,
+                   const double *scores, int n)
+{
+	tokmatch_bayes_t *bayes;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!(scores[i] > 0)) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	if ((bayes = calloc(1, sizeof(tokmatch_bayes_t))) == NULL)
+		return NULL;
+	if ((bayes->tm = tokmatch_new(tokens, lens, n)) == NULL) {
+		free(bayes);
+		return NULL;
+	}
+	if ((bayes->scores = malloc((n + 1) * sizeof(double))) == NULL ||
+	    (bayes->within = calloc(bayes->tm->maxlen + 1,
+	                            sizeof(double))) == NULL) {
+		tokmatch_bayes_free(bayes);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(bayes->scores, scores, n * sizeof(double));
+	for (i = 0; i < n; i++)
+		if (bayes->tm->same[i] == i)
+			bayes->within[lens[i]] += scores[i];
+	for (i = 1; i <= bayes->tm->maxlen; i++)
+		bayes->within[i] += bayes->within[i - 1];
+
+	/* sums of up to n positive terms in any two orders differ by
+	 * less than this times either
+	 */
+	bayes->slack = 2.0 * (n + 1) * DBL_EPSILON;
+	return bayes;
+}
+
+void
+tokmatch_bayes_free(tokmatch_bayes_t *bayes)
+{
+	if (bayes == NULL)
+		return;
+	tokmatch_free(bayes->tm);
+	free(bayes->scores);
+	free(bayes->within);
+	free(bayes);
+}
+
+tokmatch_work_t *
+tokmatch_work_new(const tokmatch_bayes_t *bayes)
+{
+	tokmatch_work_t *work;
+
+	if ((work = calloc(1, sizeof(tokmatch_work_t))) == NULL)
+		return NULL;
+	for (work->size = 1; work->size < bayes->tm->maxlen; work->size *= 2)
+		;
+	if ((work->longest = malloc(work->size * sizeof(int))) == NULL ||
+	    (work->seen = calloc(bayes->tm->ntokens + 1,
+	                         sizeof(unsigned))) == NULL) {
+		tokmatch_work_free(work);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return work;
+}
+
+void
+tokmatch_work_free(tokmatch_work_t *work)
+{
+	if (work == NULL)
+		return;
+	free(work->longest);
+	free(work->seen);
+	free(work);
+}
+
+/* the token list of bayes.Bayes.get_token_list, as it is resolved */
+typedef struct {
+	int last;               /* the last token kept, or -1 */
+	size_t covered;         /* end of the last token kept */
+	double kept;            /* score of the tokens kept before it */
+} resolve_t;
+
+static void
+keep(const tokmatch_bayes_t *bayes, tokmatch_work_t *work, resolve_t *r,
+     int token)
+{
+	if (work->seen[token] != work->gen) {
+		work->seen[token] = work->gen;
+		r->kept += bayes->scores[token];
+	}
+}
+
+/* the longest token starting at p, as get_token_list takes it */
+static void
+resolve(const tokmatch_bayes_t *bayes, tokmatch_work_t *work, resolve_t *r,
+        size_t p, int token)
+{
+	const double *scores = bayes->scores;
+	size_t end = p + bayes->tm->lens[token];
+
+	if (r->last >= 0 && p < r->covered) {
+		/* contained in or overlapping the last token */
+		if (scores[token] > scores[r->last])
+			r->last = -1;
+		else
+			return;
+	}
+	if (r->last >= 0)
+		keep(bayes, work, r, r->last);
+	r->last = token;
+	r->covered = end;
+}
+
+int
+tokmatch_bayes_score(const tokmatch_bayes_t *bayes, tokmatch_work_t *work,
+                     const unsigned char *s, size_t len,
+                     double lo, double hi, double *score)
+{
+	const tokmatch_t *tm = bayes->tm;
+	resolve_t r;
+	size_t e, p = 0, rest, maxlen = tm->maxlen;
+	int mask = work->size - 1;
+	int state = 0, t, token, *longest = work->longest;
+	double bound, sum;
+
+	if (++work->gen == 0) {
+		memset(work->seen, 0, tm->ntokens * sizeof(unsigned));
+		work->gen = 1;
+	}
+	r.last = -1;
+	r.covered = 0;
+	r.kept = 0;
+
+	for (e = 0; e <= len; e++) {
+		if (e < len) {
+			/* the longest token starting at each recent byte */
+			longest[e & mask] = -1;
+			state = next_state(tm, state, s[e]);
+			t = tm->token[state] >= 0 ? state : tm->output[state];
+			for (; t >= 0; t = tm->output[t]) {
+				size_t start;
+
+				token = tm->token[t];
+				start = e + 1 - tm->lens[token];
+				if (longest[start & mask] < 0 ||
+				    tm->lens[longest[start & mask]] <
+				    tm->lens[token])
+					longest[start & mask] = token;
+			}
+		}
+
+		/* resolve the starts no longer token can be found at */
+		for (; p < len && (e == len || p + maxlen <= e + 1); p++) {
+			if ((token = longest[p & mask]) >= 0)
+				resolve(bayes, work, &r, p, token);
+
+			if (r.kept >= hi + r.kept * bayes->slack)
+				return TOKMATCH_ABOVE;
+			rest = len - p - 1;
+			bound = r.kept + bayes->within[rest < maxlen ? rest : maxlen];
+			if (r.last >= 0 && work->seen[r.last] != work->gen)
+				bound += bayes->scores[r.last];
+			if (bound + bound * bayes->slack < lo)
+				return TOKMATCH_BELOW;
+		}
+	}
+	if (r.last >= 0)
+		keep(bayes, work, &r, r.last);
+
+	/* in the order of the tokens, as score sums them */
+	sum = 0;
+	for (t = 0; t < tm->ntokens; t++)
+		if (work->seen[t] == work->gen)
+			sum += bayes->scores[t];
+	*score = sum;
+	return 0;
+}
+
+/* a range of streams scored by one thread */
+typedef struct {
+	const tokmatch_bayes_t *bayes;
+	const unsigned char *data;
+	const uint64_t *offsets;
+	uint32_t first;
+	uint32_t last;
+	int k;
+	int n;                  /* scores in the heap */
+	double *heap;           /* [k], lowest first */
+	int rv;
+} shard_t;
+
+/* Adds score to the heap of the k highest, if it is one. */
+static void
+heap_add(double *heap, int *n, int k, double score)
+{
+	int i, c;
+
+	if (*n < k) {
+		/* sift up */
+		for (i = (*n)++; i > 0 && heap[(i - 1) / 2] > score;
+		     i = (i - 1) / 2)
+			heap[i] = heap[(i - 1) / 2];
+		heap[i] = score;
+		return;
+	}
+	if (!(score > heap[0]))
+		return;
+	/* replace the lowest and sift down */
+	for (i = 0; (c = 2 * i + 1) < k; i = c) {
+		if (c + 1 < k && heap[c + 1] < heap[c])
+			c++;
+		if (heap[c] >= score)
+			break;
+		heap[i] = heap[c];
+	}
+	heap[i] = score;
+}
+
+static void *
+score_shard(void *arg)
+{
+	shard_t *sh = (shard_t *)arg;
+	tokmatch_work_t *work;
+	uint32_t i;
+	double lo, score;
+
+	if ((work = tokmatch_work_new(sh->bayes)) == NULL) {
+		sh->rv = -1;
+		return NULL;
+	}
+	for (i = sh->first; i < sh->last; i++) {
+		/* a full heap only takes scores above its lowest */
+		lo = sh->n < sh->k ? -HUGE_VAL : sh->heap[0];
+		if (tokmatch_bayes_score(sh->bayes, work,
+		                         sh->data + sh->offsets[i],
+		                         sh->offsets[i + 1] - sh->offsets[i],
+		                         lo, HUGE_VAL, &score) == 0)
+			heap_add(sh->heap, &sh->n, sh->k, score);
+	}
+	tokmatch_work_free(work);
+	sh->rv = 0;
+	return NULL;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int
+tokmatch_bayes_top(const tokmatch_bayes_t *bayes, const char *data_name,
+                   const uint64_t *offsets, uint32_t nstreams,
+                   int k, int nthreads, double *top)
+{
+	const unsigned char *data = NULL;
+	uint64_t bytes = offsets[nstreams];
+	shard_t *shards;
+	pthread_t *threads;
+	struct stat st;
+	uint32_t s;
+	int fd, i, j, n, rv = 0, nstarted = 0;
+
+	if (k < 1 || nthreads < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((fd = open(data_name, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if ((uint64_t)st.st_size < bytes) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	if (bytes > 0) {
+		data = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise((void *)data, bytes, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	if ((shards = calloc(nthreads, sizeof(shard_t))) == NULL ||
+	    (threads = calloc(nthreads, sizeof(pthread_t))) == NULL) {
+		free(shards);
+		if (data)
+			munmap((void *)data, bytes);
+		return -1;
+	}
+
+	/* about the same number of bytes in each shard */
+	s = 0;
+	for (i = 0; i < nthreads; i++) {
+		shards[i].bayes = bayes;
+		shards[i].data = data;
+		shards[i].offsets = offsets;
+		shards[i].k = k;
+		shards[i].first = s;
+		while (s < nstreams && offsets[s] < bytes / nthreads * (i + 1))
+			s++;
+		if (i == nthreads - 1)
+			s = nstreams;
+		shards[i].last = s;
+		if ((shards[i].heap = malloc(k * sizeof(double))) == NULL)
+			rv = -1;
+	}
+
+	if (rv == 0 && nthreads == 1) {
+		score_shard(&shards[0]);
+		rv = shards[0].rv;
+	} else if (rv == 0) {
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&threads[i], NULL, score_shard,
+			                   &shards[i]) != 0) {
+				rv = -1;
+				break;
+			}
+			nstarted++;
+		}
+		for (i = 0; i < nstarted; i++) {
+			pthread_join(threads[i], NULL);
+			if (shards[i].rv < 0)
+				rv = -1;
+		}
+	}
+
+	/* the k highest of the shards' k highest */
+	n = 0;
+	if (rv == 0) {
+		for (i = 0; i < nthreads; i++)
+			for (j = 0; j < shards[i].n; j++)
+				heap_add(top, &n, k, shards[i].heap[j]);
+		qsort(top, n, sizeof(double), compare_doubles);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		free(shards[i].heap);
+	free(shards);
+	free(threads);
+	if (data)
+		munmap((void *)data, bytes);
+	if (rv < 0) {
+		if (errno == 0)
+			errno = ENOMEM;
+		return -1;
+	}
+	return n;
+}
+
+tokmatch_set_t *
+tokmatch_set_new(const char **tokens, const int *lens,
+                 const int *sigs, const double *weights, int n,
+                 const double *need, int nsigs)
+{
+	tokmatch_set_t *set;
+	int *last = NULL, i, first;
+
+	for (i = 0; i < n; i++) {
+		if (sigs[i] < 0 || sigs[i] >= nsigs || !(weights[i] > 0)) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	if ((set = calloc(1, sizeof(tokmatch_set_t))) == NULL)
+		return NULL;
+	if ((set->tm = tokmatch_new(tokens, lens, n)) == NULL) {
+		free(set);
+		return NULL;
+	}
+	set->nsigs = nsigs;
+	if ((set->need = malloc((nsigs + 1) * sizeof(double))) == NULL ||
+	    (set->sig = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (set->weight = malloc((n + 1) * sizeof(double))) == NULL ||
+	    (set->next = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (set->seen = calloc(n + 1, sizeof(unsigned))) == NULL ||
+	    (set->touched = calloc(nsigs + 1, sizeof(unsigned))) == NULL ||
+	    (set->sum = malloc((nsigs + 1) * sizeof(double))) == NULL ||
+	    (last = malloc((n + 1) * sizeof(int))) == NULL) {
+		free(last);
+		tokmatch_set_free(set);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(set->need, need, nsigs * sizeof(double));
+	memcpy(set->sig, sigs, n * sizeof(int));
+	memcpy(set->weight, weights, n * sizeof(double));
+
+	/* chain the entries of equal tokens to the first of them */
+	for (i = 0; i < n; i++) {
+		set->next[i] = -1;
+		first = set->tm->same[i];
+		if (first == i)
+			last[i] = i;
+		else {
+			set->next[last[first]] = i;
+			last[first] = i;
+		}
+	}
+	free(last);
+
+	set->slack = 2.0 * (n + 1) * DBL_EPSILON;
+	return set;
+}
+
+void
+tokmatch_set_free(tokmatch_set_t *set)
+{
+	if (set == NULL)
+		return;
+	tokmatch_free(set->tm);
+	free(set->need);
+	free(set->sig);
+	free(set->weight);
+	free(set->next);
+	free(set->seen);
+	free(set->touched);
+	free(set->sum);
+	free(set);
+}
+
+static void
+set_hit(tokmatch_set_t *set, int token)
+{
+	int e, s;
+
+	if (set->seen[token] == set->gen)
+		return;
+	set->seen[token] = set->gen;
+	for (e = token; e >= 0; e = set->next[e]) {
+		s = set->sig[e];
+		if (set->touched[s] != set->gen) {
+			set->touched[s] = set->gen;
+			set->sum[s] = 0;
+		}
+		set->sum[s] += set->weight[e];
+	}
+}
+
+int
+tokmatch_set_scan(tokmatch_set_t *set, const unsigned char *s, size_t len,
+                  int *candidates)
+{
+	const tokmatch_t *tm = set->tm;
+	size_t j;
+	int i, n = 0, state = 0, t;
+	double sum;
+
+	if (++set->gen == 0) {
+		memset(set->seen, 0, set->tm->ntokens * sizeof(unsigned));
+		memset(set->touched, 0, set->nsigs * sizeof(unsigned));
+		set->gen = 1;
+	}
+	/* as tokmatch_scan, but where a token ends does not matter */
+	for (j = 0; tm->ntokens > 0 && j < len; j++) {
+		state = next_state(tm, state, s[j]);
+		t = tm->token[state] >= 0 ? state : tm->output[state];
+		for (; t >= 0; t = tm->output[t])
+			set_hit(set, tm->token[t]);
+	}
+
+	for (i = 0; i < set->nsigs; i++) {
+		if (set->need[i] > 0) {
+			if (set->touched[i] != set->gen)
+				continue;
+			/* the sum may be rounded below the score it bounds */
+			sum = set->sum[i];
+			if (sum + sum * set->slack < set->need[i])
+				continue;
+		}
+		candidates[n++] = i;
+	}
+	return n;
+}
+
+void
+tokmatch_gap_free(tokmatch_gap_t *gap)
+{
+	int g;
+
+	if (gap == NULL)
+		return;
+	if (gap->groups != NULL) {
+		for (g = 0; g < gap->ngroups; g++) {
+			tokmatch_free(gap->groups[g].tm);
+			free(gap->groups[g].offset);
+			free(gap->groups[g].next);
+			free(gap->groups[g].text);
+			free(gap->groups[g].at);
+		}
+	}
+	free(gap->groups);
+	free(gap->start);
+	free(gap->votes);
+	free(gap->stamp);
+	free(gap);
+}
+
+tokmatch_gap_t *
+tokmatch_gap_new(const char **tokens, const int *lens,
+                 const int *skip, const int *variable, int n)
+{
+	tokmatch_gap_t *gap;
+	tokmatch_group_t *group;
+	int *last = NULL, i, j, g, first, total, longest = 0;
+
+	for (i = 0; i < n; i++) {
+		if (lens[i] <= 0 || skip[i] < 0) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	if ((gap = calloc(1, sizeof(tokmatch_gap_t))) == NULL)
+		return NULL;
+
+	/* a group starts at every variable gap, and at the first token */
+	gap->anchored = n == 0 || !variable[0];
+	for (i = 0; i < n; i++)
+		if (i == 0 || variable[i])
+			gap->ngroups++;
+	if ((gap->groups = calloc(gap->ngroups + 1,
+	                          sizeof(tokmatch_group_t))) == NULL ||
+	    (last = malloc((n + 1) * sizeof(int))) == NULL)
+		goto fail;
+
+	for (g = 0, i = 0; g < gap->ngroups; g++) {
+		group = &gap->groups[g];
+		group->skip = skip[i];
+		for (j = i + 1; j < n && !variable[j]; j++)
+			;
+		group->ntokens = j - i;
+		for (total = 0, j = i; j < i + group->ntokens; j++)
+			total += lens[j];
+		if ((group->offset = malloc(group->ntokens * sizeof(int))) == NULL ||
+		    (group->next = malloc(group->ntokens * sizeof(int))) == NULL ||
+		    (group->at = malloc(group->ntokens * sizeof(int))) == NULL ||
+		    (group->text = malloc(total)) == NULL ||
+		    (group->tm = tokmatch_new(tokens + i, lens + i,
+		                              group->ntokens)) == NULL)
+			goto fail;
+
+		/* the skip of the first token of the first group, if it is
+		 * anchored, is its offset from the start of the sample
+		 */
+		group->length = g == 0 && gap->anchored ? skip[i] : 0;
+		for (total = 0, j = 0; j < group->ntokens; j++) {
+			if (j > 0)
+				group->length += skip[i + j];
+			group->offset[j] = group->length;
+			group->length += lens[i + j];
+			group->at[j] = total;
+			memcpy(group->text + total, tokens[i + j], lens[i + j]);
+			total += lens[i + j];
+
+			/* chain equal tokens to the first of them */
+			group->next[j] = -1;
+			first = group->tm->same[j];
+			if (first == j)
+				last[j] = j;
+			else {
+				group->next[last[first]] = j;
+				last[first] = j;
+			}
+		}
+		if (group->length > longest)
+			longest = group->length;
+		i += group->ntokens;
+	}
+	free(last);
+	last = NULL;
+
+	for (gap->size = 1; gap->size < longest; gap->size *= 2)
+		;
+	if ((gap->start = malloc(gap->size * sizeof(size_t))) == NULL ||
+	    (gap->votes = malloc(gap->size * sizeof(int))) == NULL ||
+	    (gap->stamp = calloc(gap->size, sizeof(unsigned))) == NULL)
+		goto fail;
+	return gap;
+
+fail:
+	free(last);
+	tokmatch_gap_free(gap);
+	errno = ENOMEM;
+	return NULL;
+}
+
+/* a group being found in a sample */
+typedef struct {
+	tokmatch_gap_t *gap;
+	const tokmatch_group_t *group;
+	size_t lo;              /* earliest start, where the scan begins */
+	size_t found;           /* the start of the group, once found */
+} find_t;
+
+static int
+vote(void *arg, int token, size_t end)
+{
+	find_t *f = (find_t *)arg;
+	tokmatch_gap_t *gap = f->gap;
+	const tokmatch_group_t *group = f->group;
+	size_t e = f->lo + end + 1, start;
+	int j, slot;
+
+	for (j = token; j >= 0; j = group->next[j]) {
+		/* the group this occurrence would be part of */
+		if (e < f->lo + group->offset[j] + group->tm->lens[j])
+			continue;
+		start = e - group->offset[j] - group->tm->lens[j];
+		slot = start & (gap->size - 1);
+		if (gap->stamp[slot] != gap->gen ||
+		    gap->start[slot] != start) {
+			gap->stamp[slot] = gap->gen;
+			gap->start[slot] = start;
+			gap->votes[slot] = 0;
+		}
+		/* the last vote for a start is that of the token ending the
+		 * group, so groups are found in the order of their starts
+		 */
+		if (++gap->votes[slot] == group->ntokens) {
+			f->found = start;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int
+tokmatch_gap_match(tokmatch_gap_t *gap, const unsigned char *s, size_t len)
+{
+	const tokmatch_group_t *group;
+	find_t f;
+	size_t pos = 0;
+	int g, j;
+
+	for (g = 0; g < gap->ngroups; g++) {
+		group = &gap->groups[g];
+
+		if (g == 0 && gap->anchored) {
+			if ((size_t)group->length > len)
+				return 0;
+			for (j = 0; j < group->ntokens; j++)
+				if (memcmp(s + group->offset[j],
+				           group->text + group->at[j],
+				           group->tm->lens[j]) != 0)
+					return 0;
+			pos = group->length;
+			continue;
+		}
+
+		if (pos + group->skip + group->length > len)
+			return 0;
+		if (++gap->gen == 0) {
+			memset(gap->stamp, 0, gap->size * sizeof(unsigned));
+			gap->gen = 1;
+		}
+		f.gap = gap;
+		f.group = group;
+		f.lo = pos + group->skip;
+		if (!tokmatch_scan(group->tm, s + f.lo, len - f.lo, vote, &f))
+			return 0;
+		pos = f.found + group->length;
+	}
+	return 1;
+}
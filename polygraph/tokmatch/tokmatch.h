@@ -0,0 +1,207 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+/* Finding the tokens of signatures in a sample in one pass.
+ *
+ * The tokens are compiled into an Aho-Corasick automaton: a trie of the
+ * tokens whose states also have a failure link, to the state of the
+ * longest proper suffix of their string that is in the trie, and an
+ * output link, to the nearest state on the failure chain that ends a
+ * token. Feeding the sample a byte at a time, every token occurrence is
+ * reported at its last byte, in time linear in the sample and the
+ * number of occurrences.
+ *
+ * The children of a state are kept sorted by byte, except those of the
+ * root, which has a transition for every byte.
+ */
+#ifndef TOKMATCH_H
+#define TOKMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	int ntokens;
+	int nstates;
+	int maxlen;             /* of the tokens */
+	int *lens;              /* [ntokens] */
+	int *same;              /* [ntokens], the first token equal to each */
+	int root[256];          /* transitions of the root, 0 for none */
+	int *first;             /* [nstates + 1], children of each state */
+	unsigned char *label;   /* [nstates], byte of each child */
+	int *child;             /* [nstates] */
+	int *fail;              /* [nstates] */
+	int *token;             /* [nstates], token ending at a state or -1 */
+	int *output;            /* [nstates], next state ending a token or -1 */
+} tokmatch_t;
+
+/* Compiles the n tokens, none of them empty. Returns NULL with errno
+ * set.
+ */
+tokmatch_t *tokmatch_new(const char **tokens, const int *lens, int n);
+void tokmatch_free(tokmatch_t *tm);
+
+/* Calls hit(arg, token, end) for every occurrence of a token ending at
+ * byte end of s, until hit returns non-zero. Of tokens that are equal,
+ * only the first is reported. Returns what hit last returned, or 0.
+ */
+int tokmatch_scan(const tokmatch_t *tm, const unsigned char *s, size_t len,
+                  int (*hit)(void *arg, int token, size_t end), void *arg);
+
+/* Score of a sample under a Bayes signature (bayes.Bayes.score): the sum
+ * of the scores of the distinct tokens it contains, where at each
+ * position only the longest token is considered, and of tokens that
+ * overlap or contain one another only the one that was seen first is
+ * kept, unless the next one scores higher. Summing in the order of the
+ * tokens gives bit for bit the sum of the Python code.
+ *
+ * The scan resolves the tokens starting at a position once no longer
+ * token can start there. The tokens kept before the last one are then
+ * final, so their score is a lower bound, and with the tokens short
+ * enough to fit in the rest of the sample it gives an upper bound:
+ * the scan stops as soon as either settles the result.
+ */
+typedef struct {
+	tokmatch_t *tm;
+	double *scores;         /* [ntokens], all positive */
+	double *within;         /* [maxlen + 1], of tokens up to each length */
+	double slack;           /* relative error of a sum of scores */
+} tokmatch_bayes_t;
+
+/* scratch space of a scan, one per thread */
+typedef struct {
+	int size;               /* power of 2, at least maxlen */
+	int *longest;           /* [size], longest token at recent starts */
+	unsigned *seen;         /* [ntokens], generation of a token kept */
+	unsigned gen;
+} tokmatch_work_t;
+
+#define TOKMATCH_BELOW -1       /* the score is below lo */
+#define TOKMATCH_ABOVE 1        /* the score is at least hi */
+
+tokmatch_bayes_t *tokmatch_bayes_new(const char **tokens, const int *lens,
+                                     const double *scores, int n);
+void tokmatch_bayes_free(tokmatch_bayes_t *bayes);
+
+tokmatch_work_t *tokmatch_work_new(const tokmatch_bayes_t *bayes);
+void tokmatch_work_free(tokmatch_work_t *work);
+
+/* Returns TOKMATCH_BELOW or TOKMATCH_ABOVE as soon as the score of s is
+ * known to be below lo or at least hi, otherwise 0 with the score in
+ * *score. lo = -HUGE_VAL and hi = HUGE_VAL ask for the score.
+ */
+int tokmatch_bayes_score(const tokmatch_bayes_t *bayes, tokmatch_work_t *work,
+                         const unsigned char *s, size_t len,
+                         double lo, double hi, double *score);
+
+/* The k highest scores of the nstreams streams of data_name, whose
+ * starts are offsets, with the data size after them, in top in
+ * increasing order: bayes.Bayes.get_bound_threshold's scores of a
+ * training trace. The streams are split in nthreads ranges of about the
+ * same size, each scored into a heap of its k highest scores. A stream
+ * is only scored as far as it takes to tell it is below the lowest of
+ * them. Returns the number of scores, at most k, or -1 with errno set.
+ */
+int tokmatch_bayes_top(const tokmatch_bayes_t *bayes, const char *data_name,
+                       const uint64_t *offsets, uint32_t nstreams,
+                       int k, int nthreads, double *top);
+
+/* Screening a sample for many signatures at once (experiments/evaluate.py).
+ * Each signature has tokens of positive weight and a need: a sample can
+ * only match the signature if the weights of the distinct tokens of the
+ * signature that it contains add up to need. A signature whose need is
+ * not positive may match any sample. One scan of a sample finds every
+ * signature it may match, which is then matched as it would be alone.
+ *
+ * The tokens of all the signatures are compiled into one automaton, as
+ * entries of (token, signature, weight); entries of equal tokens are
+ * chained to the first of them, which is the one the scan reports.
+ */
+typedef struct {
+	tokmatch_t *tm;
+	int nsigs;
+	double *need;           /* [nsigs] */
+	int *sig;               /* [ntokens], signature of each entry */
+	double *weight;         /* [ntokens] */
+	int *next;              /* [ntokens], next entry of an equal token or -1 */
+	double slack;           /* relative error of a sum of weights */
+	/* scratch space of a scan */
+	unsigned gen;
+	unsigned *seen;         /* [ntokens], generation of a token found */
+	unsigned *touched;      /* [nsigs], generation of a sum begun */
+	double *sum;            /* [nsigs] */
+} tokmatch_set_t;
+
+tokmatch_set_t *tokmatch_set_new(const char **tokens, const int *lens,
+                                 const int *sigs, const double *weights, int n,
+                                 const double *need, int nsigs);
+void tokmatch_set_free(tokmatch_set_t *set);
+
+/* Puts the signatures s may match in candidates, [nsigs], in increasing
+ * order, and returns their number.
+ */
+int tokmatch_set_scan(tokmatch_set_t *set, const unsigned char *s,
+                      size_t len, int *candidates);
+
+/* Matching a gap pattern: tokens in order, each after a gap of exactly
+ * or at least a number of bytes from the end of the one before, or from
+ * the start of the sample for the first; the regular expressions of
+ * lcseq_tree.LCSeqTree._lcs_to_regex, where a gap is .{n}, .* or .*.{n},
+ * and the tuple signatures, where every gap is .*.
+ *
+ * The gaps of at least some bytes split the pattern into groups of fixed
+ * length, each of tokens at fixed offsets. Matching each group as early
+ * as it can be after the one before is enough to tell whether the whole
+ * pattern matches. A group is found with an automaton of its tokens: an
+ * occurrence of a token votes for the start of the group it would be
+ * part of, and the first start voted for by every token is the earliest
+ * match. The ring of votes holds the starts a group could still match
+ * at, so a sample is matched in one pass, in time linear in its length
+ * and the occurrences of the tokens.
+ */
+typedef struct {
+	tokmatch_t *tm;         /* of the tokens of the group */
+	int ntokens;
+	int *offset;            /* [ntokens], from the start of the group */
+	int *next;              /* [ntokens], next equal token or -1 */
+	unsigned char *text;    /* the tokens, one after the other */
+	int *at;                /* [ntokens], of each token in text */
+	int length;             /* of the group */
+	int skip;               /* bytes at least from the group before */
+} tokmatch_group_t;
+
+typedef struct {
+	int anchored;           /* the first group starts the sample */
+	int ngroups;
+	tokmatch_group_t *groups;
+	/* scratch space of a match */
+	int size;               /* power of 2, at least the longest group */
+	size_t *start;          /* [size], start voted for in each slot */
+	int *votes;             /* [size] */
+	unsigned *stamp;        /* [size], generation of each slot */
+	unsigned gen;
+} tokmatch_gap_t;
+
+/* Compiles the pattern of the n tokens, none of them empty, where token
+ * i comes skip[i] bytes after the one before, or at least that many if
+ * variable[i]. Returns NULL with errno set.
+ */
+tokmatch_gap_t *tokmatch_gap_new(const char **tokens, const int *lens,
+                                 const int *skip, const int *variable, int n);
+void tokmatch_gap_free(tokmatch_gap_t *gap);
+
+/* Returns 1 if the pattern matches s, otherwise 0. */
+int tokmatch_gap_match(tokmatch_gap_t *gap, const unsigned char *s,
+                       size_t len);
+
+#endif
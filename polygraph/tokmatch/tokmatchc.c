@@ -0,0 +1,479 @@
+/*
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+*/
+
+#include <Python.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include "tokmatch.h"
+
+/* a Bayes signature and the scratch space of the calls from Python,
+ * which the interpreter lock serializes
+ */
+typedef struct {
+	tokmatch_bayes_t *bayes;
+	tokmatch_work_t *work;
+} scorer_t;
+
+static void
+scorer_free(scorer_t *scorer)
+{
+	tokmatch_work_free(scorer->work);
+	tokmatch_bayes_free(scorer->bayes);
+	free(scorer);
+}
+
+static PyObject*
+py_bayes_new(PyObject* self, PyObject* args)
+{
+	PyObject *tokens, *scores, *tseq = NULL, *sseq = NULL, *item;
+	const char **strs = NULL;
+	int *lens = NULL, n, i;
+	double *values = NULL;
+	scorer_t *scorer = NULL;
+
+	if (!PyArg_ParseTuple(args, "OO:bayes_new", &tokens, &scores))
+		return NULL;
+	if ((tseq = PySequence_Fast(tokens, "tokens must be a list")) == NULL ||
+	    (sseq = PySequence_Fast(scores, "scores must be a list")) == NULL)
+		goto done;
+	n = PySequence_Fast_GET_SIZE(tseq);
+	if (PySequence_Fast_GET_SIZE(sseq) != n) {
+		PyErr_SetString(PyExc_ValueError, "one score per token");
+		goto done;
+	}
+	if ((strs = malloc((n + 1) * sizeof(char *))) == NULL ||
+	    (lens = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (values = malloc((n + 1) * sizeof(double))) == NULL) {
+		PyErr_NoMemory();
+		goto done;
+	}
+	for (i = 0; i < n; i++) {
+		item = PySequence_Fast_GET_ITEM(tseq, i);
+		if (!PyString_Check(item) || PyString_GET_SIZE(item) == 0) {
+			PyErr_SetString(PyExc_ValueError,
+			                "tokens must be non-empty strings");
+			goto done;
+		}
+		strs[i] = PyString_AS_STRING(item);
+		lens[i] = PyString_GET_SIZE(item);
+		values[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(sseq, i));
+		if (values[i] == -1 && PyErr_Occurred())
+			goto done;
+		if (!(values[i] > 0)) {
+			PyErr_SetString(PyExc_ValueError,
+			                "scores must be positive");
+			goto done;
+		}
+	}
+
+	if ((scorer = calloc(1, sizeof(scorer_t))) == NULL ||
+	    (scorer->bayes = tokmatch_bayes_new(strs, lens, values, n)) == NULL ||
+	    (scorer->work = tokmatch_work_new(scorer->bayes)) == NULL) {
+		if (scorer != NULL)
+			scorer_free(scorer);
+		scorer = NULL;
+		PyErr_SetFromErrno(PyExc_OSError);
+	}
+
+done:
+	Py_XDECREF(tseq);
+	Py_XDECREF(sseq);
+	free(strs);
+	free(lens);
+	free(values);
+	if (scorer == NULL)
+		return NULL;
+
+	/* return pointer to the handle */
+	return Py_BuildValue("l", (long)scorer);
+}
+
+static PyObject*
+py_bayes_free(PyObject* self, PyObject* args)
+{
+	scorer_t *scorer;
+
+	if (!PyArg_ParseTuple(args, "l:bayes_free", (long*)&scorer))
+		return NULL;
+	scorer_free(scorer);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_bayes_score(PyObject* self, PyObject* args)
+{
+	scorer_t *scorer;
+	const char *s;
+	int len;
+	double score;
+
+	if (!PyArg_ParseTuple(args, "ls#:bayes_score", (long*)&scorer,
+	                      &s, &len))
+		return NULL;
+	tokmatch_bayes_score(scorer->bayes, scorer->work,
+	                     (const unsigned char *)s, len,
+	                     -HUGE_VAL, HUGE_VAL, &score);
+	return PyFloat_FromDouble(score);
+}
+
+static PyObject*
+py_bayes_match(PyObject* self, PyObject* args)
+{
+	scorer_t *scorer;
+	const char *s;
+	int len, rv;
+	double threshold, score;
+
+	if (!PyArg_ParseTuple(args, "ls#d:bayes_match", (long*)&scorer,
+	                      &s, &len, &threshold))
+		return NULL;
+	rv = tokmatch_bayes_score(scorer->bayes, scorer->work,
+	                          (const unsigned char *)s, len,
+	                          threshold, threshold, &score);
+	if (rv == 0)
+		rv = score >= threshold ? TOKMATCH_ABOVE : TOKMATCH_BELOW;
+	return PyBool_FromLong(rv == TOKMATCH_ABOVE);
+}
+
+static PyObject*
+py_bayes_top(PyObject* self, PyObject* args)
+{
+	scorer_t *scorer;
+	char *data_name;
+	const void *buf;
+	int buflen, itemsize, k, nthreads = 1, n, i;
+	uint64_t *offsets;
+	uint32_t nstreams, j;
+	double *top;
+	PyObject *list;
+
+	if (!PyArg_ParseTuple(args, "lss#ii|i:bayes_top", (long*)&scorer,
+	                      &data_name, &buf, &buflen, &itemsize, &k,
+	                      &nthreads))
+		return NULL;
+	if ((itemsize != 4 && itemsize != 8) || buflen % itemsize != 0 ||
+	    buflen == 0) {
+		PyErr_SetString(PyExc_ValueError, "bad offsets array");
+		return NULL;
+	}
+	if (k < 1 || nthreads < 1) {
+		PyErr_SetString(PyExc_ValueError, "bad number of scores or threads");
+		return NULL;
+	}
+
+	/* the array ends with the data size */
+	nstreams = buflen / itemsize - 1;
+	if ((offsets = malloc(((size_t)nstreams + 1) * sizeof(uint64_t))) == NULL)
+		return PyErr_NoMemory();
+	for (j = 0; j <= nstreams; j++) {
+		if (itemsize == 4)
+			offsets[j] = ((const uint32_t *)buf)[j];
+		else
+			offsets[j] = ((const uint64_t *)buf)[j];
+	}
+	if ((top = malloc(k * sizeof(double))) == NULL) {
+		free(offsets);
+		return PyErr_NoMemory();
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	errno = 0;
+	n = tokmatch_bayes_top(scorer->bayes, data_name, offsets, nstreams, k,
+	                       nthreads, top);
+	Py_END_ALLOW_THREADS
+	free(offsets);
+	if (n < 0) {
+		free(top);
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, data_name);
+	}
+
+	if ((list = PyList_New(n)) != NULL) {
+		for (i = 0; i < n; i++)
+			PyList_SET_ITEM(list, i, PyFloat_FromDouble(top[i]));
+	}
+	free(top);
+	return list;
+}
+
+/* a signature set and room for the candidates of a scan */
+typedef struct {
+	tokmatch_set_t *set;
+	int *candidates;
+} screen_t;
+
+static void
+screen_free(screen_t *screen)
+{
+	tokmatch_set_free(screen->set);
+	free(screen->candidates);
+	free(screen);
+}
+
+static PyObject*
+py_set_new(PyObject* self, PyObject* args)
+{
+	PyObject *tokens, *sigs, *weights, *need, *item;
+	PyObject *tseq = NULL, *sseq = NULL, *wseq = NULL, *nseq = NULL;
+	const char **strs = NULL;
+	int *lens = NULL, *sig_of = NULL, n, nsigs, i;
+	double *values = NULL, *needs = NULL;
+	screen_t *screen = NULL;
+
+	if (!PyArg_ParseTuple(args, "OOOO:set_new", &tokens, &sigs, &weights,
+	                      &need))
+		return NULL;
+	if ((tseq = PySequence_Fast(tokens, "tokens must be a list")) == NULL ||
+	    (sseq = PySequence_Fast(sigs, "sigs must be a list")) == NULL ||
+	    (wseq = PySequence_Fast(weights, "weights must be a list")) == NULL ||
+	    (nseq = PySequence_Fast(need, "need must be a list")) == NULL)
+		goto done;
+	n = PySequence_Fast_GET_SIZE(tseq);
+	nsigs = PySequence_Fast_GET_SIZE(nseq);
+	if (PySequence_Fast_GET_SIZE(sseq) != n ||
+	    PySequence_Fast_GET_SIZE(wseq) != n) {
+		PyErr_SetString(PyExc_ValueError,
+		                "one signature and weight per token");
+		goto done;
+	}
+	if ((strs = malloc((n + 1) * sizeof(char *))) == NULL ||
+	    (lens = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (sig_of = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (values = malloc((n + 1) * sizeof(double))) == NULL ||
+	    (needs = malloc((nsigs + 1) * sizeof(double))) == NULL) {
+		PyErr_NoMemory();
+		goto done;
+	}
+	for (i = 0; i < n; i++) {
+		item = PySequence_Fast_GET_ITEM(tseq, i);
+		if (!PyString_Check(item) || PyString_GET_SIZE(item) == 0) {
+			PyErr_SetString(PyExc_ValueError,
+			                "tokens must be non-empty strings");
+			goto done;
+		}
+		strs[i] = PyString_AS_STRING(item);
+		lens[i] = PyString_GET_SIZE(item);
+		sig_of[i] = PyInt_AsLong(PySequence_Fast_GET_ITEM(sseq, i));
+		if (sig_of[i] == -1 && PyErr_Occurred())
+			goto done;
+		if (sig_of[i] < 0 || sig_of[i] >= nsigs) {
+			PyErr_SetString(PyExc_ValueError, "no such signature");
+			goto done;
+		}
+		values[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(wseq, i));
+		if (values[i] == -1 && PyErr_Occurred())
+			goto done;
+		if (!(values[i] > 0)) {
+			PyErr_SetString(PyExc_ValueError,
+			                "weights must be positive");
+			goto done;
+		}
+	}
+	for (i = 0; i < nsigs; i++) {
+		needs[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(nseq, i));
+		if (needs[i] == -1 && PyErr_Occurred())
+			goto done;
+	}
+
+	if ((screen = calloc(1, sizeof(screen_t))) == NULL ||
+	    (screen->candidates = malloc((nsigs + 1) * sizeof(int))) == NULL ||
+	    (screen->set = tokmatch_set_new(strs, lens, sig_of, values, n,
+	                                    needs, nsigs)) == NULL) {
+		if (screen != NULL)
+			screen_free(screen);
+		screen = NULL;
+		PyErr_SetFromErrno(PyExc_OSError);
+	}
+
+done:
+	Py_XDECREF(tseq);
+	Py_XDECREF(sseq);
+	Py_XDECREF(wseq);
+	Py_XDECREF(nseq);
+	free(strs);
+	free(lens);
+	free(sig_of);
+	free(values);
+	free(needs);
+	if (screen == NULL)
+		return NULL;
+
+	/* return pointer to the handle */
+	return Py_BuildValue("l", (long)screen);
+}
+
+static PyObject*
+py_set_free(PyObject* self, PyObject* args)
+{
+	screen_t *screen;
+
+	if (!PyArg_ParseTuple(args, "l:set_free", (long*)&screen))
+		return NULL;
+	screen_free(screen);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_set_scan(PyObject* self, PyObject* args)
+{
+	screen_t *screen;
+	const char *s;
+	int len, n, i;
+	PyObject *tuple;
+
+	if (!PyArg_ParseTuple(args, "ls#:set_scan", (long*)&screen, &s, &len))
+		return NULL;
+	n = tokmatch_set_scan(screen->set, (const unsigned char *)s, len,
+	                      screen->candidates);
+	if ((tuple = PyTuple_New(n)) == NULL)
+		return NULL;
+	for (i = 0; i < n; i++)
+		PyTuple_SET_ITEM(tuple, i, PyInt_FromLong(screen->candidates[i]));
+	return tuple;
+}
+
+static PyObject*
+py_gap_new(PyObject* self, PyObject* args)
+{
+	PyObject *tokens, *skips, *variable, *item;
+	PyObject *tseq = NULL, *sseq = NULL, *vseq = NULL;
+	const char **strs = NULL;
+	int *lens = NULL, *skip = NULL, *var = NULL, n, i;
+	tokmatch_gap_t *gap = NULL;
+
+	if (!PyArg_ParseTuple(args, "OOO:gap_new", &tokens, &skips, &variable))
+		return NULL;
+	if ((tseq = PySequence_Fast(tokens, "tokens must be a list")) == NULL ||
+	    (sseq = PySequence_Fast(skips, "skips must be a list")) == NULL ||
+	    (vseq = PySequence_Fast(variable, "variable must be a list")) == NULL)
+		goto done;
+	n = PySequence_Fast_GET_SIZE(tseq);
+	if (PySequence_Fast_GET_SIZE(sseq) != n ||
+	    PySequence_Fast_GET_SIZE(vseq) != n) {
+		PyErr_SetString(PyExc_ValueError, "one gap per token");
+		goto done;
+	}
+	if ((strs = malloc((n + 1) * sizeof(char *))) == NULL ||
+	    (lens = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (skip = malloc((n + 1) * sizeof(int))) == NULL ||
+	    (var = malloc((n + 1) * sizeof(int))) == NULL) {
+		PyErr_NoMemory();
+		goto done;
+	}
+	for (i = 0; i < n; i++) {
+		item = PySequence_Fast_GET_ITEM(tseq, i);
+		if (!PyString_Check(item) || PyString_GET_SIZE(item) == 0) {
+			PyErr_SetString(PyExc_ValueError,
+			                "tokens must be non-empty strings");
+			goto done;
+		}
+		strs[i] = PyString_AS_STRING(item);
+		lens[i] = PyString_GET_SIZE(item);
+		skip[i] = PyInt_AsLong(PySequence_Fast_GET_ITEM(sseq, i));
+		if (skip[i] == -1 && PyErr_Occurred())
+			goto done;
+		if (skip[i] < 0) {
+			PyErr_SetString(PyExc_ValueError,
+			                "skips must not be negative");
+			goto done;
+		}
+		if ((var[i] = PyObject_IsTrue(PySequence_Fast_GET_ITEM(vseq,
+		                                                        i))) < 0)
+			goto done;
+	}
+
+	if ((gap = tokmatch_gap_new(strs, lens, skip, var, n)) == NULL)
+		PyErr_SetFromErrno(PyExc_OSError);
+
+done:
+	Py_XDECREF(tseq);
+	Py_XDECREF(sseq);
+	Py_XDECREF(vseq);
+	free(strs);
+	free(lens);
+	free(skip);
+	free(var);
+	if (gap == NULL)
+		return NULL;
+
+	/* return pointer to the handle */
+	return Py_BuildValue("l", (long)gap);
+}
+
+static PyObject*
+py_gap_free(PyObject* self, PyObject* args)
+{
+	tokmatch_gap_t *gap;
+
+	if (!PyArg_ParseTuple(args, "l:gap_free", (long*)&gap))
+		return NULL;
+	tokmatch_gap_free(gap);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject*
+py_gap_match(PyObject* self, PyObject* args)
+{
+	tokmatch_gap_t *gap;
+	const char *s;
+	int len;
+
+	if (!PyArg_ParseTuple(args, "ls#:gap_match", (long*)&gap, &s, &len))
+		return NULL;
+	return PyBool_FromLong(tokmatch_gap_match(gap,
+	                                          (const unsigned char *)s,
+	                                          len));
+}
+
+static PyMethodDef tokmatchc_funcs[] = {
+	{"bayes_new", (PyCFunction)py_bayes_new, METH_VARARGS,
+	 "bayes_new(tokens, scores): handle of a compiled Bayes signature"},
+	{"bayes_free", (PyCFunction)py_bayes_free, METH_VARARGS,
+	 "bayes_free(handle)"},
+	{"bayes_score", (PyCFunction)py_bayes_score, METH_VARARGS,
+	 "bayes_score(handle, sample): bayes.Bayes.score"},
+	{"bayes_match", (PyCFunction)py_bayes_match, METH_VARARGS,
+	 "bayes_match(handle, sample, threshold): score >= threshold, "
+	 "scanning no further than needed to tell"},
+	{"bayes_top", (PyCFunction)py_bayes_top, METH_VARARGS,
+	 "bayes_top(handle, data_name, offsets, itemsize, k, nthreads=1): "
+	 "the k highest scores of the streams, lowest first"},
+	{"set_new", (PyCFunction)py_set_new, METH_VARARGS,
+	 "set_new(tokens, sigs, weights, need): handle of a set of signatures, "
+	 "token i being of signature sigs[i]"},
+	{"set_free", (PyCFunction)py_set_free, METH_VARARGS,
+	 "set_free(handle)"},
+	{"set_scan", (PyCFunction)py_set_scan, METH_VARARGS,
+	 "set_scan(handle, sample): the signatures sample may match"},
+	{"gap_new", (PyCFunction)py_gap_new, METH_VARARGS,
+	 "gap_new(tokens, skips, variable): handle of a gap pattern, token i "
+	 "coming skips[i] bytes, or at least that many if variable[i], "
+	 "after the one before"},
+	{"gap_free", (PyCFunction)py_gap_free, METH_VARARGS,
+	 "gap_free(handle)"},
+	{"gap_match", (PyCFunction)py_gap_match, METH_VARARGS,
+	 "gap_match(handle, sample): whether the pattern matches sample"},
+	{NULL}
+};
+
+void inittokmatchc(void)
+{
+	Py_InitModule3(
+		"tokmatchc",
+		tokmatchc_funcs,
+		"one pass token matching of signatures"
+	);
+}
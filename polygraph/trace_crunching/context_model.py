@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+
+from __future__ import division
+import sys
+import polygraph.util.ctxmodelc as ctxmodelc
+import polygraph.trace_crunching.stream_trace as stream_trace
+
+# first bytes of a model file, see polygraph/ctxmodel/ctxmodel.h
+MAGIC = 'PGCTXMD1'
+
+def build(streamfile, model_name, windowsize, jobs=1, budget=0):
+    """Write the context statistics of the streams of streamfile, for
+    contexts of fewer than windowsize bytes, to model_name. The
+    streams are split in jobs shards counted in parallel.
+
+    With a budget, in bytes, the model is approximate and about that
+    size: the frequent strings are counted exactly and the others in
+    a count-min sketch (see ContextModel.error_bound). Each job needs
+    the budget in memory, however large the trace. A budget under 32KB
+    is too small for the sketch, and raises ValueError."""
+    trace = stream_trace.StreamTrace(streamfile)
+    ctxmodelc.build(streamfile + '/data', trace.offsets,
+                    trace.offsets.itemsize, windowsize, model_name, jobs,
+                    budget)
+
+class ContextModel(object):
+    """A context model written by build, mapped rather than loaded.
+
+    It can stand in for the statistics dictionary of
+    priorprob.PortInfo: model[context]['count'] and
+    model[context]['bytes'][byte] are the same, and
+    sigprob.contextprob uses the native lookup.
+
+    The counts of an approximate model may be too high, never too low;
+    error_bound says by how much."""
+    def __init__(self, model_name):
+        self.model = None
+        self.model_name = model_name
+        self.model = ctxmodelc.open(model_name)
+        (self.windowsize, self.strings, self.numstreams, self.numbytes) = \
+              ctxmodelc.info(self.model)
+        self.approximate = self.error_bound()[0] > 0
+
+    def __reduce__(self):
+        # the model is a handle to a mapping; pickle the file name
+        return (ContextModel, (self.model_name,))
+
+    def __del__(self):
+        if self.model:
+            ctxmodelc.close(self.model)
+            self.model = None
+
+    def error_bound(self):
+        """(error, confidence): a count exceeds the true one by at most
+        error with probability confidence. (0, 1) for an exact model."""
+        return ctxmodelc.error(self.model)
+
+    def contextprob(self, context, byte, max_context=2):
+        return ctxmodelc.prob(self.model, context, byte, max_context)
+
+    def count(self, context):
+        """number of times context is followed by a byte"""
+        if len(context) >= self.windowsize:
+            return 0
+        return ctxmodelc.lookup(self.model, context)[1]
+
+    def byte_count(self, context, byte):
+        """number of times context is followed by byte"""
+        return ctxmodelc.lookup(self.model, context + byte)[0]
+
+    def has_key(self, context):
+        return self.count(context) > 0
+
+    def __getitem__(self, context):
+        count = self.count(context)
+        if count == 0:
+            raise KeyError(context)
+        bytes = {}
+        for b in xrange(256):
+            n = self.byte_count(context, chr(b))
+            if n > 0:
+                bytes[chr(b)] = n
+        return {'count': count, 'bytes': bytes}
+
+def load(statsfile):
+    """The training statistics in statsfile: a ContextModel, or the
+    pickled dictionary written by older versions of priorprob."""
+    f = open(statsfile, 'rb')
+    magic = f.read(len(MAGIC))
+    if magic == MAGIC:
+        f.close()
+        return ContextModel(statsfile)
+    import pickle
+    f.seek(0)
+    stats = pickle.load(f)
+    f.close()
+    return stats
+
+if __name__ == "__main__":
+    args = sys.argv[1:]
+    budget = 0
+    if args and args[0].startswith('--budget='):
+        # in megabytes
+        budget = int(float(args[0][len('--budget='):]) * 1024 * 1024)
+        args = args[1:]
+    if len(args) < 3:
+        print "Usage: %s [--budget=MB] windowsize streamfile model [jobs]" % \
+              sys.argv[0]
+        sys.exit(1)
+    jobs = 1
+    if len(args) > 3:
+        jobs = int(args[3])
+    build(args[1], args[2], int(args[0]), jobs, budget)
+    if budget:
+        (error, confidence) = ContextModel(args[2]).error_bound()
+        print "counts over by at most %d with probability %.3f" % \
+              (error, confidence)
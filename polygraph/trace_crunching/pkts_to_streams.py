@@ -12,12 +12,16 @@
 
 from __future__ import division
 from __future__ import generators
-import pcapy
-import impacket.ImpactPacket
-import impacket.ImpactDecoder
 import sys
 import string
 
+# native reassembler; pcapy and impacket are then only needed for
+# traces processed with a filter
+try:
+    import polygraph.util.pktstreamsc as pktstreamsc
+except ImportError:
+    pktstreamsc = None
+
 # def parse_ip4(hdr, offset):
 #     import struct
 #     rv = {}
@@ -48,6 +52,10 @@ import string
 #     return rv
 
 def _get_next_pkt(tracer, save_data):
+    import pcapy
+    import impacket.ImpactPacket
+    import impacket.ImpactDecoder
+
     # set up decoder
     assert(tracer.datalink() == pcapy.DLT_EN10MB) #assuming ethernet
     decoder = impacket.ImpactDecoder.EthDecoder()
@@ -156,20 +164,43 @@ def process_trace(trace_name, callback=print_stream, timeout=2000, filter=None,
 
     callback may raise an IndexError exception to halt processing
     of the trace.
+
+    Unless a filter is given, this is done by the native reassembler,
+    which gives the same streams in the same order.
     """
 
-    streams = [] # stream q - most recent at 0
-    now = 0          # current time
-    tracer = pcapy.open_offline(trace_name)
+    process_traces([trace_name], callback, timeout, filter, save_data)
+
+def _trace_pkts(trace_names, filter, save_data):
+    import pcapy
+    for trace_name in trace_names:
+        tracer = pcapy.open_offline(trace_name)
+        if filter:
+            tracer.setfilter(filter)
+        while(True):
+            pkt = _get_next_pkt(tracer, save_data)
+            if(pkt == None):
+                break
+            yield pkt
+
+def process_traces(trace_names, callback=print_stream, timeout=2000,
+                   filter=None, save_data=True):
+    """
+    As process_trace, over libpcap files taken one after the other, as
+    a capture tool writes them when it rotates its output. Connections
+    still open at the end of one file go on in the next, so a stream
+    split across files is passed to callback whole.
+    """
 
-    if filter:
-        tracer.setfilter(filter)
+    if pktstreamsc and not filter:
+        pktstreamsc.process_trace(list(trace_names), callback, timeout,
+                                  save_data)
+        return
 
-    while(True):
-        pkt = _get_next_pkt(tracer, save_data)
-        if(pkt == None):
-            break
+    streams = [] # stream q - most recent at 0
+    now = 0          # current time
 
+    for pkt in _trace_pkts(trace_names, filter, save_data):
         now = pkt["ts"][-1]
 
         # process udp packets individually
@@ -225,6 +256,57 @@ def process_trace(trace_name, callback=print_stream, timeout=2000, filter=None,
         except IndexError:
             return
 
+def write_streams(trace_names, datafile, off_file, offset, timeout=2000,
+                  jobs=1, meta_file=None):
+    """
+    Append the payload of each stream of the libpcap file trace_names
+    to datafile, and its offset to off_file, as in a streamfile (see
+    stream_trace.create). With meta_file, the connection of each stream
+    is written to it too. Streams without payload are skipped. The
+    files must be open for appending. Returns the offset after the last
+    stream.
+
+    trace_names may also be a list of files, whose streams are
+    stitched as by process_traces. With jobs > 1 the native
+    reassembler spreads the connections over that many threads; the
+    streams are the same but come out grouped by thread rather than
+    in the order they finish.
+    """
+    import polygraph.trace_crunching.stream_trace as stream_trace
+
+    if type(trace_names) == type(""):
+        trace_names = [trace_names]
+
+    if pktstreamsc:
+        datafile.flush()
+        off_file.flush()
+        meta_name = None
+        if meta_file:
+            meta_file.flush()
+            meta_name = meta_file.name
+        return pktstreamsc.write_streams(list(trace_names), datafile.name,
+                                         off_file.name, offset, timeout, jobs,
+                                         meta_name)
+
+    offsets = [offset]
+    def callback(stream):
+        import struct, socket
+        if len(stream['data']) > 0:
+            off_file.write(struct.pack(stream_trace.OFFSET_FORMAT,
+                                       offsets[0]))
+            datafile.write(stream['data'])
+            offsets[0] += len(stream['data'])
+            if meta_file:
+                (src, dst, sport, dport) = stream['connection']
+                meta_file.write(struct.pack(stream_trace.META_FORMAT,
+                    socket.inet_aton(src), socket.inet_aton(dst),
+                    sport, dport,
+                    list(stream_trace.STREAM_TYPES).index(stream['type']),
+                    list(stream_trace.STREAM_STATUSES).index(stream['status']),
+                    stream['pkts'], stream['ts'][0], stream['ts'][-1]))
+    process_traces(trace_names, callback=callback, timeout=timeout)
+    return offsets[0]
+
 if __name__ == "__main__":
     assert len(sys.argv) > 1
     for fname in sys.argv[1:]:
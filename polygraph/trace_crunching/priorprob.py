@@ -105,6 +105,17 @@ class Counters:
         return self.ctrs.has_key(port)
 
 if __name__ == "__main__":
+    # with --ctx, the native builder writes a mapped model, port.0.ctx,
+    # in a small fraction of the time, instead of port.0.pickle and the
+    # port.0 report; see context_model.py
+    if len(sys.argv) > 1 and sys.argv[1] == '--ctx':
+        import polygraph.trace_crunching.context_model as context_model
+        jobs = 1
+        if len(sys.argv) > 4:
+            jobs = int(sys.argv[4])
+        context_model.build(sys.argv[3], "port.0.ctx", int(sys.argv[2]), jobs)
+        sys.exit()
+
     import stream_trace
     windowsize = int(sys.argv[1])
     counters = Counters(windowsize)
@@ -14,6 +14,9 @@ from __future__ import division
 import sys
 import string
 
+# context_model.build with a memory budget bounds the size of long
+# context models without pruning them; see context_model.py
+
 class PortInfo:
     def __init__(self, port, windowsize):
         self.contexts = {}
@@ -15,18 +15,35 @@ import sys
 import os
 import struct
 import polygraph.util.pysary as pysary
+import polygraph.util.sarytracec as sarytracec
+import polygraph.trace_crunching.stream_trace as stream_trace
+
+# number of search results each TraceSary keeps
+CACHE_SIZE = 4096
 
 class TraceSary(object):
-    def __init__(self, streamfile):
-        # for offsets file
-        self.f = None
-        self.mx = None
-        self.offsets_length = None
+    def __init__(self, streamfile, cache_file=None):
+        # stream boundaries, mapped when first needed
+        self.streamfile = streamfile
+        self.streams = None
 
 #        self.sary_file = streamfile + '.sarray/data'
 #        self.offsets_file = streamfile + '.sarray/offsets'
         self.sary_file = streamfile + '/data'
         self.offsets_file = streamfile + '/offsets'
+        self.length = os.path.getsize(self.sary_file)
+
+        # a streamfile built with 'reconstruct_streams --fmindex' has an
+        # FM-index instead of the sary array; it answers the same counts
+        # in a fraction of the memory. see build_fm_index
+        self.fm_file = self.sary_file + '.fmi'
+        self.fm = None
+        self.sary = None
+        self.trace = None
+        if os.path.exists(self.fm_file):
+            self.fm = sarytracec.fm_open(self.sary_file, self.fm_file)
+            self.numstreams = sarytracec.fm_numstreams(self.fm)
+            return
 
         self.sary = pysary.saryer_new(self.sary_file)
         if self.sary == 'NULL':
@@ -35,68 +52,125 @@ class TraceSary(object):
             raise exceptions.Exception("Couldn't open sarray %s for %s" % \
                   (self.sary_file, streamfile))
 
-        self.numstreams = int(os.path.getsize(self.offsets_file) / 4)
-        self.length = os.path.getsize(self.sary_file)
+        # searches use the LCP table written by 'mksary --lcp' when it is
+        # present and matches the array, plain binary search otherwise.
+        self.lcp_file = self.sary_file + '.ary.lcp'
+        self.has_lcp = pysary.saryer_enable_lcp(self.sary, self.lcp_file)
+
+        # the prefix bucket table written by 'mksary --bucket' starts
+        # each search in the range of the token's first bytes, and the
+        # LCP table is then searched within that range, which is faster
+        # still and touches far fewer pages of a large array
+        self.bucket_file = self.sary_file + '.ary.bkt'
+        self.has_bucket = pysary.saryer_enable_bucket(self.sary,
+                                                      self.bucket_file)
+
+        # remember recent search results. with cache_file, the results
+        # are kept in that file and shared with every process opening
+        # the same streamfile with it, e.g. parallel training jobs. by
+        # default that is data.ary.cache in the streamfile, if there is
+        # one (see 'reconstruct_streams --shared-cache').
+        if cache_file is None and \
+               os.path.exists(self.sary_file + '.ary.cache'):
+            cache_file = self.sary_file + '.ary.cache'
+        if not cache_file or \
+               not pysary.saryer_enable_shared_cache(self.sary, cache_file,
+                                                     CACHE_SIZE):
+            pysary.saryer_enable_cache2(self.sary, CACHE_SIZE)
+
+        # document index (suffix rank -> stream) for counting distinct
+        # streams; see build_doc_index
+        self.doc_file = self.sary_file + '.ary.doc'
+        self.trace = sarytracec.open(self.sary_file, self.sary_file + '.ary')
+
+        if sarytracec.has_docs(self.trace):
+            self.numstreams = sarytracec.numstreams(self.trace)
+        else:
+            self.numstreams = \
+                stream_trace.StreamTrace(streamfile).numstreams()
 
 
     def __del__(self):
         if self.sary:
             pysary.saryer_destroy(self.sary)
             self.sary = None
-        if self.mx:
-#            self.mx.close()
-#            os.close(self.f)
-            self.f.close()
+        if getattr(self, 'trace', None):
+            sarytracec.close(self.trace)
+            self.trace = None
+        if getattr(self, 'fm', None):
+            sarytracec.fm_close(self.fm)
+            self.fm = None
 
     def offset_to_index(self, offset, start=0):
-        import mmap, os, struct
-#        fname = streamfile + '.sarray/offsets'
-
-        if not self.mx:
-            self.offsets_length = os.path.getsize(self.offsets_file)
-            self.f = open(self.offsets_file)
-#            self.f = os.open(self.offsets_file, os.O_RDWR)
-#            self.mx = mmap.mmap(self.f, self.offsets_length)
-            self.mx = self.f.read()
-
-        def value(x):
-            return struct.unpack('l', self.mx[x*4:(x+1)*4])[0]
-
-        startvalue = value(start)
-        end = int(self.offsets_length / 4) 
-#       endvalue = value(end)
-        while True:
-            current = int((end + start)/ 2) 
-#           (thisone,) = struct.unpack('l', mx[(current*4):(current+1)*4])
-            thisone = value(current)
-#           print start,end, current, thisone
-
-            if current == int(self.offsets_length / 4 - 1):
-                # eof
-                nextone = None 
-                break
-
-            nextone = value(current+1)
-            if thisone <= offset < nextone:
-                break
-            elif end == (start + 1):
-                end += 1
-            elif offset < thisone:
-                end = current
-            elif offset >= nextone:
-                start = current
-            else:
-                assert(False)
-
-        return (current, nextone)
+        """(stream holding data byte offset, start of the next stream
+        or None for the last one)"""
+        if not self.streams:
+            self.streams = stream_trace.StreamTrace(self.streamfile)
+        return self.streams.stream_of(offset)
 
     def token_count(self, token):
+        if self.fm:
+            return sarytracec.fm_count(self.fm, token)
 #        if not pysary.saryer_search2(self.sary, token, len(token)):
         if not pysary.saryer_search2(self.sary, token):
             return 0
         return pysary.saryer_count_occurrences(self.sary)
 
+    def token_counts(self, tokens, unique=False):
+        """Counts of a list of tokens, in one call. Tokens sharing a
+        prefix share the search for it, so this is much cheaper than
+        calling token_count on each substring of a token. With unique,
+        counts distinct streams; that needs the document index."""
+        if self.fm:
+            return sarytracec.fm_count_many(self.fm, tokens, unique)
+        return sarytracec.count_many(self.trace, tokens, unique)
+
+    def mpp(self, token, minprob=1, minlen=1, unique=False):
+        """tokensplit.mpp of a non-empty token: (probability, [(start,
+        end), ...] of the pieces). The counts of the substrings of the
+        token and the split are computed natively, extending the
+        search for each start, or end with an FM-index, a byte at a
+        time. unique needs the document index."""
+        if self.fm:
+            return sarytracec.fm_mpp(self.fm, token, self.numstreams,
+                                     minprob, minlen, unique)
+        return sarytracec.mpp(self.trace, token, self.numstreams,
+                              minprob, minlen, unique)
+
+    def has_doc_index(self):
+        # the FM-index always counts distinct streams
+        if self.fm:
+            return True
+        return sarytracec.has_docs(self.trace)
+
+    def build_doc_index(self):
+        """Write the document index used by token_count_unique.
+        The offset size is only used for streamfiles older than the
+        versioned offsets format."""
+        sarytracec.build_docs(self.sary_file, self.sary_file + '.ary',
+                              self.offsets_file, struct.calcsize('L'),
+                              self.doc_file)
+        sarytracec.close(self.trace)
+        self.trace = sarytracec.open(self.sary_file, self.sary_file + '.ary')
+        self.numstreams = sarytracec.numstreams(self.trace)
+
+    def build_fm_index(self):
+        """Write the FM-index of the streamfile from its sary array.
+        Once it exists, the array, its LCP table and document index
+        are no longer used and may be removed."""
+        sarytracec.build_fm(self.sary_file, self.sary_file + '.ary',
+                            self.offsets_file, struct.calcsize('L'),
+                            self.fm_file)
+
     def token_count_unique(self, token, estimate=False):
+        if self.fm:
+            return sarytracec.fm_count_unique(self.fm, token)
+
+        # exact, and without visiting the occurrences, if the
+        # streamfile has a document index
+        if sarytracec.has_docs(self.trace):
+            return sarytracec.count_unique(self.trace, token)
+
 #        if not pysary.saryer_search2(self.sary, token, len(token)):
         if not pysary.saryer_search2(self.sary, token):
             return 0
@@ -124,6 +198,40 @@ class TraceSary(object):
 
         return uniquecount
 
+def bucket_width(size):
+    """Prefix length of the bucket table for a streamfile of size bytes.
+    3 byte prefixes take a 64MB table, worth it only once the suffix
+    array is several times larger."""
+    if size >= 64 * 1024 * 1024:
+        return 3
+    return 2
+
+open_traces = {} # memoize
+def open_trace(streamfile, cache_file=None):
+    """A TraceSary of streamfile, opened once per process. Use this
+    rather than TraceSary when looking up tokens a few at a time, so
+    that the index is not mapped again for each lookup and repeated
+    searches hit the cache."""
+    if not open_traces.has_key(streamfile):
+        open_traces[streamfile] = TraceSary(streamfile, cache_file)
+    return open_traces[streamfile]
+
+def append_streams(streamfile, old_size):
+    """Update the suffix array and LCP table of a streamfile after
+    streams were appended to its data, which held old_size bytes when
+    the array was built. Only the new suffixes are sorted, but the
+    merged array is written out whole, and the LCP and bucket tables
+    are rebuilt by full passes over it, so the time is still linear in
+    the whole streamfile; what is saved is sorting the old suffixes
+    again. The document index must be rebuilt afterwards."""
+    if open_traces.has_key(streamfile):
+        del open_traces[streamfile]
+    data = streamfile + '/data'
+    sarytracec.append(data, data + '.ary', old_size)
+    sarytracec.build_lcp(data, data + '.ary', data + '.ary.lcp')
+    sarytracec.build_bucket(data, data + '.ary', data + '.ary.bkt',
+                            bucket_width(os.path.getsize(data)))
+
 #
 #if __name__ == "__main__":
 #    import polygraph.trace_crunching.stream_trace as stream_trace
@@ -60,57 +60,201 @@ def regex_count(pattern, streamfile):
         stream = trace.next()
     return (count, total)
 
+# Streamfile format. A streamfile is a directory holding
+#   data     the payloads of the streams, one after the other
+#   offsets  a 16 byte header, then the start of each stream in data as
+#            a little endian 64 bit integer
+#   meta     optional, a record of META_FORMAT per stream
+# The header is MAGIC, then little endian 32 bit version and flags.
+# Offsets files written before the header was introduced hold native
+# unsigned longs and no header; StreamTrace still reads them, and
+# upgrade() converts them.
+MAGIC = 'PGSTREAM'
+VERSION = 1
+HEADER_FORMAT = '<8sII'
+HEADER_LEN = struct.calcsize(HEADER_FORMAT)
+OFFSET_FORMAT = '<Q'
+OFFSET_LEN = struct.calcsize(OFFSET_FORMAT)
+FLAG_META = 1
+
+# src and dst addresses (network order), src and dst ports, type,
+# status, packets, time stamps of the first and last packets
+META_FORMAT = '<4s4sHHBBxxIxxxxdd'
+META_LEN = struct.calcsize(META_FORMAT)
+STREAM_TYPES = ('tcp', 'udp')
+STREAM_STATUSES = ('open', 'fin', 'rst', 'udp', 'timeout')
+
+def _header(flags):
+    return struct.pack(HEADER_FORMAT, MAGIC, VERSION, flags)
+
+def _read_header(offname):
+    """(header length, offset format, flags) of an offsets file"""
+    f = open(offname, 'rb')
+    head = f.read(HEADER_LEN)
+    f.close()
+    if len(head) == HEADER_LEN and head[:len(MAGIC)] == MAGIC:
+        (magic, version, flags) = struct.unpack(HEADER_FORMAT, head)
+        if version != VERSION:
+            import exceptions
+            raise exceptions.Exception("Unsupported streamfile version %d in %s" % \
+                  (version, offname))
+        return (HEADER_LEN, OFFSET_FORMAT, flags)
+    return (0, 'L', 0)
+
+def create(dirname, meta=False):
+    """Make a new, empty streamfile. Returns its data, offsets and
+    meta files open for writing; meta is None unless asked for."""
+    import os
+    os.mkdir(dirname)
+    datafile = open(dirname + '/data', 'wb')
+    off_file = open(dirname + '/offsets', 'wb')
+    meta_file = None
+    flags = 0
+    if meta:
+        meta_file = open(dirname + '/meta', 'wb')
+        flags |= FLAG_META
+    off_file.write(_header(flags))
+    off_file.flush()
+    return (datafile, off_file, meta_file)
+
+def upgrade(dirname):
+    """Rewrite the offsets file of a streamfile without a header in the
+    current format. The data and any index built on it are unchanged."""
+    import os
+    offname = dirname + '/offsets'
+    (header_len, fmt, flags) = _read_header(offname)
+    if header_len:
+        return
+    old = open(offname, 'rb').read()
+    size = struct.calcsize(fmt)
+    out = [_header(0)]
+    for i in xrange(0, len(old) - size + 1, size):
+        out.append(struct.pack(OFFSET_FORMAT,
+                               struct.unpack(fmt, old[i:i+size])[0]))
+    f = open(offname + '.tmp', 'wb')
+    f.write(''.join(out))
+    f.close()
+    os.rename(offname + '.tmp', offname)
+
+def open_append(dirname):
+    """Open an existing streamfile to add streams to it, as create
+    does, upgrading its offsets file first if needed."""
+    upgrade(dirname)
+    (header_len, fmt, flags) = _read_header(dirname + '/offsets')
+    datafile = open(dirname + '/data', 'ab')
+    off_file = open(dirname + '/offsets', 'ab')
+    meta_file = None
+    if flags & FLAG_META:
+        meta_file = open(dirname + '/meta', 'ab')
+    return (datafile, off_file, meta_file)
+
+def _read_offsets(offname, start, fmt, data_len):
+    """The offsets of an offsets file from byte start on, as an array
+    ending with data_len."""
+    import array
+    raw = open(offname, 'rb').read()[start:]
+    size = struct.calcsize(fmt)
+    offsets = array.array('L')
+    if offsets.itemsize == size and \
+           (fmt == 'L' or struct.pack('L', 1) == struct.pack('<Q', 1)):
+        offsets.fromstring(raw[:len(raw) - len(raw) % size])
+    else:
+        for i in xrange(0, len(raw) - size + 1, size):
+            offsets.append(struct.unpack(fmt, raw[i:i+size])[0])
+    offsets.append(data_len)
+    return offsets
+
+def _map(fname):
+    import mmap, os
+    f = open(fname, 'rb')
+    size = os.fstat(f.fileno()).st_size
+    if size == 0:
+        # mmap refuses empty files
+        f.close()
+        return ''
+    m = mmap.mmap(f.fileno(), size, access=mmap.ACCESS_READ)
+    f.close()
+    return m
+
 class StreamTrace(object):
-#    def __init__(self, filename):
-#        self.tracefile = open(filename)
-#        self.longlen = struct.calcsize('I')
-#    def next(self):
-#        packed_length = self.tracefile.read(self.longlen)
-#        if len(packed_length) != self.longlen:
-#            self.tracefile.close()
-#            return None
-#        (length,) = struct.unpack('I', packed_length)
-#        stream = self.tracefile.read(length)
-#        assert(len(stream) == length)
-#        return stream
-    def __init__(self, filename):
+    """The streams of a streamfile, read through a memory map of its
+    data, so that scanning a trace does no reads or seeks of its own.
+    The offsets are read into an array of 8 bytes per stream.
+
+    next() returns each stream in turn as a string; with zero_copy it
+    returns a buffer into the map instead, which the re module and the
+    C extensions accept without copying the stream. stream(i) and
+    buffer(i) get stream i in constant time."""
+    def __init__(self, filename, zero_copy=False):
         self.filename = filename
-        self.tracefile = open(filename + '/data')
-        self.offsetsfile = open(filename + '/offsets')
+        self.zero_copy = zero_copy
+        offname = filename + '/offsets'
+        (off_start, off_fmt, self.flags) = _read_header(offname)
+        self.data = _map(filename + '/data')
+        self.offsets = _read_offsets(offname, off_start, off_fmt,
+                                     len(self.data))
+        self.count = len(self.offsets) - 1
+        self.meta_map = None
+        if self.flags & FLAG_META:
+            self.meta_map = _map(filename + '/meta')
+
+        if self.count > 0 and self.offsets[0] != 0:
+            import exceptions
+            raise exceptions.Exception('Invalid offsets file %s' % offname)
+        self.index = 0
+
+    def span(self, i):
+        """(start, end) of stream i in the data"""
+        return (self.offsets[i], self.offsets[i + 1])
+
+    def stream(self, i):
+        return self.data[self.offsets[i]:self.offsets[i + 1]]
+
+    def buffer(self, i):
+        start = self.offsets[i]
+        return buffer(self.data, start, self.offsets[i + 1] - start)
 
-        longlen = struct.calcsize('L')
-        (self.last_off,) = struct.unpack('L', self.offsetsfile.read(longlen))
-        if self.last_off != 0:
-            print self.last_off
-            raise 'Invalid offsets file'
+    def meta(self, i):
+        """The connection of stream i as in pkts_to_streams, with the
+        time stamps of its first and last packets, or None if the
+        streamfile has no metadata."""
+        if not self.meta_map:
+            return None
+        import socket
+        (src, dst, sport, dport, type, status, pkts, first, last) = \
+              struct.unpack(META_FORMAT,
+                            self.meta_map[i * META_LEN:(i + 1) * META_LEN])
+        return {'connection': (socket.inet_ntoa(src), socket.inet_ntoa(dst),
+                               sport, dport),
+                'type': STREAM_TYPES[type],
+                'status': STREAM_STATUSES[status],
+                'pkts': pkts,
+                'ts': (first, last)}
 
     def next(self):
-        longlen = struct.calcsize('L')
-        packed = self.offsetsfile.read(longlen)
-        if len(packed) == 0: # end of file
-            # last stream is rest of the file
-            data = self.tracefile.read()
-
-            # if we've already gotten the last stream, return None
-            if len(data) == 0:
-                data = None
-            return data
-
-        (next_off,) = struct.unpack('L', packed)
-        length = next_off - self.last_off
-        self.last_off = next_off
-        return self.tracefile.read(length)
+        i = self.index
+        if i >= self.count:
+            return None
+        self.index = i + 1
+        if self.zero_copy:
+            return self.buffer(i)
+        return self.data[self.offsets[i]:self.offsets[i + 1]]
 
     def numstreams(self):
-        import os
-        s = os.fstat(self.offsetsfile.fileno())
-        return s.st_size // struct.calcsize('L')
+        return self.count
 
     def seek(self, streamno):
         assert(streamno < self.numstreams())
-        self.offsetsfile.seek(streamno * struct.calcsize('L'))
-        (self.last_off,) = struct.unpack('L', self.offsetsfile.read(struct.calcsize('L')))
-        self.tracefile.seek(self.last_off)
+        self.index = streamno
+
+    def stream_of(self, pos):
+        """(number of the stream holding data byte pos, start of the
+        next stream or None if it is the last one)"""
+        import bisect
+        i = bisect.bisect_right(self.offsets, pos, 0, self.count) - 1
+        if i + 1 >= self.count:
+            return (i, None)
+        return (i, self.offsets[i + 1])
 
 if __name__ == "__main__":
 #    import pkts_to_streams
@@ -130,29 +274,12 @@ if __name__ == "__main__":
 #    outfile.close()
 
     import polygraph.trace_crunching.pkts_to_streams as pkts_to_streams
-    import os
-    import struct
 
     dirname = sys.argv[1]
-    os.mkdir(dirname)
-    dataname = dirname + '/data'
-    datafile = open(dataname, 'w')
-    offname = dirname + '/offsets'
-    off_file = open(offname, 'w')
-
-    offset = 0
-    def callback(stream):
-        if len(stream['data']) > 0:
-            global offset
-            off_file.write(struct.pack('L', offset))
-            datafile.write(stream['data'])
-            offset += len(stream['data'])
-
-    for trace in sys.argv[2:]:
-        pkts_to_streams.process_trace(trace, 
-                                        callback=callback, 
-                                        timeout=60,
-                                        filter=None)
+    (datafile, off_file, meta_file) = create(dirname)
+
+    pkts_to_streams.write_streams(sys.argv[2:], datafile, off_file, 0,
+                                  timeout=60)
 
     off_file.close()
     datafile.close()
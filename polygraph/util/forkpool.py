@@ -0,0 +1,93 @@
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+import os
+import sys
+import pickle
+import tempfile
+
+class WorkerError(Exception):
+    pass
+
+def _dump(result, f):
+    """Pickle result to f, or, if part of it cannot be pickled, the
+    result with that part replaced by None."""
+    try:
+        s = pickle.dumps(result, True)
+    except (pickle.PicklingError, TypeError):
+        if type(result) is not tuple:
+            raise
+        s = pickle.dumps(tuple([_picklable(x) for x in result]), True)
+    f.write(s)
+
+def _picklable(x):
+    try:
+        pickle.dumps(x, True)
+        return x
+    except (pickle.PicklingError, TypeError):
+        return None
+
+def map_forked(fn, items, jobs=1):
+    """
+    [fn(item) for item in items], computed by jobs forked processes.
+
+    fn may be any callable, such as a closure: the workers inherit it
+    with the rest of the process. Worker k computes items k, k + jobs,
+    k + 2 * jobs, ..., so that runs of costly items are shared out,
+    and pickles its results to a file of its own; they come back in
+    the order of items whatever the number of workers. A part of a
+    tuple result that cannot be pickled comes back as None. Anything
+    fn changes in the worker's memory, like a cache, is lost.
+    """
+    items = list(items)
+    jobs = min(jobs, len(items))
+    if jobs <= 1 or not hasattr(os, 'fork'):
+        return [fn(item) for item in items]
+
+    sys.stdout.flush()
+    sys.stderr.flush()
+    workers = []
+    for k in xrange(jobs):
+        (fd, fname) = tempfile.mkstemp(prefix='forkpool')
+        pid = os.fork()
+        if pid == 0:
+            status = 0
+            try:
+                try:
+                    f = os.fdopen(fd, 'wb')
+                    for item in items[k::jobs]:
+                        _dump(fn(item), f)
+                    f.close()
+                except:
+                    import traceback
+                    traceback.print_exc()
+                    status = 1
+            finally:
+                sys.stdout.flush()
+                sys.stderr.flush()
+                os._exit(status)
+        os.close(fd)
+        workers.append((pid, fname))
+
+    results = [None] * len(items)
+    failed = 0
+    for (k, (pid, fname)) in enumerate(workers):
+        (pid, status) = os.waitpid(pid, 0)
+        if status != 0:
+            failed += 1
+        else:
+            f = open(fname, 'rb')
+            for i in xrange(k, len(items), jobs):
+                results[i] = pickle.load(f)
+            f.close()
+        os.unlink(fname)
+    if failed:
+        raise WorkerError("%d of %d workers failed" % (failed, jobs))
+    return results
@@ -0,0 +1,134 @@
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+import os
+try:
+    import fpstorec
+except ImportError:
+    fpstorec = None
+
+# estimates kept in memory by an EstimateStore
+MEMORY_ENTRIES = 4096
+
+# estimates a new store file has room for
+FILE_ENTRIES = 1 << 20
+
+def file_identity(filename):
+    """A string naming the current contents of filename: its path, size
+    and modification time. None if it does not exist."""
+    try:
+        st = os.stat(filename)
+    except OSError:
+        return None
+    return '%s:%d:%d' % (os.path.realpath(filename), st.st_size,
+                         int(st.st_mtime))
+
+class EstimateStore(object):
+    """
+    Estimates, such as the false positive rates of tokens, kept by
+    (source, estimator, token). source names the data the estimate was
+    made from, e.g. the file_identity of a trace, and estimator the way
+    it was made.
+
+    The last MEMORY_ENTRIES estimates used are kept in memory. With
+    filename, every estimate is also kept in that file, which is mapped
+    by every process opening it (see fpstore/fpstore.h), so concurrent
+    trials and later runs share their estimates. Estimates whose source
+    is None are only kept in memory.
+    """
+
+    def __init__(self, filename=None, entries=MEMORY_ENTRIES,
+                 file_entries=FILE_ENTRIES):
+        self.entries = max(entries, 1)
+        self.filename = filename
+
+        # key -> [prev, next, key, value], threaded on a ring from the
+        # most to the least recently used through the sentinel
+        self.table = {}
+        self.ring = [None, None, None, None]
+        self.ring[0] = self.ring[1] = self.ring
+
+        self.store = None
+        if filename:
+            if fpstorec is None:
+                raise ImportError("the fpstorec extension is not built")
+            # fpstorec itself may be gone by the time __del__ runs
+            self.fpstorec = fpstorec
+            self.store = fpstorec.open(filename, file_entries)
+
+    def __del__(self):
+        if getattr(self, 'store', None):
+            self.fpstorec.close(self.store)
+            self.store = None
+
+    def _unlink(self, node):
+        node[0][1] = node[1]
+        node[1][0] = node[0]
+
+    def _push(self, node):
+        node[0] = self.ring
+        node[1] = self.ring[1]
+        self.ring[1][0] = node
+        self.ring[1] = node
+
+    def _remember(self, key, value):
+        if self.table.has_key(key):
+            node = self.table[key]
+            node[3] = value
+            self._unlink(node)
+        else:
+            if len(self.table) >= self.entries:
+                lru = self.ring[0]
+                self._unlink(lru)
+                del self.table[lru[2]]
+            node = [None, None, key, value]
+            self.table[key] = node
+        self._push(node)
+
+    def get_many(self, source, estimator, tokens):
+        """Dictionary of the estimates of tokens that are known."""
+        found = {}
+        missing = []
+        for token in tokens:
+            key = (source, estimator, token)
+            if self.table.has_key(key):
+                node = self.table[key]
+                self._unlink(node)
+                self._push(node)
+                found[token] = node[3]
+            elif not found.has_key(token):
+                missing.append(token)
+
+        if self.store and source is not None and missing:
+            prefix = '%s\0%s\0' % (source, estimator)
+            for (token, value) in zip(missing,
+                                      fpstorec.get(self.store, prefix,
+                                                   missing)):
+                if value is not None:
+                    found[token] = value
+                    self._remember((source, estimator, token), value)
+        return found
+
+    def put_many(self, source, estimator, estimates):
+        """Keeps estimates, a dictionary token -> estimate."""
+        for (token, value) in estimates.items():
+            self._remember((source, estimator, token), value)
+        if self.store and source is not None and estimates:
+            prefix = '%s\0%s\0' % (source, estimator)
+            fpstorec.put(self.store, prefix, estimates.keys(),
+                         estimates.values())
+
+    def info(self):
+        """(estimates in memory, slots of the file, slots in use), the
+        last two None without a file"""
+        if self.store:
+            (slots, used) = fpstorec.info(self.store)
+            return (len(self.table), slots, used)
+        return (len(self.table), None, None)
@@ -54,23 +54,30 @@ class STree(object):
 
         if not prune:
             return token_counts
-        
-        # undo double counts due to tokens appearing inside other tokens
+        return prune_counts(token_counts, min_occ)
 
-        sorted_tokens = token_counts.keys()
-        sorted_tokens.sort(lambda x,y: cmp(len(y), len(x)))
+def prune_counts(token_counts, min_occ):
+    """
+    Undo the double counts common_sub finds for tokens inside other
+    tokens, dropping the tokens left in fewer than min_occ strings.
+    The counts are pruned in place, and returned.
+    """
+    # undo double counts due to tokens appearing inside other tokens
 
+    sorted_tokens = token_counts.keys()
+    sorted_tokens.sort(lambda x,y: cmp(len(y), len(x)))
 
-        for token_sub_i in xrange(len(sorted_tokens)):
-            token_sub = sorted_tokens[token_sub_i]
-            for token_super_i in xrange(token_sub_i):
-                token_super = sorted_tokens[token_super_i]
-                count = token_super.count(token_sub)
-                if not count: continue
-                for (string, super_count) in token_counts[token_super].items():
-                    token_counts[token_sub][string] -= super_count * count
 
-        
+    for token_sub_i in xrange(len(sorted_tokens)):
+        token_sub = sorted_tokens[token_sub_i]
+        for token_super_i in xrange(token_sub_i):
+            token_super = sorted_tokens[token_super_i]
+            count = token_super.count(token_sub)
+            if not count: continue
+            for (string, super_count) in token_counts[token_super].items():
+                token_counts[token_sub][string] -= super_count * count
+
+    
 #        token_tree = STree(sorted_tokens)
 #        # go through tokens from longest to shortest
 #        for token in sorted_tokens:
@@ -89,17 +96,17 @@ class STree(object):
 ##                    print "supertoken appears in string %d %d times" % (string, token_counts[super_token][string])
 #                    token_counts[token][string] -= token_counts[super_token][string] * count
 #        token_tree = None
-                        
-        # now prune out the tokens that no longer appear in enough
-        # distinct strings
-        for token in token_counts.keys():
-            unique_count = 0
-            for (string, count) in token_counts[token].items():
-                if count > 0:
-                    unique_count += 1
-                else:
-                    del(token_counts[token][string])
-            if unique_count < min_occ:
-                del(token_counts[token])
+                    
+    # now prune out the tokens that no longer appear in enough
+    # distinct strings
+    for token in token_counts.keys():
+        unique_count = 0
+        for (string, count) in token_counts[token].items():
+            if count > 0:
+                unique_count += 1
+            else:
+                del(token_counts[token][string])
+        if unique_count < min_occ:
+            del(token_counts[token])
 
-        return token_counts
+    return token_counts
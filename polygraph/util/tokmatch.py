@@ -0,0 +1,127 @@
+#      Polygraph (release 0.1)
+#      Signature generation algorithms for polymorphic worms
+#
+#      Copyright (c) 2004-2005, Intel Corporation
+#      All Rights Reserved
+#
+#  This software is distributed under the terms of the Eclipse Public
+#  License, Version 1.0 which can be found in the file named LICENSE.
+#  ANY USE, REPRODUCTION OR DISTRIBUTION OF THIS SOFTWARE CONSTITUTES
+#  RECIPIENT'S ACCEPTANCE OF THIS AGREEMENT
+import tokmatchc
+
+class BayesScorer(object):
+    """
+    The tokens and scores of a Bayes signature, compiled into a matcher
+    that scans a sample once (see tokmatch/tokmatch.h).
+    """
+    def __init__(self, token_scores):
+        # the order of the dictionary is the order of the sum
+        self.handle = None
+        self.handle = tokmatchc.bayes_new(token_scores.keys(),
+                                          token_scores.values())
+        # tokmatchc itself may be gone by the time __del__ runs
+        self.free = tokmatchc.bayes_free
+
+    def __del__(self):
+        if self.handle:
+            self.free(self.handle)
+            self.handle = None
+
+    def score(self, sample):
+        return tokmatchc.bayes_score(self.handle, sample)
+
+    def match(self, sample, threshold):
+        "score(sample) >= threshold, scanning no further than needed"
+        return tokmatchc.bayes_match(self.handle, sample, threshold)
+
+    def top_scores(self, streamfile, k, jobs=1):
+        """The k highest scores of the streams of streamfile, lowest
+        first, scored by jobs threads."""
+        import polygraph.trace_crunching.stream_trace as stream_trace
+        trace = stream_trace.StreamTrace(streamfile)
+        return tokmatchc.bayes_top(self.handle, streamfile + '/data',
+                                   trace.offsets, trace.offsets.itemsize,
+                                   k, jobs)
+
+class SignatureSet(object):
+    """
+    Signatures matched together: one scan of a sample screens it for
+    all of them (see tokmatch/tokmatch.h), and only the signatures it
+    passes for are matched as they would be alone. The screen of a
+    signature is given by its match_tokens method, (weights, need): a
+    sample can only match if the weights of the distinct tokens it
+    contains add up to need. A signature without one is always matched.
+    """
+    def __init__(self, sigs):
+        self.sigs = list(sigs)
+        tokens = []
+        owners = []
+        weights = []
+        need = []
+        for (i, sig) in enumerate(self.sigs):
+            screen = None
+            if hasattr(sig, 'match_tokens'):
+                screen = sig.match_tokens()
+            if screen is None:
+                need.append(0.0)
+                continue
+            (token_weights, sig_need) = screen
+            for (token, weight) in token_weights.items():
+                tokens.append(token)
+                owners.append(i)
+                weights.append(weight)
+            need.append(sig_need)
+        self.handle = None
+        self.handle = tokmatchc.set_new(tokens, owners, weights, need)
+        # tokmatchc itself may be gone by the time __del__ runs
+        self.free = tokmatchc.set_free
+
+    def __del__(self):
+        if self.handle:
+            self.free(self.handle)
+            self.handle = None
+
+    def candidates(self, sample):
+        "indexes of the signatures sample passes the screen of"
+        return tokmatchc.set_scan(self.handle, sample)
+
+    def matches(self, sample):
+        "indexes of the signatures matching sample, in increasing order"
+        return [i for i in tokmatchc.set_scan(self.handle, sample)
+                if self.sigs[i].match(sample)]
+
+class GapPattern(object):
+    """
+    Tokens in order, each a gap of exactly or at least some bytes after
+    the one before, the first from the start of the sample, matched in
+    one pass (see tokmatch/tokmatch.h): token i comes skips[i] bytes
+    after the one before, or at least that many if variable[i]. Empty
+    tokens only add to the next gap.
+    """
+    def __init__(self, tokens, skips, variable):
+        self.tokens = []
+        self.skips = []
+        self.variable = []
+        (skip, var) = (0, False)
+        for (token, token_skip, token_var) in zip(tokens, skips, variable):
+            skip += token_skip
+            var = var or token_var
+            if token:
+                self.tokens.append(token)
+                self.skips.append(skip)
+                self.variable.append(var)
+                (skip, var) = (0, False)
+        self.handle = None
+        self.handle = tokmatchc.gap_new(self.tokens, self.skips,
+                                        self.variable)
+        # tokmatchc itself may be gone by the time __del__ runs
+        self.free = tokmatchc.gap_free
+
+    def __del__(self):
+        if self.handle:
+            self.free(self.handle)
+            self.handle = None
+
+    def match(self, sample):
+        return tokmatchc.gap_match(self.handle, sample)
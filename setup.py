@@ -39,7 +39,31 @@ setup(name="Polygraph",
           Extension('polygraph.util.pysary', \
                     sources=['polygraph/pysary/pysary_wrap.c'],\
                     libraries=['sary', 'gthread', 'glib', 'pthread'],\
-                    include_dirs=dirs)
+                    include_dirs=dirs),
+          Extension('polygraph.util.sarytracec', \
+                    sources=['polygraph/sarytrace/sarytracec.c', \
+                             'polygraph/sarytrace/sarytrace.c', \
+                             'polygraph/sarytrace/fmindex.c'],\
+                    libraries=['sary', 'gthread', 'glib', 'pthread'],\
+                    include_dirs=dirs),
+          Extension('polygraph.util.pktstreamsc', \
+                    sources=['polygraph/pktstreams/pktstreamsc.c', \
+                             'polygraph/pktstreams/pktstreams.c'],\
+                    libraries=['pthread']),
+          Extension('polygraph.util.ctxmodelc', \
+                    sources=['polygraph/ctxmodel/ctxmodelc.c', \
+                             'polygraph/ctxmodel/ctxmodel.c'],\
+                    libraries=['pthread', 'm']),
+          Extension('polygraph.util.fsmprobc', \
+                    sources=['polygraph/fsmprob/fsmprobc.c', \
+                             'polygraph/fsmprob/fsmprob.c']),
+          Extension('polygraph.util.fpstorec', \
+                    sources=['polygraph/fpstore/fpstorec.c', \
+                             'polygraph/fpstore/fpstore.c']),
+          Extension('polygraph.util.tokmatchc', \
+                    sources=['polygraph/tokmatch/tokmatchc.c', \
+                             'polygraph/tokmatch/tokmatch.c'],\
+                    libraries=['pthread', 'm'])
       ],
       scripts=['polygraph/bin/reconstruct_streams']
      )